@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "bufpool.h"
+
+#include <stdlib.h>
+
+#ifdef SQFS_MULTITHREADED
+#include <pthread.h>
+#endif
+
+typedef struct sqfs_bufpool_internal {
+	size_t size, align;
+	size_t idle, count;	/* capacity and number of retained buffers */
+	size_t idle_max;	/* room in 'free' */
+	void **free;
+#ifdef SQFS_MULTITHREADED
+	pthread_mutex_t lock;
+#endif
+} sqfs_bufpool_internal;
+
+#ifdef SQFS_MULTITHREADED
+# define SQFS_BUFPOOL_LOCK(p) pthread_mutex_lock(&(p)->lock)
+# define SQFS_BUFPOOL_UNLOCK(p) pthread_mutex_unlock(&(p)->lock)
+#else
+# define SQFS_BUFPOOL_LOCK(p)
+# define SQFS_BUFPOOL_UNLOCK(p)
+#endif
+
+static void *sqfs_bufpool_alloc(sqfs_bufpool_internal *p) {
+#ifdef _WIN32
+	return _aligned_malloc(p->size, p->align);
+#else
+	void *buf;
+	if (posix_memalign(&buf, p->align, p->size))
+		return NULL;
+	return buf;
+#endif
+}
+
+static void sqfs_bufpool_free(void *buf) {
+#ifdef _WIN32
+	_aligned_free(buf);
+#else
+	free(buf);
+#endif
+}
+
+sqfs_err sqfs_bufpool_init(sqfs_bufpool *pool, size_t size, size_t align,
+		size_t idle) {
+	sqfs_bufpool_internal *p;
+
+	if (align < sizeof(void*) || (align & (align - 1)))
+		return SQFS_ERR;
+
+	if (!(p = calloc(1, sizeof(*p))))
+		return SQFS_ERR;
+	p->size = size;
+	p->align = align;
+	p->idle = idle;
+	p->idle_max = idle;
+	p->count = 0;
+	if (idle && !(p->free = calloc(idle, sizeof(void*)))) {
+		free(p);
+		return SQFS_ERR;
+	}
+#ifdef SQFS_MULTITHREADED
+	if (pthread_mutex_init(&p->lock, NULL)) {
+		free(p->free);
+		free(p);
+		return SQFS_ERR;
+	}
+#endif
+
+	*pool = p;
+	return SQFS_OK;
+}
+
+void sqfs_bufpool_destroy(sqfs_bufpool *pool) {
+	if (pool && *pool) {
+		sqfs_bufpool_internal *p = *pool;
+		while (p->count)
+			sqfs_bufpool_free(p->free[--p->count]);
+#ifdef SQFS_MULTITHREADED
+		pthread_mutex_destroy(&p->lock);
+#endif
+		free(p->free);
+		free(p);
+		*pool = NULL;
+	}
+}
+
+void sqfs_bufpool_idle_set(sqfs_bufpool *pool, size_t idle) {
+	sqfs_bufpool_internal *p = *pool;
+
+	if (idle > p->idle_max)
+		idle = p->idle_max;
+	SQFS_BUFPOOL_LOCK(p);
+	p->idle = idle;
+	while (p->count > idle)
+		sqfs_bufpool_free(p->free[--p->count]);
+	SQFS_BUFPOOL_UNLOCK(p);
+}
+
+size_t sqfs_bufpool_size(const sqfs_bufpool *pool) {
+	return (*pool)->size;
+}
+
+void *sqfs_bufpool_get(sqfs_bufpool *pool) {
+	sqfs_bufpool_internal *p = *pool;
+	void *buf = NULL;
+
+	SQFS_BUFPOOL_LOCK(p);
+	if (p->count)
+		buf = p->free[--p->count];
+	SQFS_BUFPOOL_UNLOCK(p);
+
+	if (!buf)
+		buf = sqfs_bufpool_alloc(p);
+	return buf;
+}
+
+void sqfs_bufpool_put(sqfs_bufpool *pool, void *buf) {
+	sqfs_bufpool_internal *p = *pool;
+
+	SQFS_BUFPOOL_LOCK(p);
+	if (p->count < p->idle) {
+		p->free[p->count++] = buf;
+		buf = NULL;
+	}
+	SQFS_BUFPOOL_UNLOCK(p);
+
+	if (buf)
+		sqfs_bufpool_free(buf);
+}
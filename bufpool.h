@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_BUFPOOL_H
+#define SQFS_BUFPOOL_H
+
+#include "common.h"
+
+/* Pool of fixed-size, aligned buffers
+ *  - Buffers that are put back are kept for reuse, up to a limit
+ *  - Thread safe in multithreaded builds
+ */
+
+/* Create a pool of buffers of 'size' bytes, aligned to 'align' (a power of
+ * two). At most 'idle' unused buffers are retained. */
+sqfs_err sqfs_bufpool_init(sqfs_bufpool *pool, size_t size, size_t align,
+	size_t idle);
+void sqfs_bufpool_destroy(sqfs_bufpool *pool);
+
+/* Retain at most 'idle' unused buffers from now on, up to the number given
+ * at init, freeing any extra now */
+void sqfs_bufpool_idle_set(sqfs_bufpool *pool, size_t idle);
+
+/* Size of each buffer in the pool */
+size_t sqfs_bufpool_size(const sqfs_bufpool *pool);
+
+/* Get a buffer, or NULL if out of memory */
+void *sqfs_bufpool_get(sqfs_bufpool *pool);
+/* Return a buffer obtained from sqfs_bufpool_get() */
+void sqfs_bufpool_put(sqfs_bufpool *pool, void *buf);
+
+#endif
@@ -31,8 +31,11 @@
 
 #include "fs.h"
 
+#include "nonstd.h"
+
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 typedef struct sqfs_cache_internal {
 	uint8_t *buf;
@@ -40,12 +43,16 @@ typedef struct sqfs_cache_internal {
 	sqfs_cache_dispose dispose;
 
 	size_t size, count;
+	size_t limit; /* entries in use */
 	size_t next; /* next block to evict */
+
+	sqfs_cache_counters stats;
 } sqfs_cache_internal;
 
 typedef struct {
 	int valid;
 	sqfs_cache_idx idx;
+	uint64_t miss_ns; /* when it was last missed */
 } sqfs_cache_entry_hdr;
 
 sqfs_err sqfs_cache_init(sqfs_cache *cache, size_t size, size_t count,
@@ -58,8 +65,10 @@ sqfs_err sqfs_cache_init(sqfs_cache *cache, size_t size, size_t count,
 
 	c->size = size + sizeof(sqfs_cache_entry_hdr);
 	c->count = count;
+	c->limit = count;
 	c->dispose = dispose;
 	c->next = 0;
+	memset(&c->stats, 0, sizeof(c->stats));
 
 	c->buf = calloc(count, c->size);
 
@@ -106,29 +115,65 @@ void *sqfs_cache_get(sqfs_cache *cache, sqfs_cache_idx idx) {
 	sqfs_cache_internal *c = *cache;
 	sqfs_cache_entry_hdr *hdr;
 
-	for (i = 0; i < c->count; ++i) {
+	for (i = 0; i < c->limit; ++i) {
 		hdr = sqfs_cache_entry_header(c, i);
-		if (hdr->idx == idx) {
-			assert(hdr->valid);
+		/* Entries dropped by sqfs_cache_limit() keep a stale idx */
+		if (hdr->valid && hdr->idx == idx) {
+			++c->stats.hits;
 			return sqfs_cache_entry(c, i);
 		}
 	}
+	++c->stats.misses;
 
 	/* No existing entry; free one if necessary, allocate a new one. */
 	i = (c->next++);
-	c->next %= c->count;
+	c->next %= c->limit;
 
 	hdr = sqfs_cache_entry_header(c, i);
 	if (hdr->valid) {
 		/* evict */
 		c->dispose((void *)(hdr + 1));
 		hdr->valid = 0;
+		++c->stats.evictions;
 	}
 
 	hdr->idx = idx;
+	hdr->miss_ns = sqfs_clock_ns();
 	return (void *)(hdr + 1);
 }
 
+size_t sqfs_cache_count(const sqfs_cache *cache) {
+	return (*cache)->count;
+}
+
+void sqfs_cache_limit(sqfs_cache *cache, size_t count) {
+	sqfs_cache_internal *c = *cache;
+	size_t i;
+
+	if (count < 1)
+		count = 1;
+	if (count > c->count)
+		count = c->count;
+	for (i = count; i < c->limit; ++i) {
+		sqfs_cache_entry_hdr *hdr = sqfs_cache_entry_header(c, i);
+		if (hdr->valid) {
+			c->dispose((void *)(hdr + 1));
+			hdr->valid = 0;
+		}
+	}
+	c->limit = count;
+	c->next %= count;
+}
+
+void sqfs_cache_stats(const sqfs_cache *cache, sqfs_cache_counters *stats) {
+	*stats = (*cache)->stats;
+	stats->entries = (*cache)->limit;
+}
+
+void sqfs_cache_count_bytes(sqfs_cache *cache, size_t bytes) {
+	(*cache)->stats.bytes += bytes;
+}
+
 int sqfs_cache_entry_valid(const sqfs_cache *cache, const void *e) {
 	sqfs_cache_entry_hdr *hdr = ((sqfs_cache_entry_hdr *)e) - 1;
 	return hdr->valid;
@@ -138,6 +183,8 @@ void sqfs_cache_entry_mark_valid(sqfs_cache *cache, void *e) {
 	sqfs_cache_entry_hdr *hdr = ((sqfs_cache_entry_hdr *)e) - 1;
 	assert(hdr->valid == 0);
 	hdr->valid = 1;
+	++(*cache)->stats.fills;
+	(*cache)->stats.fill_ns += sqfs_clock_ns() - hdr->miss_ns;
 }
 
 void sqfs_cache_put(const sqfs_cache *cache, const void *e) {
@@ -61,6 +61,32 @@ void *sqfs_cache_get(sqfs_cache *cache, sqfs_cache_idx idx);
 /* inform cache it is now safe to evict this entry. */
 void sqfs_cache_put(const sqfs_cache *cache, const void *e);
 
+/* Number of entries the cache was created with */
+size_t sqfs_cache_count(const sqfs_cache *cache);
+
+/* Use only 'count' of those entries, at least one, evicting the others.
+ * Passing a larger count, up to the original one, makes room again. Safe to
+ * call while other threads use the cache. */
+void sqfs_cache_limit(sqfs_cache *cache, size_t count);
+
+/* What a cache has been doing, since it was created */
+typedef struct {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;	/* valid entries displaced by a miss */
+	uint64_t fills;		/* misses marked valid */
+	uint64_t fill_ns;	/* time from miss to mark valid, in total */
+	uint64_t bytes;		/* reported by sqfs_cache_count_bytes() */
+	size_t entries;		/* current limit */
+} sqfs_cache_counters;
+
+/* Sum up the counters. In multithreaded builds they're kept per thread, so
+ * counting is cheap, and the sum is approximate while the cache is busy. */
+void sqfs_cache_stats(const sqfs_cache *cache, sqfs_cache_counters *stats);
+
+/* Count bytes produced to fill entries, usually the amount decompressed */
+void sqfs_cache_count_bytes(sqfs_cache *cache, size_t bytes);
+
 /* Determine if cache entry contains valid contents. */
 int sqfs_cache_entry_valid(const sqfs_cache *cache, const void *e);
 /* Mark cache entry as containing valid contents. */
@@ -10,23 +10,50 @@
 
 #include "cache.h"
 #include "fs.h"
+#include "nonstd.h"
+#include "probe.h"
+#include "trace.h"
 
 #include <assert.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Counters are split up by thread, each on its own cache line */
+#define SQFS_CACHE_SHARDS 16
+typedef union {
+    sqfs_cache_counters counters;
+    char pad[128];
+} sqfs_cache_shard;
 
 typedef struct sqfs_cache_internal {
     uint8_t *buf;
     sqfs_cache_dispose dispose;
     size_t entry_size, count;
+    size_t limit; /* entries in use, changed by sqfs_cache_limit() */
+    sqfs_cache_shard shards[SQFS_CACHE_SHARDS];
 } sqfs_cache_internal;
 
 typedef struct {
     enum { EMPTY, FULL } state;
     sqfs_cache_idx idx;
+    uint64_t miss_ns; /* when it was last missed */
     pthread_mutex_t lock;
 } sqfs_cache_entry_hdr;
 
+/* Give each thread its own shard of counters, until they run out */
+static sqfs_cache_counters *sqfs_cache_shard_get(sqfs_cache_internal *c) {
+    static unsigned next_shard;
+    static __thread unsigned shard; /* one more than the shard number */
+    if (!shard)
+        shard = __atomic_add_fetch(&next_shard, 1, __ATOMIC_RELAXED);
+    return &c->shards[(shard - 1) % SQFS_CACHE_SHARDS].counters;
+}
+
+/* Shards may still be shared, so count atomically */
+#define SQFS_CACHE_COUNT(c, field, n) \
+    __atomic_fetch_add(&sqfs_cache_shard_get(c)->field, (n), __ATOMIC_RELAXED)
+
 // MurmurHash64A performance-optimized for hash of uint64_t keys
 const static uint64_t kMurmur2Seed = 4193360111ul;
 static uint64_t MurmurRehash64A(uint64_t key) {
@@ -60,7 +87,7 @@ sqfs_err sqfs_cache_init(sqfs_cache *cache, size_t entry_size, size_t count,
              sqfs_cache_dispose dispose) {
     size_t i;
     pthread_mutexattr_t attr;
-    sqfs_cache_internal *c = malloc(sizeof(sqfs_cache_internal));
+    sqfs_cache_internal *c = calloc(1, sizeof(sqfs_cache_internal));
 
     if (!c) {
         return SQFS_ERR;
@@ -68,6 +95,7 @@ sqfs_err sqfs_cache_init(sqfs_cache *cache, size_t entry_size, size_t count,
 
     c->entry_size = entry_size + sizeof(sqfs_cache_entry_hdr);
     c->count = count;
+    c->limit = count;
     c->dispose = dispose;
 
     pthread_mutexattr_init(&attr);
@@ -125,31 +153,94 @@ void *sqfs_cache_get(sqfs_cache *cache, sqfs_cache_idx idx) {
     sqfs_cache_entry_hdr *hdr;
     void *entry;
 
-    uint64_t key = MurmurRehash64A(idx) % c->count;
+    uint64_t key = MurmurRehash64A(idx) %
+        __atomic_load_n(&c->limit, __ATOMIC_RELAXED);
 
     hdr = sqfs_cache_entry_header(c, key);
-    if (pthread_mutex_lock(&hdr->lock)) { assert(0); }
+    SQFS_PROBE2(cache__lock__start, c, idx);
+    if (pthread_mutex_trylock(&hdr->lock)) {
+        /* Someone else holds it, maybe while filling it */
+        uint64_t span = sqfs_trace_begin();
+        if (pthread_mutex_lock(&hdr->lock)) { assert(0); }
+        if (span)
+            sqfs_trace_span(span, "cache", "lock_wait", "key", idx, NULL, 0);
+    }
+    SQFS_PROBE2(cache__lock__done, c, idx);
     /* matching unlock is in sqfs_cache_put() */
     entry = (void *)(hdr + 1);
 
     if (hdr->state == EMPTY) {
+        SQFS_CACHE_COUNT(c, misses, 1);
         hdr->idx = idx;
+        hdr->miss_ns = sqfs_clock_ns();
         return entry;
     }
 
     /* There's a valid entry: it's either a cache hit or a collision. */
     assert(hdr->state == FULL);
     if (hdr->idx == idx) {
+        SQFS_CACHE_COUNT(c, hits, 1);
         return entry;
     }
 
     /* Collision. */
+    SQFS_CACHE_COUNT(c, misses, 1);
+    SQFS_CACHE_COUNT(c, evictions, 1);
     c->dispose((void *)(hdr + 1));
     hdr->state = EMPTY;
     hdr->idx = idx;
+    hdr->miss_ns = sqfs_clock_ns();
     return entry;
 }
 
+size_t sqfs_cache_count(const sqfs_cache *cache) {
+    return (*cache)->count;
+}
+
+void sqfs_cache_limit(sqfs_cache *cache, size_t count) {
+    sqfs_cache_internal *c = *cache;
+    size_t i;
+
+    if (count < 1)
+        count = 1;
+    if (count > c->count)
+        count = c->count;
+    __atomic_store_n(&c->limit, count, __ATOMIC_RELAXED);
+
+    /* A get that saw the old limit may still fill one of these, then
+     * sqfs_cache_put() drops it */
+    for (i = count; i < c->count; ++i) {
+        sqfs_cache_entry_hdr *hdr = sqfs_cache_entry_header(c, i);
+        if (pthread_mutex_lock(&hdr->lock)) { assert(0); }
+        if (hdr->state == FULL) {
+            c->dispose((void *)(hdr + 1));
+            hdr->state = EMPTY;
+        }
+        if (pthread_mutex_unlock(&hdr->lock)) { assert(0); }
+    }
+}
+
+void sqfs_cache_stats(const sqfs_cache *cache, sqfs_cache_counters *stats) {
+    sqfs_cache_internal *c = *cache;
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < SQFS_CACHE_SHARDS; ++i) {
+        sqfs_cache_counters *s = &c->shards[i].counters;
+        stats->hits += __atomic_load_n(&s->hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&s->misses, __ATOMIC_RELAXED);
+        stats->evictions += __atomic_load_n(&s->evictions, __ATOMIC_RELAXED);
+        stats->fills += __atomic_load_n(&s->fills, __ATOMIC_RELAXED);
+        stats->fill_ns += __atomic_load_n(&s->fill_ns, __ATOMIC_RELAXED);
+        stats->bytes += __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+    }
+    stats->entries = __atomic_load_n(&c->limit, __ATOMIC_RELAXED);
+}
+
+void sqfs_cache_count_bytes(sqfs_cache *cache, size_t bytes) {
+    SQFS_CACHE_COUNT(*cache, bytes, bytes);
+}
+
 int sqfs_cache_entry_valid(const sqfs_cache *cache, const void *e) {
     sqfs_cache_entry_hdr *hdr = ((sqfs_cache_entry_hdr *)e) - 1;
     return hdr->state == FULL;
@@ -159,10 +250,22 @@ void sqfs_cache_entry_mark_valid(sqfs_cache *cache, void *e) {
     sqfs_cache_entry_hdr *hdr = ((sqfs_cache_entry_hdr *)e) - 1;
     assert(hdr->state == EMPTY);
     hdr->state = FULL;
+    SQFS_CACHE_COUNT(*cache, fills, 1);
+    SQFS_CACHE_COUNT(*cache, fill_ns, sqfs_clock_ns() - hdr->miss_ns);
 }
 
 void sqfs_cache_put(const sqfs_cache *cache, const void *e) {
+    sqfs_cache_internal *c = *cache;
     sqfs_cache_entry_hdr *hdr = ((sqfs_cache_entry_hdr *)e) - 1;
+    size_t slot = ((uint8_t *)hdr - c->buf) / c->entry_size;
+
+    /* sqfs_cache_limit() shrank the cache while we held this slot, so it
+     * would otherwise stay filled beyond the limit */
+    if (slot >= __atomic_load_n(&c->limit, __ATOMIC_RELAXED) &&
+            hdr->state == FULL) {
+        c->dispose((void *)(hdr + 1));
+        hdr->state = EMPTY;
+    }
     if (pthread_mutex_unlock(&hdr->lock)) { assert(0); }
 }
 
@@ -0,0 +1,662 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "squashfuse.h"
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Replay a trace of block accesses against simulated caches, to see how
+ * big each cache should be and which policy would suit it.
+ *
+ * The trace comes from squashfuse_ll -o profile_record=FILE,profile_all, or
+ * else is made by reading every file in the image. */
+
+#define PROGNAME "squashfuse_cachesim"
+
+#define ERR_MISC	(-1)
+#define ERR_USAGE	(-2)
+#define ERR_OPEN	(-3)
+
+/* Size of the reads when making a trace, as large as FUSE's */
+#define CACHESIM_READ_SIZE (128 * 1024)
+
+#define NIL ((uint32_t)-1)
+
+static void usage() {
+	fprintf(stderr, "%s (c) 2026 Dave Vasilevsky\n\n", PROGNAME);
+	fprintf(stderr, "Usage: %s [options] ARCHIVE [TRACE]\n\n", PROGNAME);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "    -p POLICY,...   policies to compare: rr, direct, lru, clock, arc\n");
+	fprintf(stderr, "                    (default: all of them)\n");
+	fprintf(stderr, "    -s N,...        cache sizes to try, in blocks\n");
+	fprintf(stderr, "                    (default: powers of two, up to what the trace uses)\n");
+	fprintf(stderr, "    -w FILE         with no TRACE, keep the trace made in FILE\n");
+	exit(ERR_USAGE);
+}
+
+static void die(const char *msg) {
+	fprintf(stderr, "%s\n", msg);
+	exit(ERR_MISC);
+}
+
+/* Map from block position to slot, open addressed */
+typedef struct {
+	uint64_t *keys;	/* one more than the key, zero is empty */
+	uint32_t *vals;
+	size_t mask;
+} cachesim_map;
+
+static uint64_t cachesim_hash(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key;
+}
+
+static void cachesim_map_init(cachesim_map *m, size_t count) {
+	size_t cap = 16;
+	while (cap < count * 2)
+		cap *= 2;
+	m->keys = calloc(cap, sizeof(*m->keys));
+	m->vals = malloc(cap * sizeof(*m->vals));
+	if (!m->keys || !m->vals)
+		die("Out of memory");
+	m->mask = cap - 1;
+}
+
+static void cachesim_map_destroy(cachesim_map *m) {
+	free(m->keys);
+	free(m->vals);
+}
+
+static size_t cachesim_map_find(const cachesim_map *m, uint64_t key) {
+	size_t i = cachesim_hash(key) & m->mask;
+	while (m->keys[i] && m->keys[i] != key + 1)
+		i = (i + 1) & m->mask;
+	return i;
+}
+
+static uint32_t cachesim_map_get(const cachesim_map *m, uint64_t key) {
+	size_t i = cachesim_map_find(m, key);
+	return m->keys[i] ? m->vals[i] : NIL;
+}
+
+static void cachesim_map_put(cachesim_map *m, uint64_t key, uint32_t val) {
+	size_t i = cachesim_map_find(m, key);
+	m->keys[i] = key + 1;
+	m->vals[i] = val;
+}
+
+/* Remove, shifting back any later entries that would no longer be found */
+static void cachesim_map_del(cachesim_map *m, uint64_t key) {
+	size_t i = cachesim_map_find(m, key), j = i;
+	if (!m->keys[i])
+		return;
+	m->keys[i] = 0;
+	for (;;) {
+		size_t home;
+		j = (j + 1) & m->mask;
+		if (!m->keys[j])
+			break;
+		home = cachesim_hash(m->keys[j] - 1) & m->mask;
+		if (((j - home) & m->mask) >= ((j - i) & m->mask)) {
+			m->keys[i] = m->keys[j];
+			m->vals[i] = m->vals[j];
+			m->keys[j] = 0;
+			i = j;
+		}
+	}
+}
+
+/* Doubly linked lists of nodes, most recent at the head */
+typedef struct {
+	uint64_t key;
+	uint32_t prev, next;
+	int list;
+	int ref;	/* for clock */
+} cachesim_node;
+
+typedef struct {
+	uint32_t head, tail;
+	size_t len;
+} cachesim_list;
+
+typedef struct {
+	cachesim_node *nodes;
+	cachesim_list lists[4];
+	uint32_t used;
+	cachesim_map map;
+} cachesim_pool;
+
+static void cachesim_pool_init(cachesim_pool *p, size_t count) {
+	int i;
+	if (!(p->nodes = malloc(count * sizeof(*p->nodes))))
+		die("Out of memory");
+	for (i = 0; i < 4; ++i) {
+		p->lists[i].head = p->lists[i].tail = NIL;
+		p->lists[i].len = 0;
+	}
+	p->used = 0;
+	cachesim_map_init(&p->map, count);
+}
+
+static void cachesim_pool_destroy(cachesim_pool *p) {
+	free(p->nodes);
+	cachesim_map_destroy(&p->map);
+}
+
+static void cachesim_unlink(cachesim_pool *p, uint32_t n) {
+	cachesim_node *node = &p->nodes[n];
+	cachesim_list *l = &p->lists[node->list];
+	if (node->prev == NIL)
+		l->head = node->next;
+	else
+		p->nodes[node->prev].next = node->next;
+	if (node->next == NIL)
+		l->tail = node->prev;
+	else
+		p->nodes[node->next].prev = node->prev;
+	--l->len;
+}
+
+static void cachesim_push(cachesim_pool *p, int list, uint32_t n) {
+	cachesim_node *node = &p->nodes[n];
+	cachesim_list *l = &p->lists[list];
+	node->list = list;
+	node->prev = NIL;
+	node->next = l->head;
+	if (l->head == NIL)
+		l->tail = n;
+	else
+		p->nodes[l->head].prev = n;
+	l->head = n;
+	++l->len;
+}
+
+static void cachesim_move(cachesim_pool *p, int list, uint32_t n) {
+	cachesim_unlink(p, n);
+	cachesim_push(p, list, n);
+}
+
+/* A node for a new key: a fresh one, or else the least recent in 'list' */
+static uint32_t cachesim_take(cachesim_pool *p, int list, uint64_t key,
+		size_t count) {
+	uint32_t n;
+	if (p->used < count) {
+		n = p->used++;
+		p->nodes[n].list = list;
+		cachesim_push(p, list, n);
+	} else {
+		n = p->lists[list].tail;
+		cachesim_map_del(&p->map, p->nodes[n].key);
+	}
+	p->nodes[n].key = key;
+	p->nodes[n].ref = 0;
+	cachesim_map_put(&p->map, key, n);
+	return n;
+}
+
+/* Each policy counts the hits it gets from a trace */
+typedef uint64_t (*cachesim_policy)(const uint64_t *keys, size_t n,
+	size_t size);
+
+/* Round robin, like the single-threaded cache: evict in turn */
+static uint64_t cachesim_rr(const uint64_t *keys, size_t n, size_t size) {
+	cachesim_pool p;
+	uint64_t hits = 0;
+	size_t i;
+
+	cachesim_pool_init(&p, size);
+	for (i = 0; i < n; ++i) {
+		if (cachesim_map_get(&p.map, keys[i]) != NIL) {
+			++hits;
+		} else {
+			uint32_t node = cachesim_take(&p, 0, keys[i], size);
+			/* Insertion order is eviction order */
+			cachesim_move(&p, 0, node);
+		}
+	}
+	cachesim_pool_destroy(&p);
+	return hits;
+}
+
+/* Direct mapped, like the multithreaded cache, with the same hash */
+static uint64_t cachesim_direct_hash(uint64_t key) {
+	const uint64_t m = 0xc6a4a7935bd1e995;
+	const int r = 47;
+	uint64_t h = (uint64_t)4193360111ul ^ (sizeof(uint64_t) * m);
+	key *= m;
+	key ^= key >> r;
+	key *= m;
+	h ^= key;
+	h *= m;
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+static uint64_t cachesim_direct(const uint64_t *keys, size_t n, size_t size) {
+	uint64_t *slots = calloc(size, sizeof(*slots)), hits = 0;
+	size_t i;
+
+	if (!slots)
+		die("Out of memory");
+	for (i = 0; i < n; ++i) {
+		uint64_t *slot = &slots[cachesim_direct_hash(keys[i]) % size];
+		if (*slot == keys[i] + 1)
+			++hits;
+		else
+			*slot = keys[i] + 1;
+	}
+	free(slots);
+	return hits;
+}
+
+static uint64_t cachesim_lru(const uint64_t *keys, size_t n, size_t size) {
+	cachesim_pool p;
+	uint64_t hits = 0;
+	size_t i;
+
+	cachesim_pool_init(&p, size);
+	for (i = 0; i < n; ++i) {
+		uint32_t node = cachesim_map_get(&p.map, keys[i]);
+		if (node != NIL)
+			++hits;
+		else
+			node = cachesim_take(&p, 0, keys[i], size);
+		cachesim_move(&p, 0, node);
+	}
+	cachesim_pool_destroy(&p);
+	return hits;
+}
+
+/* Second chance: a hit sets a bit, eviction skips and clears those set */
+static uint64_t cachesim_clock(const uint64_t *keys, size_t n, size_t size) {
+	cachesim_pool p;
+	uint64_t hits = 0;
+	uint32_t hand = 0;
+	size_t i;
+
+	cachesim_pool_init(&p, size);
+	for (i = 0; i < n; ++i) {
+		uint32_t node = cachesim_map_get(&p.map, keys[i]);
+		if (node != NIL) {
+			++hits;
+			p.nodes[node].ref = 1;
+		} else if (p.used < size) {
+			cachesim_take(&p, 0, keys[i], size);
+		} else {
+			while (p.nodes[hand].ref) {
+				p.nodes[hand].ref = 0;
+				hand = (hand + 1) % size;
+			}
+			cachesim_map_del(&p.map, p.nodes[hand].key);
+			p.nodes[hand].key = keys[i];
+			cachesim_map_put(&p.map, keys[i], hand);
+			hand = (hand + 1) % size;
+		}
+	}
+	cachesim_pool_destroy(&p);
+	return hits;
+}
+
+/* Adaptive replacement cache, after Megiddo and Modha. T1 and T2 hold
+ * blocks seen once and more than once, B1 and B2 remember what they
+ * evicted, and 'target' is how big T1 should be. */
+enum { ARC_T1, ARC_T2, ARC_B1, ARC_B2 };
+
+static void cachesim_arc_replace(cachesim_pool *p, size_t target,
+		bool in_b2) {
+	size_t t1 = p->lists[ARC_T1].len;
+	if (t1 && ((in_b2 && t1 == target) || t1 > target ||
+			!p->lists[ARC_T2].len))
+		cachesim_move(p, ARC_B1, p->lists[ARC_T1].tail);
+	else
+		cachesim_move(p, ARC_B2, p->lists[ARC_T2].tail);
+}
+
+/* Forget the least recent node of 'list', so it can be reused */
+static uint32_t cachesim_arc_drop(cachesim_pool *p, int list) {
+	uint32_t n = p->lists[list].tail;
+	cachesim_map_del(&p->map, p->nodes[n].key);
+	cachesim_unlink(p, n);
+	return n;
+}
+
+static uint64_t cachesim_arc(const uint64_t *keys, size_t n, size_t size) {
+	cachesim_pool p;
+	cachesim_list *l = p.lists;
+	uint64_t hits = 0;
+	size_t i, target = 0;
+
+	cachesim_pool_init(&p, 2 * size);
+	for (i = 0; i < n; ++i) {
+		uint64_t key = keys[i];
+		uint32_t node = cachesim_map_get(&p.map, key);
+		size_t delta;
+
+		if (node != NIL && (p.nodes[node].list == ARC_T1 ||
+				p.nodes[node].list == ARC_T2)) {
+			++hits;
+			cachesim_move(&p, ARC_T2, node);
+		} else if (node != NIL && p.nodes[node].list == ARC_B1) {
+			delta = l[ARC_B1].len >= l[ARC_B2].len ? 1 :
+				l[ARC_B2].len / l[ARC_B1].len;
+			target = target + delta > size ? size : target + delta;
+			cachesim_arc_replace(&p, target, false);
+			cachesim_move(&p, ARC_T2, node);
+		} else if (node != NIL) {
+			delta = l[ARC_B2].len >= l[ARC_B1].len ? 1 :
+				l[ARC_B1].len / l[ARC_B2].len;
+			target = target > delta ? target - delta : 0;
+			cachesim_arc_replace(&p, target, true);
+			cachesim_move(&p, ARC_T2, node);
+		} else {
+			size_t total = l[ARC_T1].len + l[ARC_T2].len + l[ARC_B1].len +
+				l[ARC_B2].len;
+			uint32_t reuse = NIL;
+			if (l[ARC_T1].len + l[ARC_B1].len == size) {
+				if (l[ARC_T1].len < size) {
+					reuse = cachesim_arc_drop(&p, ARC_B1);
+					cachesim_arc_replace(&p, target, false);
+				} else {
+					reuse = cachesim_arc_drop(&p, ARC_T1);
+				}
+			} else if (total >= size) {
+				if (total == 2 * size)
+					reuse = cachesim_arc_drop(&p, ARC_B2);
+				cachesim_arc_replace(&p, target, false);
+			}
+
+			if (reuse == NIL) {
+				node = p.used++;
+			} else {
+				node = reuse;
+			}
+			p.nodes[node].key = key;
+			cachesim_push(&p, ARC_T1, node);
+			cachesim_map_put(&p.map, key, node);
+		}
+	}
+	cachesim_pool_destroy(&p);
+	return hits;
+}
+
+static const struct {
+	const char *name;
+	cachesim_policy run;
+} cachesim_policies[] = {
+	{ "rr", cachesim_rr },
+	{ "direct", cachesim_direct },
+	{ "lru", cachesim_lru },
+	{ "clock", cachesim_clock },
+	{ "arc", cachesim_arc },
+};
+#define CACHESIM_POLICIES \
+	(sizeof(cachesim_policies) / sizeof(cachesim_policies[0]))
+
+/* The accesses to one cache */
+typedef struct {
+	const char *name;
+	const char *option;	/* to set its size */
+	size_t block_size;
+	uint64_t *keys;
+	size_t count, cap;
+} cachesim_trace;
+
+static void cachesim_trace_add(cachesim_trace *t, uint64_t key) {
+	if (t->count == t->cap) {
+		t->cap = t->cap ? t->cap * 2 : 4096;
+		if (!(t->keys = realloc(t->keys, t->cap * sizeof(*t->keys))))
+			die("Out of memory");
+	}
+	t->keys[t->count++] = key;
+}
+
+static size_t cachesim_distinct(const cachesim_trace *t) {
+	cachesim_map m;
+	size_t i, distinct = 0;
+	cachesim_map_init(&m, t->count);
+	for (i = 0; i < t->count; ++i) {
+		if (cachesim_map_get(&m, t->keys[i]) == NIL) {
+			cachesim_map_put(&m, t->keys[i], 0);
+			++distinct;
+		}
+	}
+	cachesim_map_destroy(&m);
+	return distinct;
+}
+
+/* Read everything in the image, recording each block access */
+static void cachesim_make_trace(sqfs *fs, const char *path) {
+	sqfs_traverse trv;
+	sqfs_err err;
+	uint64_t id;
+	char *buf;
+
+	if (!(buf = malloc(CACHESIM_READ_SIZE)))
+		die("Out of memory");
+	if (sqfs_image_id(fs, &id))
+		die("Can't read the image's metadata tables");
+	if (sqfs_profile_record_open(&fs->profile, path, id, true))
+		die("Can't write trace");
+	if (sqfs_traverse_open(&trv, fs, sqfs_inode_root(fs)))
+		die("sqfs_traverse_open error");
+	while (sqfs_traverse_next(&trv, &err)) {
+		sqfs_inode inode;
+		sqfs_off_t off, size;
+
+		if (trv.dir_end)
+			continue;
+		if (sqfs_inode_get(fs, &inode, sqfs_dentry_inode(&trv.entry)))
+			die("sqfs_inode_get error");
+		if (!S_ISREG(inode.base.mode))
+			continue;
+		for (off = 0; off < (sqfs_off_t)inode.xtra.reg.file_size;
+				off += CACHESIM_READ_SIZE) {
+			size = CACHESIM_READ_SIZE;
+			if (sqfs_read_range(fs, &inode, off, &size, buf))
+				die("sqfs_read_range error");
+		}
+	}
+	if (err)
+		die("sqfs_traverse_next error");
+	sqfs_traverse_close(&trv);
+	sqfs_profile_destroy(&fs->profile);
+	free(buf);
+}
+
+static void cachesim_load(const char *path, cachesim_trace *traces) {
+	char line[256];
+	FILE *f;
+
+	if (!(f = fopen(path, "r")))
+		die("Can't read trace");
+	while (fgets(line, sizeof(line), f)) {
+		sqfs_profile_entry e;
+		if (sqfs_profile_parse(line, &e))
+			cachesim_trace_add(&traces[e.kind], e.pos);
+	}
+	if (ferror(f))
+		die("Can't read trace");
+	fclose(f);
+}
+
+static void cachesim_print_size(size_t bytes) {
+	char buf[32];
+	if (bytes >= 1024 * 1024)
+		sprintf(buf, "%.1fM", bytes / (1024.0 * 1024));
+	else
+		sprintf(buf, "%zuK", bytes / 1024);
+	printf("  %9s", buf);
+}
+
+/* Hit rates for each size. With 'fit', stop once everything fits. */
+static void cachesim_report(const cachesim_trace *t, const size_t *sizes,
+		size_t nsizes, const bool *use, bool fit) {
+	size_t distinct, i, p;
+
+	if (!t->count)
+		return;
+	distinct = cachesim_distinct(t);
+	printf("# %s cache: %zu accesses, %zu blocks, %zu bytes each\n",
+		t->name, t->count, distinct, t->block_size);
+	if (t->option)
+		printf("# set its size with -o %s=N\n", t->option);
+	else
+		printf("# its size is fixed at build time\n");
+	printf("# %8s  %9s", "entries", "memory");
+	for (p = 0; p < CACHESIM_POLICIES; ++p)
+		if (use[p])
+			printf("  %7s", cachesim_policies[p].name);
+	printf("\n");
+
+	for (i = 0; i < nsizes; ++i) {
+		printf("  %8zu", sizes[i]);
+		cachesim_print_size(sizes[i] * t->block_size);
+		for (p = 0; p < CACHESIM_POLICIES; ++p) {
+			if (use[p]) {
+				uint64_t hits = cachesim_policies[p].run(t->keys, t->count,
+					sizes[i]);
+				printf("  %7.4f", (double)hits / t->count);
+			}
+		}
+		printf("\n");
+		if (fit && sizes[i] >= distinct)
+			break;
+	}
+	printf("\n");
+}
+
+static void cachesim_parse_sizes(char *arg, size_t **sizes, size_t *count) {
+	char *tok;
+	*count = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		size_t n = strtoul(tok, NULL, 10);
+		if (!n)
+			usage();
+		if (!(*sizes = realloc(*sizes, (*count + 1) * sizeof(**sizes))))
+			die("Out of memory");
+		(*sizes)[(*count)++] = n;
+	}
+}
+
+static void cachesim_parse_policies(char *arg, bool *use) {
+	char *tok;
+	size_t p;
+	memset(use, 0, CACHESIM_POLICIES * sizeof(*use));
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		for (p = 0; p < CACHESIM_POLICIES; ++p) {
+			if (strcmp(tok, cachesim_policies[p].name) == 0)
+				break;
+		}
+		if (p == CACHESIM_POLICIES)
+			usage();
+		use[p] = true;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	cachesim_trace traces[3];
+	bool use[CACHESIM_POLICIES];
+	size_t *sizes = NULL, nsizes = 0, i;
+	const char *image, *trace = NULL, *keep = NULL;
+	char tmp[] = "/tmp/squashfuse_cachesim.XXXXXX";
+	bool fit;
+	sqfs fs;
+	int a;
+
+	for (i = 0; i < CACHESIM_POLICIES; ++i)
+		use[i] = true;
+	for (a = 1; a < argc && argv[a][0] == '-'; a += 2) {
+		if (a + 1 >= argc)
+			usage();
+		if (strcmp(argv[a], "-p") == 0)
+			cachesim_parse_policies(argv[a + 1], use);
+		else if (strcmp(argv[a], "-s") == 0)
+			cachesim_parse_sizes(argv[a + 1], &sizes, &nsizes);
+		else if (strcmp(argv[a], "-w") == 0)
+			keep = argv[a + 1];
+		else
+			usage();
+	}
+	if (a == argc || argc - a > 2)
+		usage();
+	image = argv[a];
+	if (argc - a == 2)
+		trace = argv[a + 1];
+
+	if (sqfs_open_image(&fs, image, 0))
+		exit(ERR_OPEN);
+
+	if (!trace) {
+		if (keep) {
+			trace = keep;
+		} else {
+			int fd = mkstemp(tmp);
+			if (fd == -1)
+				die("Can't make a temporary file");
+			close(fd);
+			trace = tmp;
+		}
+		cachesim_make_trace(&fs, trace);
+	}
+
+	memset(traces, 0, sizeof(traces));
+	traces[SQFS_PROFILE_MD].name = "metadata";
+	traces[SQFS_PROFILE_MD].block_size = SQUASHFS_METADATA_SIZE;
+	traces[SQFS_PROFILE_DATA].name = "data";
+	traces[SQFS_PROFILE_DATA].option = "data_cache";
+	traces[SQFS_PROFILE_DATA].block_size = fs.sb.block_size;
+	traces[SQFS_PROFILE_FRAG].name = "fragment";
+	traces[SQFS_PROFILE_FRAG].option = "frag_cache";
+	traces[SQFS_PROFILE_FRAG].block_size = fs.sb.block_size;
+	cachesim_load(trace, traces);
+	if (trace == tmp)
+		unlink(tmp);
+
+	fit = !nsizes;
+	if (!nsizes) {
+		size_t n;
+		for (n = 1; n <= (1 << 20); n *= 2) {
+			if (!(sizes = realloc(sizes, (nsizes + 1) * sizeof(*sizes))))
+				die("Out of memory");
+			sizes[nsizes++] = n;
+		}
+	}
+
+	for (i = 0; i < 3; ++i) {
+		cachesim_report(&traces[i], sizes, nsizes, use, fit);
+		free(traces[i].keys);
+	}
+	free(sizes);
+	sqfs_destroy(&fs);
+	return 0;
+}
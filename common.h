@@ -67,6 +67,14 @@ typedef uint32_t sqfs_inode_num;
 typedef struct sqfs sqfs;
 typedef struct sqfs_inode sqfs_inode;
 
+/* Handles to parts of sqfs that are opaque outside the library */
+typedef struct sqfs_bufpool_internal *sqfs_bufpool;
+typedef struct sqfs_diskcache_internal *sqfs_diskcache;
+typedef struct sqfs_shmcache_internal *sqfs_shmcache;
+typedef struct sqfs_profile_internal *sqfs_profile;
+typedef struct sqfs_prefetch_internal *sqfs_prefetch;
+typedef struct sqfs_mempressure_internal *sqfs_mempressure;
+
 typedef struct {
 	size_t size;
 	void *data;
@@ -78,6 +86,12 @@ typedef struct {
 	size_t offset;
 } sqfs_md_cursor;
 
+/* SHA-256 digest, identifying content that may be shared between images */
+#define SQFS_DIGEST_SIZE 32
+typedef struct {
+	unsigned char bytes[SQFS_DIGEST_SIZE];
+} sqfs_digest;
+
 /* Increment the refcount on the block. */
 static inline void sqfs_block_ref(sqfs_block *block) {
 	atomic_inc_relaxed(&block->refcount);
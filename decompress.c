@@ -27,6 +27,7 @@
 #include "squashfs_fs.h"
 #include "swap.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #if _WIN32
@@ -50,6 +51,68 @@ static sqfs_err sqfs_decompressor_zlib(void *in, size_t insz,
 #endif
 
 
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+
+/* Blocks are always whole, with a known maximum size, which is just what
+ * libdeflate wants. Its decompressors can't be shared, so each thread gets
+ * its own. */
+#ifdef SQFS_MULTITHREADED
+#include <pthread.h>
+
+static pthread_key_t sqfs_libdeflate_key;
+static pthread_once_t sqfs_libdeflate_once = PTHREAD_ONCE_INIT;
+static bool sqfs_libdeflate_key_ok;
+
+static void sqfs_libdeflate_free(void *d) {
+	libdeflate_free_decompressor(d);
+}
+
+static void sqfs_libdeflate_key_init(void) {
+	sqfs_libdeflate_key_ok =
+		!pthread_key_create(&sqfs_libdeflate_key, &sqfs_libdeflate_free);
+}
+
+static struct libdeflate_decompressor *sqfs_libdeflate_get(void) {
+	struct libdeflate_decompressor *d;
+	pthread_once(&sqfs_libdeflate_once, &sqfs_libdeflate_key_init);
+	if (!sqfs_libdeflate_key_ok)
+		return NULL;
+	if (!(d = pthread_getspecific(sqfs_libdeflate_key))) {
+		if (!(d = libdeflate_alloc_decompressor()))
+			return NULL;
+		if (pthread_setspecific(sqfs_libdeflate_key, d)) {
+			libdeflate_free_decompressor(d);
+			return NULL;
+		}
+	}
+	return d;
+}
+#else
+static struct libdeflate_decompressor *sqfs_libdeflate_get(void) {
+	static struct libdeflate_decompressor *d;
+	if (!d)
+		d = libdeflate_alloc_decompressor();
+	return d;
+}
+#endif
+
+static sqfs_err sqfs_decompressor_libdeflate(void *in, size_t insz,
+		void *out, size_t *outsz) {
+	struct libdeflate_decompressor *d = sqfs_libdeflate_get();
+	size_t got;
+	if (!d)
+		return SQFS_ERR;
+	if (libdeflate_zlib_decompress(d, in, insz, out, *outsz, &got)
+			!= LIBDEFLATE_SUCCESS)
+		return SQFS_ERR;
+	*outsz = got;
+	return SQFS_OK;
+}
+#define CAN_DECOMPRESS_LIBDEFLATE 1
+#endif
+
+
 #ifdef HAVE_LZMA_H
 #include <lzma.h>
 
@@ -172,30 +235,287 @@ static sqfs_err sqfs_decompressor_zstd(void *in, size_t insz,
 #define CAN_DECOMPRESS_ZSTD 1
 #endif
 
-sqfs_decompressor sqfs_decompressor_get(sqfs_compression_type type) {
-	switch (type) {
+/* Implementations of the same type are together, preferred first */
+static const sqfs_decompressor_impl sqfs_decompressor_all[] = {
+#ifdef CAN_DECOMPRESS_LIBDEFLATE
+	{ ZLIB_COMPRESSION, "libdeflate", &sqfs_decompressor_libdeflate },
+#endif
 #ifdef CAN_DECOMPRESS_ZLIB
-		case ZLIB_COMPRESSION: return &sqfs_decompressor_zlib;
+	{ ZLIB_COMPRESSION, "zlib", &sqfs_decompressor_zlib },
 #endif
 #ifdef CAN_DECOMPRESS_LZMA
-		case LZMA_COMPRESSION: return &sqfs_decompressor_lzma;
+	{ LZMA_COMPRESSION, "lzma", &sqfs_decompressor_lzma },
 #endif
 #ifdef CAN_DECOMPRESS_LZO
-		case LZO_COMPRESSION: return &sqfs_decompressor_lzo;
+	{ LZO_COMPRESSION, "lzo", &sqfs_decompressor_lzo },
 #endif
 #ifdef CAN_DECOMPRESS_XZ
-		case XZ_COMPRESSION: return &sqfs_decompressor_xz;
+	{ XZ_COMPRESSION, "xz", &sqfs_decompressor_xz },
 #endif
 #ifdef CAN_DECOMPRESS_LZ4
-		case LZ4_COMPRESSION: return &sqfs_decompressor_lz4;
+	{ LZ4_COMPRESSION, "lz4", &sqfs_decompressor_lz4 },
+#endif
+#ifdef CAN_DECOMPRESS_ZSTD
+	{ ZSTD_COMPRESSION, "zstd", &sqfs_decompressor_zstd },
+#endif
+	{ SQFS_COMP_UNKNOWN, NULL, NULL }
+};
+
+size_t sqfs_decompressor_impls(sqfs_compression_type type,
+		const sqfs_decompressor_impl **impls) {
+	size_t i, count = 0;
+	*impls = NULL;
+	if (type == SQFS_COMP_UNKNOWN)
+		return 0;
+	for (i = 0; sqfs_decompressor_all[i].name; ++i) {
+		if (sqfs_decompressor_all[i].type == type) {
+			if (!count++)
+				*impls = &sqfs_decompressor_all[i];
+		} else if (count) {
+			break;
+		}
+	}
+	return count;
+}
+
+sqfs_decompressor sqfs_decompressor_get(sqfs_compression_type type) {
+	const sqfs_decompressor_impl *impls;
+	if (!sqfs_decompressor_impls(type, &impls))
+		return NULL;
+	return impls->decompress;
+}
+
+/* Decode in steps of at least this much, so a run of small reads doesn't
+ * resume the decoder for each one */
+#define SQFS_STREAM_STEP (32 * 1024)
+
+typedef struct sqfs_stream_internal sqfs_stream_internal;
+
+typedef struct {
+	sqfs_err (*init)(sqfs_stream_internal *s, size_t outsz);
+	/* Decode into out until *outpos reaches 'limit' or the block ends */
+	sqfs_err (*decode)(sqfs_stream_internal *s, char *out, size_t *outpos,
+		size_t limit, bool *done);
+	void (*end)(sqfs_stream_internal *s);
+} sqfs_stream_ops;
+
+struct sqfs_stream_internal {
+	const sqfs_stream_ops *ops;
+	char *in;
+	size_t insz;
+	union {
+		int unused;
+#ifdef CAN_DECOMPRESS_ZLIB
+		z_stream zlib;
+#endif
+#ifdef CAN_DECOMPRESS_XZ
+		lzma_stream xz;
+#endif
+#ifdef CAN_DECOMPRESS_ZSTD
+		struct {
+			ZSTD_DStream *ds;
+			size_t inpos;
+		} zstd;
+#endif
+	} u;
+};
+
+
+#ifdef CAN_DECOMPRESS_ZLIB
+static sqfs_err sqfs_stream_zlib_init(sqfs_stream_internal *s, size_t outsz) {
+	memset(&s->u.zlib, 0, sizeof(s->u.zlib));
+	s->u.zlib.next_in = (Bytef*)s->in;
+	s->u.zlib.avail_in = s->insz;
+	return inflateInit(&s->u.zlib) == Z_OK ? SQFS_OK : SQFS_ERR;
+}
+
+static sqfs_err sqfs_stream_zlib_decode(sqfs_stream_internal *s, char *out,
+		size_t *outpos, size_t limit, bool *done) {
+	int zerr;
+	s->u.zlib.next_out = (Bytef*)out + *outpos;
+	s->u.zlib.avail_out = limit - *outpos;
+	zerr = inflate(&s->u.zlib, Z_SYNC_FLUSH);
+	*outpos = limit - s->u.zlib.avail_out;
+	if (zerr == Z_STREAM_END)
+		*done = true;
+	else if (zerr != Z_OK)
+		return SQFS_ERR;
+	return SQFS_OK;
+}
+
+static void sqfs_stream_zlib_end(sqfs_stream_internal *s) {
+	inflateEnd(&s->u.zlib);
+}
+
+static const sqfs_stream_ops sqfs_stream_zlib = {
+	&sqfs_stream_zlib_init, &sqfs_stream_zlib_decode, &sqfs_stream_zlib_end
+};
+#endif
+
+
+#ifdef CAN_DECOMPRESS_XZ
+static sqfs_err sqfs_stream_xz_init(sqfs_stream_internal *s, size_t outsz) {
+	lzma_stream init = LZMA_STREAM_INIT;
+	s->u.xz = init;
+	if (lzma_stream_decoder(&s->u.xz, UINT64_MAX, 0) != LZMA_OK)
+		return SQFS_ERR;
+	s->u.xz.next_in = (uint8_t*)s->in;
+	s->u.xz.avail_in = s->insz;
+	return SQFS_OK;
+}
+
+static sqfs_err sqfs_stream_xz_decode(sqfs_stream_internal *s, char *out,
+		size_t *outpos, size_t limit, bool *done) {
+	lzma_ret err;
+	s->u.xz.next_out = (uint8_t*)out + *outpos;
+	s->u.xz.avail_out = limit - *outpos;
+	err = lzma_code(&s->u.xz, LZMA_FINISH);
+	*outpos = limit - s->u.xz.avail_out;
+	if (err == LZMA_STREAM_END)
+		*done = true;
+	else if (err != LZMA_OK)
+		return SQFS_ERR;
+	return SQFS_OK;
+}
+
+static void sqfs_stream_xz_end(sqfs_stream_internal *s) {
+	lzma_end(&s->u.xz);
+}
+
+static const sqfs_stream_ops sqfs_stream_xz = {
+	&sqfs_stream_xz_init, &sqfs_stream_xz_decode, &sqfs_stream_xz_end
+};
 #endif
+
+
 #ifdef CAN_DECOMPRESS_ZSTD
-		case ZSTD_COMPRESSION: return &sqfs_decompressor_zstd;
+static sqfs_err sqfs_stream_zstd_init(sqfs_stream_internal *s, size_t outsz) {
+	s->u.zstd.inpos = 0;
+	if (!(s->u.zstd.ds = ZSTD_createDStream()))
+		return SQFS_ERR;
+	if (ZSTD_isError(ZSTD_initDStream(s->u.zstd.ds))) {
+		ZSTD_freeDStream(s->u.zstd.ds);
+		return SQFS_ERR;
+	}
+	return SQFS_OK;
+}
+
+static sqfs_err sqfs_stream_zstd_decode(sqfs_stream_internal *s, char *out,
+		size_t *outpos, size_t limit, bool *done) {
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer o;
+	size_t ret;
+
+	in.src = s->in;
+	in.size = s->insz;
+	in.pos = s->u.zstd.inpos;
+	o.dst = out;
+	o.size = limit;
+	o.pos = *outpos;
+	ret = ZSTD_decompressStream(s->u.zstd.ds, &o, &in);
+	if (ZSTD_isError(ret))
+		return SQFS_ERR;
+	s->u.zstd.inpos = in.pos;
+	*outpos = o.pos;
+	if (ret == 0)
+		*done = true;
+	return SQFS_OK;
+}
+
+static void sqfs_stream_zstd_end(sqfs_stream_internal *s) {
+	ZSTD_freeDStream(s->u.zstd.ds);
+}
+
+static const sqfs_stream_ops sqfs_stream_zstd = {
+	&sqfs_stream_zstd_init, &sqfs_stream_zstd_decode, &sqfs_stream_zstd_end
+};
+#endif
+
+static const sqfs_stream_ops *sqfs_stream_ops_get(sqfs_compression_type type) {
+	switch (type) {
+#ifdef CAN_DECOMPRESS_ZLIB
+		case ZLIB_COMPRESSION: return &sqfs_stream_zlib;
+#endif
+#ifdef CAN_DECOMPRESS_XZ
+		case XZ_COMPRESSION: return &sqfs_stream_xz;
+#endif
+		/* Not LZ4, which can't resume. Decoding a longer prefix each time
+		 * would start over, costing more than the whole block. */
+#ifdef CAN_DECOMPRESS_ZSTD
+		case ZSTD_COMPRESSION: return &sqfs_stream_zstd;
 #endif
 		default: return NULL;
 	}
 }
 
+bool sqfs_stream_supported(sqfs_compression_type type) {
+	return sqfs_stream_ops_get(type) != NULL;
+}
+
+sqfs_err sqfs_stream_init(sqfs_stream *s, sqfs_compression_type type,
+		const void *in, size_t insz, size_t outsz) {
+	const sqfs_stream_ops *ops = sqfs_stream_ops_get(type);
+	sqfs_stream_internal *st;
+
+	*s = NULL;
+	if (!ops)
+		return SQFS_UNSUP;
+	if (!(st = malloc(sizeof(*st))))
+		return SQFS_ERR;
+	if (!(st->in = malloc(insz ? insz : 1))) {
+		free(st);
+		return SQFS_ERR;
+	}
+	memcpy(st->in, in, insz);
+	st->insz = insz;
+	st->ops = ops;
+	if (ops->init(st, outsz)) {
+		free(st->in);
+		free(st);
+		return SQFS_ERR;
+	}
+	*s = st;
+	return SQFS_OK;
+}
+
+void sqfs_stream_destroy(sqfs_stream *s) {
+	if (s && *s) {
+		(*s)->ops->end(*s);
+		free((*s)->in);
+		free(*s);
+		*s = NULL;
+	}
+}
+
+sqfs_err sqfs_stream_decode(sqfs_stream *s, void *out, size_t outsz,
+		size_t want, size_t *outpos, bool *done) {
+	sqfs_stream_internal *st = *s;
+	size_t limit;
+
+	*done = false;
+	if (want > outsz)
+		want = outsz;
+	limit = want + SQFS_STREAM_STEP - 1;
+	limit -= limit % SQFS_STREAM_STEP;
+	if (limit > outsz || limit < want)
+		limit = outsz;
+
+	while (!*done && *outpos < want) {
+		size_t before = *outpos;
+		if (st->ops->decode(st, out, outpos, limit, done))
+			return SQFS_ERR;
+		if (!*done && *outpos == before)
+			return SQFS_ERR; /* all the input is there, so it's stuck */
+	}
+
+	/* A full buffer may just mean the end is still to be checked */
+	if (!*done && *outpos == outsz) {
+		if (st->ops->decode(st, out, outpos, outsz, done) || !*done)
+			return SQFS_ERR;
+	}
+	return SQFS_OK;
+}
+
 static char *const sqfs_compression_names[SQFS_COMP_MAX] = {
 	NULL, "zlib", "lzma", "lzo", "xz", "lz4", "zstd",
 };
@@ -209,7 +529,7 @@ char *sqfs_compression_name(sqfs_compression_type type) {
 void sqfs_compression_supported(sqfs_compression_type *types) {
 	size_t i = 0;
 	memset(types, SQFS_COMP_UNKNOWN, SQFS_COMP_MAX * sizeof(*types));
-#ifdef CAN_DECOMPRESS_ZLIB
+#if defined(CAN_DECOMPRESS_ZLIB) || defined(CAN_DECOMPRESS_LIBDEFLATE)
 	types[i++] = ZLIB_COMPRESSION;
 #endif
 #ifdef CAN_DECOMPRESS_LZMA
@@ -41,6 +41,41 @@ void sqfs_compression_supported(sqfs_compression_type *types);
 typedef sqfs_err (*sqfs_decompressor)(void *in, size_t insz,
 	void *out, size_t *outsz);
 
+/* The preferred implementation for this type, or NULL if there's none */
 sqfs_decompressor sqfs_decompressor_get(sqfs_compression_type type);
 
+/* Every implementation built in, so they can be compared */
+typedef struct {
+	sqfs_compression_type type;
+	const char *name;
+	sqfs_decompressor decompress;
+} sqfs_decompressor_impl;
+
+/* Point *impls at the implementations for this type, preferred first, and
+ * return how many there are */
+size_t sqfs_decompressor_impls(sqfs_compression_type type,
+	const sqfs_decompressor_impl **impls);
+
+
+/* Incremental decompression of a single block, so that a prefix of it can be
+ * decoded without the rest, and extended later. */
+struct sqfs_stream_internal;
+typedef struct sqfs_stream_internal *sqfs_stream;
+
+/* Can blocks of this type be decoded incrementally? */
+bool sqfs_stream_supported(sqfs_compression_type type);
+
+/* Start decoding the 'insz' bytes at 'in', which are copied, into a block of
+ * at most 'outsz' bytes. Returns SQFS_UNSUP if this type can't be decoded
+ * incrementally. */
+sqfs_err sqfs_stream_init(sqfs_stream *s, sqfs_compression_type type,
+	const void *in, size_t insz, size_t outsz);
+void sqfs_stream_destroy(sqfs_stream *s);
+
+/* Continue decoding into 'out', which has room for 'outsz' bytes and already
+ * holds the first *outpos, until it holds at least 'want' or the block ends.
+ * Sets *done once the whole block is decoded. */
+sqfs_err sqfs_stream_decode(sqfs_stream *s, void *out, size_t outsz,
+	size_t want, size_t *outpos, bool *done);
+
 #endif
@@ -26,6 +26,7 @@
 
 #include "fs.h"
 #include "swap.h"
+#include "trace.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -254,7 +255,7 @@ static sqfs_err sqfs_dir_ff_name_f(sqfs *fs, sqfs_md_cursor *cur,
 	return SQFS_OK;
 }
 
-sqfs_err sqfs_dir_lookup(sqfs *fs, sqfs_inode *inode,
+static sqfs_err sqfs_dir_lookup_entry(sqfs *fs, sqfs_inode *inode,
 		const char *name, size_t namelen, sqfs_dir_entry *entry, bool *found) {
 	sqfs_err err;
 	sqfs_dir dir;
@@ -284,6 +285,17 @@ sqfs_err sqfs_dir_lookup(sqfs *fs, sqfs_inode *inode,
 	return err;
 }
 
+sqfs_err sqfs_dir_lookup(sqfs *fs, sqfs_inode *inode,
+		const char *name, size_t namelen, sqfs_dir_entry *entry, bool *found) {
+	uint64_t span = sqfs_trace_begin();
+	sqfs_err err = sqfs_dir_lookup_entry(fs, inode, name, namelen, entry,
+		found);
+	if (span)
+		sqfs_trace_span(span, "dir", "lookup", "dir", inode->base.inode_number,
+			"found", *found);
+	return err;
+}
+
 
 sqfs_err sqfs_lookup_path_with_id(sqfs *fs, sqfs_inode *inode, const char *path,
 		bool *found, sqfs_inode_id *id) {
@@ -0,0 +1,496 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "diskcache.h"
+
+#include "fs.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(SQFS_MULTITHREADED) && !defined(_WIN32)
+# define SQFS_DISKCACHE_WRITER 1
+# include <pthread.h>
+#endif
+
+#define SQFS_DISKCACHE_MAGIC 0x43445153 /* "SQDC" */
+#define SQFS_DISKCACHE_VERSION 2
+
+/* Seconds after which a temporary file's writer must be gone */
+#define SQFS_DISKCACHE_STALE 60
+
+#ifdef SQFS_DISKCACHE_WRITER
+/* Blocks waiting to be written, beyond which new ones are dropped */
+#define SQFS_DISKCACHE_QUEUE 64
+
+typedef struct {
+	sqfs_off_t pos;
+	bool has_digest;
+	sqfs_digest digest;
+	size_t aux;
+	sqfs_block *block;
+} sqfs_diskcache_job;
+#endif
+
+typedef struct sqfs_diskcache_internal {
+	char *top; /* shared by all images */
+	char *dir; /* per-image directory */
+	uint64_t limit; /* bytes under top, zero for no limit */
+	uint64_t used; /* last counted, plus what we wrote since */
+#ifdef SQFS_DISKCACHE_WRITER
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running, stop;
+	sqfs_diskcache_job queue[SQFS_DISKCACHE_QUEUE]; /* ring */
+	size_t head, queued;
+#endif
+} sqfs_diskcache_internal;
+
+/* Stored in native byte order, the magic rejects foreign files */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t pos;
+	uint64_t size;
+	uint64_t aux;
+	sqfs_digest digest; /* zero if stored without one */
+	uint64_t sum;
+} sqfs_diskcache_hdr;
+
+static uint64_t sqfs_diskcache_sum(const sqfs_diskcache_hdr *hdr,
+		const void *data) {
+	uint64_t h = SQFS_HASH_BYTES_INIT;
+	h = sqfs_hash_bytes(h, &hdr->pos, sizeof(hdr->pos));
+	h = sqfs_hash_bytes(h, &hdr->size, sizeof(hdr->size));
+	h = sqfs_hash_bytes(h, &hdr->aux, sizeof(hdr->aux));
+	h = sqfs_hash_bytes(h, &hdr->digest, sizeof(hdr->digest));
+	return sqfs_hash_bytes(h, data, hdr->size);
+}
+
+#ifdef _WIN32
+
+sqfs_err sqfs_diskcache_init(sqfs_diskcache *dc, const char *dir,
+		uint64_t id, uint64_t limit) {
+	return SQFS_UNSUP;
+}
+
+void sqfs_diskcache_destroy(sqfs_diskcache *dc) {
+}
+
+bool sqfs_diskcache_get(sqfs_diskcache *dc, sqfs_off_t pos,
+		const sqfs_digest *check, size_t *aux, sqfs_block **block) {
+	return false;
+}
+
+void sqfs_diskcache_put(sqfs_diskcache *dc, sqfs_off_t pos,
+		const sqfs_digest *digest, size_t aux, sqfs_block *block) {
+}
+
+#else
+
+#define SQFS_DISKCACHE_PATH_MAX 4096
+
+/* Entry and image directory names are 16 hex digits */
+static bool sqfs_diskcache_hex(const char *name, uint64_t *v) {
+	if (strlen(name) != 16 || strspn(name, "0123456789abcdef") != 16)
+		return false;
+	*v = strtoull(name, NULL, 16);
+	return true;
+}
+
+typedef struct {
+	time_t used;
+	uint64_t size;
+	uint64_t id, pos;
+} sqfs_diskcache_file;
+
+typedef struct {
+	sqfs_diskcache_file *files;
+	size_t count, cap;
+	uint64_t total;
+} sqfs_diskcache_list;
+
+/* Remove temporary files left by writers that died in the image directory
+ * 'dir'. If 'list' isn't NULL, also add the entries to it. */
+static void sqfs_diskcache_scan(const char *dir, uint64_t id,
+		sqfs_diskcache_list *list) {
+	char path[SQFS_DISKCACHE_PATH_MAX];
+	time_t now = time(NULL);
+	struct dirent *e;
+	struct stat st;
+	uint64_t pos;
+	DIR *dp;
+
+	if (!(dp = opendir(dir)))
+		return;
+	while ((e = readdir(dp))) {
+		sqfs_diskcache_file *f;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		if (strncmp(e->d_name, "tmp.", 4) == 0) {
+			if (lstat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+					now - st.st_mtime > SQFS_DISKCACHE_STALE)
+				unlink(path);
+			continue;
+		}
+		if (!list || !sqfs_diskcache_hex(e->d_name, &pos))
+			continue;
+		if (lstat(path, &st) == -1 || !S_ISREG(st.st_mode))
+			continue;
+
+		if (list->count == list->cap) {
+			size_t cap = list->cap ? list->cap * 2 : 1024;
+			sqfs_diskcache_file *files = realloc(list->files,
+				cap * sizeof(*files));
+			if (!files)
+				continue;
+			list->files = files;
+			list->cap = cap;
+		}
+		f = &list->files[list->count++];
+		/* Reads only update atime on some filesystems, and not often */
+		f->used = st.st_atime > st.st_mtime ? st.st_atime : st.st_mtime;
+		f->size = st.st_size;
+		f->id = id;
+		f->pos = pos;
+		list->total += f->size;
+	}
+	closedir(dp);
+}
+
+static int sqfs_diskcache_older(const void *a, const void *b) {
+	const sqfs_diskcache_file *fa = a, *fb = b;
+	return fa->used < fb->used ? -1 : fa->used > fb->used;
+}
+
+/* Count what every image has under the top directory, and if that's over
+ * the limit, remove the least recently used entries until there's some
+ * room to spare. Other processes write here too, so this is approximate. */
+static void sqfs_diskcache_trim(sqfs_diskcache_internal *d) {
+	char path[SQFS_DISKCACHE_PATH_MAX];
+	sqfs_diskcache_list list;
+	struct dirent *e;
+	uint64_t id;
+	size_t i;
+	DIR *dp;
+
+	memset(&list, 0, sizeof(list));
+	if ((dp = opendir(d->top))) {
+		while ((e = readdir(dp))) {
+			if (!sqfs_diskcache_hex(e->d_name, &id))
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", d->top, e->d_name);
+			sqfs_diskcache_scan(path, id, &list);
+		}
+		closedir(dp);
+	}
+
+	if (list.total > d->limit) {
+		uint64_t target = d->limit - d->limit / 8;
+		qsort(list.files, list.count, sizeof(*list.files),
+			sqfs_diskcache_older);
+		for (i = 0; i < list.count && list.total > target; ++i) {
+			sqfs_diskcache_file *f = &list.files[i];
+			snprintf(path, sizeof(path), "%s/%016llx/%016llx", d->top,
+				(unsigned long long)f->id, (unsigned long long)f->pos);
+			if (unlink(path) == 0 || errno == ENOENT)
+				list.total -= f->size;
+		}
+	}
+	free(list.files);
+	d->used = list.total;
+}
+
+sqfs_err sqfs_diskcache_init(sqfs_diskcache *dc, const char *dir,
+		uint64_t id, uint64_t limit) {
+	sqfs_diskcache_internal *d;
+	size_t len;
+
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+		return SQFS_ERR;
+
+	if (!(d = calloc(1, sizeof(*d))))
+		return SQFS_ERR;
+	len = strlen(dir) + 1 + 16 + 1;
+	if (!(d->top = strdup(dir)) || !(d->dir = malloc(len))) {
+		free(d->top);
+		free(d);
+		return SQFS_ERR;
+	}
+	snprintf(d->dir, len, "%s/%016llx", dir, (unsigned long long)id);
+	if (mkdir(d->dir, 0755) == -1 && errno != EEXIST)
+		goto error;
+#ifdef SQFS_DISKCACHE_WRITER
+	if (pthread_mutex_init(&d->lock, NULL))
+		goto error;
+	if (pthread_cond_init(&d->cond, NULL)) {
+		pthread_mutex_destroy(&d->lock);
+		goto error;
+	}
+#endif
+
+	d->limit = limit;
+	if (limit)
+		sqfs_diskcache_trim(d);
+	else
+		sqfs_diskcache_scan(d->dir, id, NULL);
+
+	*dc = d;
+	return SQFS_OK;
+
+error:
+	free(d->dir);
+	free(d->top);
+	free(d);
+	return SQFS_ERR;
+}
+
+void sqfs_diskcache_destroy(sqfs_diskcache *dc) {
+	sqfs_diskcache_internal *d;
+	if (!dc || !*dc)
+		return;
+	d = *dc;
+
+#ifdef SQFS_DISKCACHE_WRITER
+	/* The writer empties the queue before it notices */
+	if (d->running) {
+		pthread_mutex_lock(&d->lock);
+		d->stop = true;
+		pthread_cond_signal(&d->cond);
+		pthread_mutex_unlock(&d->lock);
+		pthread_join(d->thread, NULL);
+	}
+	pthread_cond_destroy(&d->cond);
+	pthread_mutex_destroy(&d->lock);
+#endif
+	free(d->dir);
+	free(d->top);
+	free(d);
+	*dc = NULL;
+}
+
+static void sqfs_diskcache_path(sqfs_diskcache_internal *d, sqfs_off_t pos,
+		char *path) {
+	snprintf(path, SQFS_DISKCACHE_PATH_MAX, "%s/%016llx", d->dir,
+		(unsigned long long)pos);
+}
+
+static bool sqfs_diskcache_readall(int fd, void *buf, size_t size) {
+	while (size) {
+		ssize_t got = read(fd, buf, size);
+		if (got <= 0) {
+			if (got == -1 && errno == EINTR)
+				continue;
+			return false;
+		}
+		buf = (char*)buf + got;
+		size -= got;
+	}
+	return true;
+}
+
+static bool sqfs_diskcache_writeall(int fd, const void *buf, size_t size) {
+	while (size) {
+		ssize_t put = write(fd, buf, size);
+		if (put <= 0) {
+			if (put == -1 && errno == EINTR)
+				continue;
+			return false;
+		}
+		buf = (const char*)buf + put;
+		size -= put;
+	}
+	return true;
+}
+
+bool sqfs_diskcache_get(sqfs_diskcache *dc, sqfs_off_t pos,
+		const sqfs_digest *check, size_t *aux, sqfs_block **block) {
+	char path[SQFS_DISKCACHE_PATH_MAX];
+	sqfs_diskcache_hdr hdr;
+	sqfs_block *b = NULL;
+	int fd;
+
+	sqfs_diskcache_path(*dc, pos, path);
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return false;
+
+	if (!sqfs_diskcache_readall(fd, &hdr, sizeof(hdr)))
+		goto miss;
+	if (hdr.magic != SQFS_DISKCACHE_MAGIC ||
+			hdr.version != SQFS_DISKCACHE_VERSION ||
+			hdr.pos != (uint64_t)pos || hdr.size > SIZE_MAX)
+		goto miss;
+	if (check && memcmp(&hdr.digest, check, sizeof(*check)) != 0) {
+		/* Another block with the same key, which is welcome to stay */
+		close(fd);
+		return false;
+	}
+
+	if (!(b = malloc(sizeof(*b))))
+		goto miss;
+	b->refcount = 1;
+	b->size = hdr.size;
+	if (!(b->data = malloc(hdr.size ? hdr.size : 1)))
+		goto miss;
+	if (!sqfs_diskcache_readall(fd, b->data, b->size))
+		goto miss;
+	if (sqfs_diskcache_sum(&hdr, b->data) != hdr.sum)
+		goto miss;
+
+	close(fd);
+	*aux = hdr.aux;
+	*block = b;
+	return true;
+
+miss:
+	/* Damaged or stale, get rid of it so it can be rewritten */
+	if (b) {
+		free(b->data);
+		free(b);
+	}
+	close(fd);
+	unlink(path);
+	return false;
+}
+
+static void sqfs_diskcache_write(sqfs_diskcache_internal *d, sqfs_off_t pos,
+		const sqfs_digest *digest, size_t aux, const sqfs_block *block) {
+	char path[SQFS_DISKCACHE_PATH_MAX], tmp[SQFS_DISKCACHE_PATH_MAX];
+	sqfs_diskcache_hdr hdr;
+	bool ok;
+	int fd;
+
+	sqfs_diskcache_path(d, pos, path);
+	if (access(path, F_OK) == 0)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", d->dir);
+	if ((fd = mkstemp(tmp)) == -1)
+		return;
+
+	hdr.magic = SQFS_DISKCACHE_MAGIC;
+	hdr.version = SQFS_DISKCACHE_VERSION;
+	hdr.pos = pos;
+	hdr.size = block->size;
+	hdr.aux = aux;
+	if (digest)
+		hdr.digest = *digest;
+	else
+		memset(&hdr.digest, 0, sizeof(hdr.digest));
+	hdr.sum = sqfs_diskcache_sum(&hdr, block->data);
+
+	ok = sqfs_diskcache_writeall(fd, &hdr, sizeof(hdr)) &&
+		sqfs_diskcache_writeall(fd, block->data, block->size);
+	if (close(fd) == -1)
+		ok = false;
+	if (!ok || rename(tmp, path) == -1) {
+		unlink(tmp);
+		return;
+	}
+
+	/* Only ever called from one thread, so 'used' needs no lock */
+	d->used += sizeof(hdr) + block->size;
+	if (d->limit && d->used > d->limit)
+		sqfs_diskcache_trim(d);
+}
+
+#ifdef SQFS_DISKCACHE_WRITER
+
+static void *sqfs_diskcache_writer(void *arg) {
+	sqfs_diskcache_internal *d = arg;
+	sqfs_diskcache_job job;
+
+	for (;;) {
+		pthread_mutex_lock(&d->lock);
+		while (!d->queued && !d->stop)
+			pthread_cond_wait(&d->cond, &d->lock);
+		if (!d->queued) {
+			pthread_mutex_unlock(&d->lock);
+			break;
+		}
+		job = d->queue[d->head];
+		d->head = (d->head + 1) % SQFS_DISKCACHE_QUEUE;
+		--d->queued;
+		pthread_mutex_unlock(&d->lock);
+
+		sqfs_diskcache_write(d, job.pos, job.has_digest ? &job.digest : NULL,
+			job.aux, job.block);
+		sqfs_block_dispose(job.block);
+	}
+	return NULL;
+}
+
+void sqfs_diskcache_put(sqfs_diskcache *dc, sqfs_off_t pos,
+		const sqfs_digest *digest, size_t aux, sqfs_block *block) {
+	sqfs_diskcache_internal *d = *dc;
+	sqfs_diskcache_job *job;
+
+	pthread_mutex_lock(&d->lock);
+	/* Started here rather than at init, since a daemon forks in between */
+	if (!d->running) {
+		if (pthread_create(&d->thread, NULL, sqfs_diskcache_writer, d)) {
+			pthread_mutex_unlock(&d->lock);
+			return;
+		}
+		d->running = true;
+	}
+	if (d->queued == SQFS_DISKCACHE_QUEUE) {
+		pthread_mutex_unlock(&d->lock);
+		return;
+	}
+	job = &d->queue[(d->head + d->queued) % SQFS_DISKCACHE_QUEUE];
+	job->pos = pos;
+	job->has_digest = digest != NULL;
+	if (digest)
+		job->digest = *digest;
+	job->aux = aux;
+	job->block = block;
+	sqfs_block_ref(block);
+	++d->queued;
+	pthread_cond_signal(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+}
+
+#else
+
+void sqfs_diskcache_put(sqfs_diskcache *dc, sqfs_off_t pos,
+		const sqfs_digest *digest, size_t aux, sqfs_block *block) {
+	sqfs_diskcache_write(*dc, pos, digest, aux, block);
+}
+
+#endif /* SQFS_DISKCACHE_WRITER */
+
+#endif /* _WIN32 */
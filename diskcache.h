@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_DISKCACHE_H
+#define SQFS_DISKCACHE_H
+
+#include "common.h"
+
+/* Persistent cache of decompressed blocks
+ *  - One file per block, in a directory per image
+ *  - Files are written under a temporary name and renamed into place, and
+ *    carry a checksum, so a crash can't leave a bad entry that is trusted
+ *  - Safe to share a directory between processes
+ *  - Optionally limited in size, across all the images sharing a directory.
+ *    When a write goes over, the least recently used entries are removed.
+ *  - Temporary files left by a crash are removed at init
+ *  - In multithreaded builds, blocks are written by a background thread,
+ *    started on first use, from a bounded queue. When it's full, or the
+ *    thread can't start, new blocks are dropped rather than making the
+ *    caller wait.
+ */
+
+/* Use directory 'dir' for the image with the given identifier, keeping
+ * everything in 'dir' to about 'limit' bytes, or any size if it's zero */
+sqfs_err sqfs_diskcache_init(sqfs_diskcache *dc, const char *dir,
+	uint64_t id, uint64_t limit);
+/* Waits for queued blocks to be written */
+void sqfs_diskcache_destroy(sqfs_diskcache *dc);
+
+/* Look up the block at image position 'pos'. On a hit, returns true with a
+ * new block of refcount one, and the 'aux' value it was stored with. If
+ * 'check' is given, the block must have been stored with that digest. */
+bool sqfs_diskcache_get(sqfs_diskcache *dc, sqfs_off_t pos,
+	const sqfs_digest *check, size_t *aux, sqfs_block **block);
+
+/* Store a block, with a digest of its source if 'digest' isn't NULL. A
+ * reference to the block is held until it's written. Failures are ignored,
+ * the cache is just less useful. */
+void sqfs_diskcache_put(sqfs_diskcache *dc, sqfs_off_t pos,
+	const sqfs_digest *digest, size_t aux, sqfs_block *block);
+
+#endif
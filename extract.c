@@ -3,6 +3,7 @@
 #include "squashfuse.h"
 #include "stat.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +11,15 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#ifdef SQFS_MULTITHREADED
+#include <pthread.h>
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/xattr.h>
+#define EXTRACT_XATTRS 1
+#endif
+
 
 #define PROGNAME "squashfuse_extract"
 
@@ -17,9 +27,100 @@
 #define ERR_USAGE	(2)
 #define ERR_OPEN	(3)
 
+/* Each task decompresses about this much of a file, and writes it at once */
+#define EXTRACT_CHUNK (2 * 1024 * 1024)
+/* Writes are aligned to this, as are the buffers */
+#define EXTRACT_ALIGN 4096
+/* Stop queueing when this many tasks are waiting. Every file with a task
+ * waiting or running is open, so this also bounds open files. */
+#define EXTRACT_MAX_QUEUED 256
+#define EXTRACT_MAX_THREADS 256
+
+/* A regular file being written. Once its last task is done, whichever
+ * thread ran that task restores its attributes and closes it. */
+typedef struct {
+    char *path;
+    int fd;
+    sqfs_inode inode;
+    sqfs_blocklist_entry *headers;  /* one for each block */
+    size_t tasks_left;
+    bool failed;
+} extract_file;
+
+/* Some consecutive blocks of a file, or its fragment if count is zero */
+typedef struct {
+    extract_file *file;
+    size_t first, count;
+    uint64_t pos;                   /* where the first block is */
+} extract_task;
+
+/* Each worker has its own queue. It takes from the front, so a file's
+ * tasks tend to be written in order; when that's empty, it steals from the
+ * back of other workers' queues. */
+typedef struct {
+#ifdef SQFS_MULTITHREADED
+    pthread_t thread;
+    pthread_mutex_t lock;
+#endif
+    extract_task *tasks;
+    size_t head, count, cap;
+    char *buf;
+} extract_worker;
+
+/* Something to finish once the whole tree has been walked: a directory to
+ * give its attributes, or another link to a file that's now surely there */
+typedef struct {
+    char *path;
+    sqfs_inode_id id;
+} extract_later;
+
+typedef struct {
+    extract_later *items;
+    size_t count, cap;
+} extract_list;
+
+static sqfs fs;
+static const char *dest = "squashfs-root";
+static bool verbose;
+static bool sparse;
+static bool restore_owner;
+static size_t chunk_blocks;
+static size_t failures, files_done, links_made;
+static uint64_t bytes_written, bytes_skipped;
+
+/* Shared by the threads walking the tree */
+static extract_list dirs, links;
+/* Directories with bad names, whose contents are skipped too */
+static extract_list rejected;
+static bool any_rejected;
+/* Where each inode with more than one link was first extracted to, by
+ * inode number */
+static char **linked;
+#ifdef SQFS_MULTITHREADED
+static pthread_mutex_t walk_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static extract_worker *workers;
+static int nworkers = 1;
+#ifdef SQFS_MULTITHREADED
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_room = PTHREAD_COND_INITIALIZER;
+static size_t pool_queued;
+static bool pool_done;
+static unsigned pool_next;
+#endif
+
 static void usage() {
-    fprintf(stderr, "Usage: %s ARCHIVE PATH_TO_EXTRACT\n", PROGNAME);
-    fprintf(stderr, "       %s ARCHIVE -a\n", PROGNAME);
+    fprintf(stderr, "Usage: %s [-j THREADS] [-d DEST] [-s] [-v] ARCHIVE "
+        "[PATH | -a]\n", PROGNAME);
+    fprintf(stderr, "\n"
+        "Extract PATH from ARCHIVE into DEST, or everything if there's no PATH.\n"
+        "    -j THREADS  walk the tree and decompress with this many threads\n"
+        "                (default: one per CPU)\n"
+        "    -d DEST     where to extract to (default: squashfs-root)\n"
+        "    -s          leave holes in sparse files as holes, not written zeros\n"
+        "    -v          print each path as it's extracted, and a summary\n");
     exit(ERR_USAGE);
 }
 
@@ -28,119 +129,754 @@ static void die(const char *msg) {
     exit(ERR_MISC);
 }
 
-static bool starts_with(const char *pre, const char *str)
-{
-    size_t lenpre = strlen(pre),
-    lenstr = strlen(str);
-    return lenstr < lenpre ? false : strncmp(pre, str, lenpre) == 0;
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (!p)
+        die("Out of memory");
+    return p;
+}
+
+static void fail(const char *what, const char *path) {
+    fprintf(stderr, "%s %s: %s\n", what, path, strerror(errno));
+    __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+}
+
+static void fail_sqfs(const char *what, const char *path) {
+    fprintf(stderr, "%s %s\n", what, path);
+    __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+}
+
+static char *join(const char *a, const char *b) {
+    char *p = xmalloc(strlen(a) + strlen(b) + 2);
+    if (*b)
+        sprintf(p, "%s/%s", a, b);
+    else
+        strcpy(p, a);
+    return p;
+}
+
+static void walk_lock_acquire(void) {
+#ifdef SQFS_MULTITHREADED
+    pthread_mutex_lock(&walk_lock);
+#endif
+}
+
+static void walk_lock_release(void) {
+#ifdef SQFS_MULTITHREADED
+    pthread_mutex_unlock(&walk_lock);
+#endif
+}
+
+/* Call with the walk lock held */
+static void list_add(extract_list *l, char *path, sqfs_inode_id id) {
+    if (l->count == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 256;
+        if (!(l->items = realloc(l->items, l->cap * sizeof(*l->items))))
+            die("Out of memory");
+    }
+    l->items[l->count].path = path;
+    l->items[l->count++].id = id;
+}
+
+static bool write_all(int fd, const char *buf, size_t size, off_t offset) {
+    while (size) {
+        ssize_t done = pwrite(fd, buf, size, offset);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += done;
+        size -= done;
+        offset += done;
+    }
+    return true;
+}
+
+#ifdef EXTRACT_XATTRS
+static int set_xattr(const char *path, int fd, const char *name,
+        const void *value, size_t size) {
+#ifdef __APPLE__
+    if (fd >= 0)
+        return fsetxattr(fd, name, value, size, 0, 0);
+    return setxattr(path, name, value, size, 0, XATTR_NOFOLLOW);
+#else
+    if (fd >= 0)
+        return fsetxattr(fd, name, value, size, 0);
+    return lsetxattr(path, name, value, size, 0);
+#endif
+}
+
+/* Only root can set most namespaces, so others just get user xattrs */
+static void extract_xattrs(const char *path, int fd, sqfs_inode *inode) {
+    static bool warned;
+    sqfs_xattr x;
+
+    if (sqfs_xattr_open(&fs, inode, &x)) {
+        fail_sqfs("Can't read xattrs of", path);
+        return;
+    }
+    while (x.remain) {
+        size_t nsize, vsize;
+        char *name, *value;
+
+        if (sqfs_xattr_read(&x) || sqfs_xattr_value_size(&x, &vsize)) {
+            fail_sqfs("Can't read xattrs of", path);
+            return;
+        }
+        nsize = sqfs_xattr_name_size(&x);
+        name = xmalloc(nsize + 1);
+        value = xmalloc(vsize ? vsize : 1);
+        if (sqfs_xattr_name(&x, name, true) || sqfs_xattr_value(&x, value)) {
+            fail_sqfs("Can't read xattrs of", path);
+        } else {
+            name[nsize] = '\0';
+            if ((restore_owner || strncmp(name, "user.", 5) == 0) &&
+                    set_xattr(path, fd, name, value, vsize) == -1 &&
+                    !__atomic_exchange_n(&warned, true, __ATOMIC_RELAXED)) {
+                fprintf(stderr, "Can't set xattr %s on %s: %s\n"
+                    "Some xattrs may be missing.\n", name, path,
+                    strerror(errno));
+            }
+        }
+        free(name);
+        free(value);
+    }
+}
+#endif
+
+/* chmod() that doesn't follow a symlink put in the file's place */
+static int chmod_nofollow(const char *path, mode_t mode) {
+    struct stat st;
+    if (fchmodat(AT_FDCWD, path, mode, AT_SYMLINK_NOFOLLOW) == 0)
+        return 0;
+    if (errno != ENOTSUP && errno != EOPNOTSUPP)
+        return -1;
+    /* Older C libraries can't, so check first */
+    if (lstat(path, &st) == -1)
+        return -1;
+    if (S_ISLNK(st.st_mode)) {
+        errno = ELOOP;
+        return -1;
+    }
+    return chmod(path, mode);
+}
+
+/* Restore ownership, permissions, xattrs and times. Without an fd, path is
+ * not followed if it's a symlink. */
+static void extract_attrs(const char *path, int fd, sqfs_inode *inode) {
+    struct stat st;
+    struct timespec times[2];
+
+    if (sqfs_stat(&fs, inode, &st)) {
+        fail_sqfs("Can't stat", path);
+        return;
+    }
+#ifdef EXTRACT_XATTRS
+    extract_xattrs(path, fd, inode);
+#endif
+    if (restore_owner &&
+            (fd >= 0 ? fchown(fd, st.st_uid, st.st_gid)
+                : lchown(path, st.st_uid, st.st_gid)) == -1)
+        fail("Can't change owner of", path);
+    /* After chown, which clears setuid */
+    if (!S_ISLNK(st.st_mode) &&
+            (fd >= 0 ? fchmod(fd, st.st_mode & 07777)
+                : chmod_nofollow(path, st.st_mode & 07777)) == -1)
+        fail("Can't change permissions of", path);
+
+    times[0].tv_sec = times[1].tv_sec = st.st_mtime;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    if ((fd >= 0 ? futimens(fd, times)
+            : utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW)) == -1)
+        fail("Can't set times of", path);
+}
+
+static void extract_file_release(extract_file *f, size_t tasks) {
+    if (__atomic_sub_fetch(&f->tasks_left, tasks, __ATOMIC_ACQ_REL))
+        return;
+    if (!__atomic_load_n(&f->failed, __ATOMIC_RELAXED))
+        extract_attrs(f->path, f->fd, &f->inode);
+    if (close(f->fd) == -1)
+        fail("Can't write", f->path);
+    __atomic_add_fetch(&files_done, 1, __ATOMIC_RELAXED);
+    free(f->headers);
+    free(f->path);
+    free(f);
+}
+
+static bool extract_write(extract_file *f, const char *buf, size_t size,
+        off_t offset) {
+    if (!size)
+        return true;
+    if (!write_all(f->fd, buf, size, offset)) {
+        if (!__atomic_exchange_n(&f->failed, true, __ATOMIC_RELAXED))
+            fail("Can't write", f->path);
+        return false;
+    }
+    __atomic_add_fetch(&bytes_written, size, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* Decompress the task's blocks into buf, and write them out at once. When
+ * sparse, holes are skipped instead, and the data on each side of them is
+ * written separately; the file was already extended to its full size. */
+static void extract_run(extract_task *t, char *buf) {
+    extract_file *f = t->file;
+    size_t block_size = fs.sb.block_size, len = 0, run = 0, i;
+    uint64_t file_size = f->inode.xtra.reg.file_size, pos = t->pos;
+    off_t offset = (off_t)t->first * block_size;
+    sqfs_block *block;
+
+    if (__atomic_load_n(&f->failed, __ATOMIC_RELAXED))
+        goto done;
+
+    if (!t->count) {
+        size_t frag_off, frag_size;
+        if (sqfs_frag_block(&fs, &f->inode, &frag_off, &frag_size, &block))
+            goto error;
+        memcpy(buf, (char *)block->data + frag_off, frag_size);
+        sqfs_block_dispose(block);
+        len = frag_size;
+    }
+    for (i = 0; i < t->count; ++i) {
+        uint64_t start = (uint64_t)(t->first + i) * block_size;
+        size_t want = file_size - start < block_size
+            ? (size_t)(file_size - start) : block_size;
+        bool compressed;
+        uint32_t size;
+
+        sqfs_data_header(f->headers[t->first + i], &compressed, &size);
+        if (!size && sparse) {
+            if (!extract_write(f, buf + run, len - run, offset + run))
+                goto done;
+            run = len + want;
+            __atomic_add_fetch(&bytes_skipped, want, __ATOMIC_RELAXED);
+        } else if (!size) {
+            memset(buf + len, 0, want);
+        } else {
+            if (sqfs_data_block_read(&fs, pos, f->headers[t->first + i],
+                    &block))
+                goto error;
+            if (block->size != want) {
+                sqfs_block_dispose(block);
+                goto error;
+            }
+            memcpy(buf + len, block->data, want);
+            sqfs_block_dispose(block);
+            pos += size;
+        }
+        len += want;
+    }
+
+    extract_write(f, buf + run, len - run, offset + run);
+    goto done;
+
+error:
+    if (!__atomic_exchange_n(&f->failed, true, __ATOMIC_RELAXED))
+        fail_sqfs("Can't read the data of", f->path);
+done:
+    extract_file_release(f, 1);
+}
+
+#ifdef SQFS_MULTITHREADED
+static bool pool_take(extract_worker *w, extract_task *t, bool steal) {
+    bool found = false;
+    pthread_mutex_lock(&w->lock);
+    if (w->count) {
+        size_t i = steal ? (w->head + w->count - 1) % w->cap : w->head;
+        *t = w->tasks[i];
+        if (!steal)
+            w->head = (w->head + 1) % w->cap;
+        --w->count;
+        found = true;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return found;
+}
+
+static bool pool_find(int self, extract_task *t) {
+    int i;
+    if (pool_take(&workers[self], t, false))
+        return true;
+    for (i = 1; i < nworkers; ++i) {
+        if (pool_take(&workers[(self + i) % nworkers], t, true))
+            return true;
+    }
+    return false;
+}
+
+static void *pool_work_loop(void *arg) {
+    int self = (int)(intptr_t)arg;
+    extract_task t;
+
+    for (;;) {
+        if (pool_find(self, &t)) {
+            pthread_mutex_lock(&pool_lock);
+            /* Several threads walking the tree may be waiting for room */
+            if (--pool_queued <= EXTRACT_MAX_QUEUED)
+                pthread_cond_signal(&pool_room);
+            pthread_mutex_unlock(&pool_lock);
+            extract_run(&t, workers[self].buf);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        while (!pool_queued && !pool_done)
+            pthread_cond_wait(&pool_work, &pool_lock);
+        if (!pool_queued && pool_done) {
+            pthread_mutex_unlock(&pool_lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+#endif
+
+/* Hand out tasks round-robin; idle workers steal the rest */
+static void extract_submit(extract_task *t) {
+#ifdef SQFS_MULTITHREADED
+    extract_worker *w = &workers[
+        __atomic_fetch_add(&pool_next, 1, __ATOMIC_RELAXED) % nworkers];
+
+    pthread_mutex_lock(&w->lock);
+    if (w->count == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 64, i;
+        extract_task *tasks = xmalloc(cap * sizeof(*tasks));
+        for (i = 0; i < w->count; ++i)
+            tasks[i] = w->tasks[(w->head + i) % w->cap];
+        free(w->tasks);
+        w->tasks = tasks;
+        w->head = 0;
+        w->cap = cap;
+    }
+    w->tasks[(w->head + w->count++) % w->cap] = *t;
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_mutex_lock(&pool_lock);
+    ++pool_queued;
+    pthread_cond_signal(&pool_work);
+    while (pool_queued > EXTRACT_MAX_QUEUED)
+        pthread_cond_wait(&pool_room, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+#else
+    extract_run(t, workers[0].buf);
+#endif
+}
+
+static void pool_start(void) {
+    size_t size = chunk_blocks * fs.sb.block_size;
+    int i;
+
+    workers = calloc(nworkers, sizeof(*workers));
+    if (!workers)
+        die("Out of memory");
+    for (i = 0; i < nworkers; ++i) {
+        if (posix_memalign((void **)&workers[i].buf, EXTRACT_ALIGN, size))
+            die("Out of memory");
+#ifdef SQFS_MULTITHREADED
+        pthread_mutex_init(&workers[i].lock, NULL);
+#endif
+    }
+#ifdef SQFS_MULTITHREADED
+    /* Only once every queue can be stolen from */
+    for (i = 0; i < nworkers; ++i) {
+        if (pthread_create(&workers[i].thread, NULL, pool_work_loop,
+                (void *)(intptr_t)i))
+            die("Can't start a thread");
+    }
+#endif
+}
+
+static void pool_finish(void) {
+    int i;
+#ifdef SQFS_MULTITHREADED
+    pthread_mutex_lock(&pool_lock);
+    pool_done = true;
+    pthread_cond_broadcast(&pool_work);
+    pthread_mutex_unlock(&pool_lock);
+    for (i = 0; i < nworkers; ++i)
+        pthread_join(workers[i].thread, NULL);
+#endif
+    for (i = 0; i < nworkers; ++i) {
+#ifdef SQFS_MULTITHREADED
+        pthread_mutex_destroy(&workers[i].lock);
+#endif
+        free(workers[i].tasks);
+        free(workers[i].buf);
+    }
+    free(workers);
+}
+
+/* Open the file, and queue tasks for its blocks as the block list is read */
+static void extract_regular(char *path, sqfs_inode *inode) {
+    size_t nblocks = sqfs_blocklist_count(&fs, inode), tasks, submitted = 0;
+    bool frag = inode->xtra.reg.frag_idx != SQUASHFS_INVALID_FRAG;
+    extract_file *f;
+    extract_task t;
+    sqfs_blocklist bl;
+    size_t i;
+
+    unlink(path);
+    f = xmalloc(sizeof(*f));
+    f->path = path;
+    f->inode = *inode;
+    f->failed = false;
+    f->headers = NULL;
+    /* Never through a symlink that took its place */
+    if ((f->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW,
+            0600)) == -1) {
+        fail("Can't create", path);
+        free(f);
+        free(path);
+        return;
+    }
+    /* Holes that are skipped, even at the end, then read as zeros */
+    if (sparse && ftruncate(f->fd, (off_t)inode->xtra.reg.file_size) == -1) {
+        fail("Can't extend", path);
+        close(f->fd);
+        free(f);
+        free(path);
+        return;
+    }
+
+    tasks = (nblocks + chunk_blocks - 1) / chunk_blocks + (frag ? 1 : 0);
+    f->tasks_left = tasks + 1; /* until everything's queued */
+    if (nblocks)
+        f->headers = xmalloc(nblocks * sizeof(*f->headers));
+
+    t.file = f;
+    sqfs_blocklist_init(&fs, inode, &bl);
+    for (i = 0; i < nblocks; ++i) {
+        if (sqfs_blocklist_next(&bl)) {
+            __atomic_store_n(&f->failed, true, __ATOMIC_RELAXED);
+            fail_sqfs("Can't read the block list of", path);
+            break;
+        }
+        f->headers[i] = bl.header;
+        if (i % chunk_blocks == 0) {
+            t.first = i;
+            t.pos = bl.block;
+        }
+        if (i % chunk_blocks == chunk_blocks - 1 || i == nblocks - 1) {
+            t.count = i - t.first + 1;
+            extract_submit(&t);
+            ++submitted;
+        }
+    }
+    if (frag && !__atomic_load_n(&f->failed, __ATOMIC_RELAXED)) {
+        t.first = nblocks;
+        t.count = 0;
+        t.pos = 0;
+        extract_submit(&t);
+        ++submitted;
+    }
+    extract_file_release(f, tasks - submitted + 1);
+}
+
+/* If this inode was already extracted somewhere, path will be a link to it,
+ * made once the walk is done. Otherwise, remember that it's going to path. */
+static bool extract_link(char *path, sqfs_inode *inode, sqfs_inode_id id) {
+    uint32_t num = inode->base.inode_number;
+    bool later = false;
+
+    if (num == 0 || num > fs.sb.inodes)
+        return false;
+    walk_lock_acquire();
+    if (!linked && !(linked = calloc(fs.sb.inodes + 1, sizeof(*linked))))
+        die("Out of memory");
+    if (linked[num]) {
+        list_add(&links, path, id);
+        later = true;
+    } else {
+        linked[num] = xmalloc(strlen(path) + 1);
+        strcpy(linked[num], path);
+    }
+    walk_lock_release();
+    return later;
+}
+
+/* Create anything but a directory. Takes ownership of path. */
+static void extract_node(char *path, sqfs_inode *inode, struct stat *st) {
+    if (S_ISREG(st->st_mode)) {
+        extract_regular(path, inode);
+        return;
+    }
+
+    unlink(path);
+    if (S_ISLNK(st->st_mode)) {
+        size_t size;
+        char *target;
+        sqfs_readlink(&fs, inode, NULL, &size);
+        target = xmalloc(size);
+        if (sqfs_readlink(&fs, inode, target, &size))
+            fail_sqfs("Can't read the symlink", path);
+        else if (sqfs_symlink(target, path) == -1)
+            fail("Can't create", path);
+        else
+            extract_attrs(path, -1, inode);
+        free(target);
+    } else if (S_ISFIFO(st->st_mode)) {
+        if (mkfifo(path, 0600) == -1)
+            fail("Can't create", path);
+        else
+            extract_attrs(path, -1, inode);
+    } else {
+        if (mknod(path, (st->st_mode & S_IFMT) | 0600, st->st_rdev) == -1)
+            fail("Can't create", path);
+        else
+            extract_attrs(path, -1, inode);
+    }
+    free(path);
+}
+
+/* Returns false if it's a directory that couldn't be created */
+static bool extract_entry(const char *rel, sqfs_inode_id id) {
+    char *path = join(dest, rel);
+    sqfs_inode inode;
+    struct stat st;
+
+    if (verbose)
+        printf("%s\n", path);
+    if (sqfs_inode_get(&fs, &inode, id) || sqfs_stat(&fs, &inode, &st)) {
+        fail_sqfs("Can't read the inode of", path);
+        free(path);
+        return true;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        struct stat old;
+        /* Writable until we're done inside. What's already there must be a
+         * directory itself, not a symlink to one. */
+        if (mkdir(path, 0700) == -1 &&
+                (errno != EEXIST || lstat(path, &old) == -1 ||
+                 !S_ISDIR(old.st_mode))) {
+            fail("Can't create", path);
+            free(path);
+            return false;
+        }
+        /* After its parent, so the fixups can go innermost first */
+        walk_lock_acquire();
+        list_add(&dirs, path, id);
+        walk_lock_release();
+        return true;
+    }
+
+    if (st.st_nlink > 1 && extract_link(path, &inode, id))
+        return true;
+    extract_node(path, &inode, &st);
+    return true;
+}
+
+/* A name that isn't a single path component could write outside dest */
+static bool name_ok(const char *name, size_t size) {
+    return size && !memchr(name, '/', size) && !memchr(name, '\0', size) &&
+        !(size <= 2 && memcmp(name, "..", size) == 0);
+}
+
+/* Skip everything inside a directory. Its contents are all visited after
+ * it, with its path as their prefix. */
+static void reject(const char *path, sqfs_inode_id id) {
+    walk_lock_acquire();
+    list_add(&rejected, join(path, ""), id);
+    __atomic_store_n(&any_rejected, true, __ATOMIC_RELEASE);
+    walk_lock_release();
+}
+
+/* Whether path is inside a directory that was skipped */
+static bool in_rejected(const char *path) {
+    bool found = false;
+    size_t i;
+
+    if (!__atomic_load_n(&any_rejected, __ATOMIC_ACQUIRE))
+        return false;
+    walk_lock_acquire();
+    for (i = 0; !found && i < rejected.count; ++i) {
+        size_t len = strlen(rejected.items[i].path);
+        found = strncmp(path, rejected.items[i].path, len) == 0 &&
+            path[len] == '/';
+    }
+    walk_lock_release();
+    return found;
+}
+
+/* Called by each thread walking the tree */
+static sqfs_err extract_visit(void *user, const char *path,
+        sqfs_dir_entry *entry) {
+    const char *want = user;
+    sqfs_inode_id id = sqfs_dentry_inode(entry);
+    char *rel;
+
+    if (in_rejected(path))
+        return SQFS_OK;
+    if (!name_ok(sqfs_dentry_name(entry), sqfs_dentry_name_size(entry))) {
+        fprintf(stderr, "Skipping bad name %s\n", path);
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        if (sqfs_dentry_is_dir(entry))
+            reject(path, id);
+        return SQFS_OK;
+    }
+
+    rel = *want ? join(want, path) : (char *)path;
+    /* Nothing may be written through whatever is in its place */
+    if (!extract_entry(rel, id))
+        reject(path, id);
+    if (rel != path)
+        free(rel);
+    return SQFS_OK;
+}
+
+/* Every first copy exists by now, though it may still be being written.
+ * That's fine for a link. */
+static void extract_links(void) {
+    size_t i;
+    for (i = 0; i < links.count; ++i) {
+        char *path = links.items[i].path;
+        sqfs_inode inode;
+        struct stat st;
+
+        if (sqfs_inode_get(&fs, &inode, links.items[i].id) ||
+                sqfs_stat(&fs, &inode, &st)) {
+            fail_sqfs("Can't read the inode of", path);
+            free(path);
+            continue;
+        }
+        unlink(path);
+        if (linkat(AT_FDCWD, linked[inode.base.inode_number], AT_FDCWD, path,
+                0) == 0) {
+            ++links_made;
+            free(path);
+        } else {
+            extract_node(path, &inode, &st); /* Just extract another copy */
+        }
+    }
+    free(links.items);
+}
+
+/* Create the directories above the path asked for, as plain directories */
+static void make_parents(const char *rel) {
+    char *path = join(dest, rel), *slash = path + strlen(dest);
+    while ((slash = strchr(slash + 1, '/'))) {
+        *slash = '\0';
+        if (mkdir(path, 0777) == -1 && errno != EEXIST)
+            fail("Can't create", path);
+        *slash = '/';
+    }
+    free(path);
 }
 
 int main(int argc, char *argv[]) {
     sqfs_err err = SQFS_OK;
-    sqfs_traverse trv;
-    sqfs fs;
-    char *image;
-    char *path_to_extract;
-    char *prefix;
-    char prefixed_path_to_extract[1024];
-    struct stat st;
-    
-    prefix = "squashfs-root/";
-    
-    if (access(prefix, F_OK ) == -1 ) {
-        if (mkdir(prefix, 0777) == -1) {
-            perror("mkdir error");
-            exit(EXIT_FAILURE);
+    sqfs_inode inode;
+    sqfs_inode_id id;
+    char *image, *want = NULL;
+    size_t i;
+    uint64_t start = sqfs_clock_ns();
+    int opt;
+
+    nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "j:d:sva")) != -1) {
+        switch (opt) {
+            case 'j': nworkers = atoi(optarg); break;
+            case 'd': dest = optarg; break;
+            case 's': sparse = true; break;
+            case 'v': verbose = true; break;
+            case 'a': break;
+            default: usage();
         }
     }
-    
-    if (argc != 3)
+    if (optind >= argc || optind + 2 < argc)
         usage();
-    image = argv[1];
-    path_to_extract = argv[2];
-    
+    image = argv[optind];
+    if (optind + 1 < argc && strcmp(argv[optind + 1], "-a") != 0)
+        want = argv[optind + 1];
+#ifdef SQFS_MULTITHREADED
+    if (nworkers < 1)
+        nworkers = 1;
+    if (nworkers > EXTRACT_MAX_THREADS)
+        nworkers = EXTRACT_MAX_THREADS;
+#else
+    nworkers = 1;
+#endif
+    restore_owner = geteuid() == 0;
+
     if ((err = sqfs_open_image(&fs, image, 0)))
         exit(ERR_OPEN);
-    
-    if ((err = sqfs_traverse_open(&trv, &fs, sqfs_inode_root(&fs))))
-        die("sqfs_traverse_open error");
-    while (sqfs_traverse_next(&trv, &err)) {
-        if (!trv.dir_end) {
-            if ((starts_with(path_to_extract, trv.path) != 0) || (strcmp("-a", path_to_extract) == 0)){
-                fprintf(stderr, "trv.path: %s\n", trv.path);
-                fprintf(stderr, "sqfs_inode_id: %llu\n", (unsigned long long)trv.entry.inode);
-                sqfs_inode inode;
-                if (sqfs_inode_get(&fs, &inode, trv.entry.inode))
-                    die("sqfs_inode_get error");
-                fprintf(stderr, "inode.base.inode_type: %i\n", inode.base.inode_type);
-                fprintf(stderr, "inode.xtra.reg.file_size: %llu\n", (unsigned long long)inode.xtra.reg.file_size);
-                strcpy(prefixed_path_to_extract, "");
-                strcat(strcat(prefixed_path_to_extract, prefix), trv.path);
-                if (inode.base.inode_type == SQUASHFS_DIR_TYPE){
-                    fprintf(stderr, "inode.xtra.dir.parent_inode: %ui\n", inode.xtra.dir.parent_inode);
-                    fprintf(stderr, "mkdir: %s/\n", prefixed_path_to_extract);
-                    if (access(prefixed_path_to_extract, F_OK ) == -1 ) {
-                        if (mkdir(prefixed_path_to_extract, 0777) == -1) {
-                            perror("mkdir error");
-                            exit(1);
-                        }
-                    }
-                } else if (inode.base.inode_type == SQUASHFS_REG_TYPE){
-                    fprintf(stderr, "Extract to: %s\n", prefixed_path_to_extract);
-                    if (sqfs_stat(&fs, &inode, &st) != 0)
-                        die("sqfs_stat error");
-                    printf("Permissions: ");
-                    printf( (S_ISDIR(st.st_mode)) ? "d" : "-");
-                    printf( (st.st_mode & S_IRUSR) ? "r" : "-");
-                    printf( (st.st_mode & S_IWUSR) ? "w" : "-");
-                    printf( (st.st_mode & S_IXUSR) ? "x" : "-");
-                    printf( (st.st_mode & S_IRGRP) ? "r" : "-");
-                    printf( (st.st_mode & S_IWGRP) ? "w" : "-");
-                    printf( (st.st_mode & S_IXGRP) ? "x" : "-");
-                    printf( (st.st_mode & S_IROTH) ? "r" : "-");
-                    printf( (st.st_mode & S_IWOTH) ? "w" : "-");
-                    printf( (st.st_mode & S_IXOTH) ? "x" : "-");
-                    printf("\n");
-        
-                    // Read the file in chunks
-                    off_t bytes_already_read = 0;
-                    sqfs_off_t bytes_at_a_time = 64*1024;
-                    FILE * f;
-                    f = fopen (prefixed_path_to_extract, "w+");
-                    if (f == NULL)
-                        die("fopen error");
-                    while (bytes_already_read < inode.xtra.reg.file_size)
-                    {
-                        char buf[bytes_at_a_time];
-                        if (sqfs_read_range(&fs, &inode, (sqfs_off_t) bytes_already_read, &bytes_at_a_time, buf))
-                            die("sqfs_read_range error");
-                        // fwrite(buf, 1, bytes_at_a_time, stdout);
-                        fwrite(buf, 1, bytes_at_a_time, f);                 
-                        bytes_already_read = bytes_already_read + bytes_at_a_time;
-                    }
-                    fclose(f);
-                    chmod (prefixed_path_to_extract, st.st_mode);
-                } else if (inode.base.inode_type == SQUASHFS_SYMLINK_TYPE){
-                    size_t size = strlen(trv.path)+1;
-                    char buf[size];
-                    int ret = sqfs_readlink(&fs, &inode, buf, &size);
-                    if (ret != 0)
-                        die("sqfs_readlink error");
-                    fprintf(stderr, "Symlink: %s to %s \n", prefixed_path_to_extract, buf);
-                    unlink(prefixed_path_to_extract);
-                    ret = sqfs_symlink(buf, prefixed_path_to_extract);
-                    if (ret != 0)
-                        die("symlink error");
-                } else {
-                    fprintf(stderr, "TODO: Implement inode.base.inode_type %i\n", inode.base.inode_type);
-                }
-                fprintf(stderr, "\n");
+    chunk_blocks = EXTRACT_CHUNK / fs.sb.block_size;
+    if (!chunk_blocks)
+        chunk_blocks = 1;
+
+    id = sqfs_inode_root(&fs);
+    if (sqfs_inode_get(&fs, &inode, id))
+        die("sqfs_inode_get error");
+    if (want) {
+        bool found;
+        /* Tidy the path, it's joined to others */
+        while (*want == '/')
+            ++want;
+        for (i = strlen(want); i > 0 && want[i - 1] == '/'; --i)
+            want[i - 1] = '\0';
+        if (*want) {
+            if (sqfs_lookup_path_with_id(&fs, &inode, want, &found, &id))
+                die("sqfs_lookup_path error");
+            if (!found) {
+                fprintf(stderr, "%s isn't in %s\n", want, image);
+                exit(ERR_MISC);
             }
         }
     }
-    if (err)
-        die("sqfs_traverse_next error");
-    sqfs_traverse_close(&trv);
-    sqfs_fd_close(fs.fd);
-    return 0;
+    if (!want || !*want) {
+        want = "";
+    } else {
+        if (mkdir(dest, 0777) == -1 && errno != EEXIST) {
+            perror("mkdir error");
+            exit(ERR_MISC);
+        }
+        make_parents(want);
+    }
+
+    pool_start();
+    if (extract_entry(want, id) && S_ISDIR(inode.base.mode) &&
+            sqfs_traverse_mt(&fs, id, nworkers, extract_visit, want))
+        fail_sqfs("Can't read everything in", image);
+    extract_links();
+    pool_finish();
+
+    /* Innermost first, so setting times isn't undone by what's inside */
+    for (i = dirs.count; i-- > 0; ) {
+        char *path = dirs.items[i].path;
+        int fd;
+        if (sqfs_inode_get(&fs, &inode, dirs.items[i].id)) {
+            fail_sqfs("Can't read the inode of", path);
+        } else if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW))
+                == -1) {
+            fail("Can't open", path);
+        } else {
+            extract_attrs(path, fd, &inode);
+            close(fd);
+        }
+        free(path);
+    }
+    free(dirs.items);
+    for (i = 0; i < rejected.count; ++i)
+        free(rejected.items[i].path);
+    free(rejected.items);
+    if (linked) {
+        for (i = 0; i <= fs.sb.inodes; ++i)
+            free(linked[i]);
+        free(linked);
+    }
+
+    if (verbose) {
+        double secs = (sqfs_clock_ns() - start) / 1e9;
+        fprintf(stderr, "Extracted %zu files, %.1f MB in %.2f s with "
+            "%d threads (%.1f MB/s)\n", files_done, bytes_written / 1e6, secs,
+            nworkers, secs > 0 ? bytes_written / 1e6 / secs : 0.0);
+        if (links_made)
+            fprintf(stderr, "Made %zu hard links\n", links_made);
+        if (bytes_skipped)
+            fprintf(stderr, "Skipped %.1f MB of holes\n", bytes_skipped / 1e6);
+    }
+    sqfs_destroy(&fs);
+    return failures ? ERR_MISC : 0;
 }
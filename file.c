@@ -25,8 +25,10 @@
 #include "file.h"
 
 #include "fs.h"
+#include "profile.h"
 #include "swap.h"
 #include "table.h"
+#include "trace.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -56,6 +58,14 @@ sqfs_err sqfs_frag_block(sqfs *fs, sqfs_inode *inode,
 	if (err)
 		return err;
 	
+	if (fs->profile) {
+		sqfs_profile_entry pe = { SQFS_PROFILE_FRAG };
+		pe.inode = inode->id;
+		pe.pos = frag.start_block;
+		pe.hdr = frag.size;
+		sqfs_profile_access(&fs->profile, &pe);
+	}
+	
 	err = sqfs_data_cache(fs, &fs->frag_cache, frag.start_block,
 		frag.size, block);
 	if (err)
@@ -110,8 +120,8 @@ sqfs_err sqfs_blocklist_next(sqfs_blocklist *bl) {
 	return SQFS_OK;
 }
 
-sqfs_err sqfs_read_range(sqfs *fs, sqfs_inode *inode, sqfs_off_t start,
-		sqfs_off_t *size, void *buf) {
+static sqfs_err sqfs_read_range_blocks(sqfs *fs, sqfs_inode *inode,
+		sqfs_off_t start, sqfs_off_t *size, void *buf) {
 	sqfs_err err = SQFS_OK;
 	
 	sqfs_off_t file_size;
@@ -143,7 +153,7 @@ sqfs_err sqfs_read_range(sqfs *fs, sqfs_inode *inode, sqfs_off_t start,
 	while (*size > 0) {
 		sqfs_block *block = NULL;
 		size_t data_off, data_size;
-		size_t take;
+		size_t take, want;
 		
 		bool fragment = (bl.remain == 0);
 		if (fragment) { /* fragment */
@@ -164,11 +174,22 @@ sqfs_err sqfs_read_range(sqfs *fs, sqfs_inode *inode, sqfs_off_t start,
 				if (data_size > block_size)
 					data_size = block_size;
 			} else {
-				err = sqfs_data_cache(fs, &fs->data_cache, bl.block,
-					bl.header, &block);
+				if (fs->profile) {
+					sqfs_profile_entry pe = { SQFS_PROFILE_DATA };
+					pe.inode = inode->id;
+					pe.index = bl.pos / block_size;
+					pe.pos = bl.block;
+					pe.hdr = bl.header;
+					sqfs_profile_access(&fs->profile, &pe);
+				}
+				/* Only as much of the block as this read needs */
+				want = block_size;
+				if ((sqfs_off_t)(block_size - read_off) > *size)
+					want = read_off + (size_t)*size;
+				err = sqfs_data_cache_prefix(fs, &fs->data_cache, bl.block,
+					bl.header, want, &block, &data_size);
 				if (err)
 					return err;
-				data_size = block->size;
 			}
 		}
 		
@@ -193,6 +214,54 @@ sqfs_err sqfs_read_range(sqfs *fs, sqfs_inode *inode, sqfs_off_t start,
 	return *size ? SQFS_OK : SQFS_ERR;
 }
 
+sqfs_err sqfs_read_range(sqfs *fs, sqfs_inode *inode, sqfs_off_t start,
+		sqfs_off_t *size, void *buf) {
+	uint64_t span = sqfs_trace_begin();
+	sqfs_off_t want = *size;
+	sqfs_err err = sqfs_read_range_blocks(fs, inode, start, size, buf);
+	if (span)
+		sqfs_trace_span(span, "file", "read_range", "offset", start,
+			"size", want);
+	return err;
+}
+
+sqfs_err sqfs_seek_data(sqfs *fs, sqfs_inode *inode, sqfs_off_t start,
+		bool data, sqfs_off_t *found) {
+	sqfs_off_t file_size, block_size = fs->sb.block_size;
+	sqfs_blocklist bl;
+	sqfs_err err;
+
+	if (!S_ISREG(inode->base.mode) || start < 0)
+		return SQFS_ERR;
+	file_size = inode->xtra.reg.file_size;
+	*found = -1;
+	if (start >= file_size)
+		return SQFS_OK;
+
+	/* Skip straight to the block, in a large file */
+	if ((err = sqfs_blockidx_blocklist(fs, inode, &bl, start)))
+		return err;
+	while (bl.remain) {
+		if ((err = sqfs_blocklist_next(&bl)))
+			return err;
+		if ((sqfs_off_t)bl.pos + block_size <= start)
+			continue;
+		if ((bl.input_size != 0) == data) {
+			*found = (sqfs_off_t)bl.pos > start ? (sqfs_off_t)bl.pos : start;
+			return SQFS_OK;
+		}
+	}
+
+	/* All that's left is the fragment, which is data, then the end */
+	if (!data) {
+		*found = file_size;
+	} else if (inode->xtra.reg.frag_idx != SQUASHFS_INVALID_FRAG) {
+		sqfs_off_t frag = file_size / block_size * block_size;
+		*found = frag > start ? frag : start;
+	}
+	return SQFS_OK;
+}
+
 
 /*
 To read block N of a M-block file, we have to read N blocksizes from the,
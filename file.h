@@ -60,6 +60,12 @@ sqfs_err sqfs_blocklist_next(sqfs_blocklist *bl);
 sqfs_err sqfs_read_range(sqfs *fs, sqfs_inode *inode, sqfs_off_t start,
 	sqfs_off_t *size, void *buf);
 
+/* Find the first offset at or after start that's in data, or in a hole, like
+ * lseek() with SEEK_DATA or SEEK_HOLE. Holes are sparse blocks, and the end
+ * of the file. *found is -1 if there's no such offset. */
+sqfs_err sqfs_seek_data(sqfs *fs, sqfs_inode *inode, sqfs_off_t start,
+	bool data, sqfs_off_t *found);
+
 
 /*** Block index for skipping to the middle of large files ***/
 
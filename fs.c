@@ -24,9 +24,18 @@
  */
 #include "fs.h"
 
+#include "bufpool.h"
+#include "diskcache.h"
 #include "file.h"
+#include "hash.h"
 #include "dir.h"
+#include "mempressure.h"
 #include "nonstd.h"
+#include "prefetch.h"
+#include "probe.h"
+#include "profile.h"
+#include "shmcache.h"
+#include "trace.h"
 #include "swap.h"
 #include "xattr.h"
 
@@ -34,15 +43,75 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 
 #ifdef SQFS_MULTITHREADED
 # define DATA_CACHED_BLKS 48
 # define FRAG_CACHED_BLKS 48
+# define DIRECT_IDLE_BUFS 16
 #else
 # define DATA_CACHED_BLKS 1
 # define FRAG_CACHED_BLKS 3
+# define DIRECT_IDLE_BUFS 1
 #endif
 
+/* Size of each sequential read when preloading metadata */
+#define MD_PRELOAD_CHUNK (1024 * 1024)
+
+#ifdef SQFS_MULTITHREADED
+# define SQFS_IO_COUNT(fs, field, n) \
+	__atomic_fetch_add(&(fs)->io_stats.field, (n), __ATOMIC_RELAXED)
+# define SQFS_IO_LOAD(fs, field) \
+	__atomic_load_n(&(fs)->io_stats.field, __ATOMIC_RELAXED)
+#else
+# define SQFS_IO_COUNT(fs, field, n) ((fs)->io_stats.field += (n))
+# define SQFS_IO_LOAD(fs, field) ((fs)->io_stats.field)
+#endif
+
+/* Read from the image, counting the bytes read */
+static ssize_t sqfs_image_pread(sqfs *fs, void *buf, size_t count,
+		sqfs_off_t off) {
+	uint64_t span = sqfs_trace_begin();
+	ssize_t got;
+	SQFS_PROBE2(io__start, (int64_t)off, count);
+	got = sqfs_pread(fs->fd, buf, count, off);
+	SQFS_PROBE2(io__done, (int64_t)off, (int64_t)got);
+	if (span)
+		sqfs_trace_span(span, "io", "pread", "pos", off, "size", count);
+	if (got > 0)
+		SQFS_IO_COUNT(fs, read_bytes, (uint64_t)got);
+	return got;
+}
+
+/* Decompress a whole block, counting the output and the time taken */
+static sqfs_err sqfs_decompress(sqfs *fs, void *in, size_t insz,
+		void *out, size_t *outsz) {
+	uint64_t start;
+	sqfs_err err;
+
+	SQFS_PROBE1(decompress__start, insz);
+	start = sqfs_clock_ns();
+	err = fs->decompressor(in, insz, out, outsz);
+	SQFS_IO_COUNT(fs, decompress_ns, sqfs_clock_ns() - start);
+	SQFS_PROBE2(decompress__done, *outsz, (int)err);
+	if (sqfs_trace_on)
+		sqfs_trace_span(start, "decompress", "decompress", "size", insz,
+			"outsize", err ? 0 : *outsz);
+	if (!err)
+		SQFS_IO_COUNT(fs, decompressed_bytes, (uint64_t)*outsz);
+	return err;
+}
+
+void sqfs_io_stats_get(sqfs *fs, sqfs_io_stats *stats) {
+	stats->read_bytes = SQFS_IO_LOAD(fs, read_bytes);
+	stats->decompressed_bytes = SQFS_IO_LOAD(fs, decompressed_bytes);
+	stats->decompress_ns = SQFS_IO_LOAD(fs, decompress_ns);
+}
+
 void sqfs_version_supported(int *min_major, int *min_minor, int *max_major,
 		int *max_minor) {
 	*min_major = *max_major = SQUASHFS_MAJOR;
@@ -120,7 +189,66 @@ sqfs_err sqfs_init(sqfs *fs, sqfs_fd_t fd, size_t offset) {
   return sqfs_init_with_subdir(fs, fd, offset, NULL);
 }
 
+sqfs_err sqfs_direct_io_enable(sqfs *fs) {
+#if !defined(_WIN32) && defined(O_DIRECT)
+	long page;
+	size_t max_read;
+	int flags;
+	sqfs_block *block;
+	size_t data_size;
+
+	if (fs->direct_io)
+		return SQFS_OK;
+
+	page = sysconf(_SC_PAGESIZE);
+	fs->direct_align = page > 0 ? (size_t)page : 4096;
+
+	/* Largest raw read is a data block, or a metadata block and header */
+	max_read = fs->sb.block_size;
+	if (max_read < sizeof(uint16_t) + SQUASHFS_METADATA_SIZE)
+		max_read = sizeof(uint16_t) + SQUASHFS_METADATA_SIZE;
+	if (sqfs_bufpool_init(&fs->direct_pool, max_read + 2 * fs->direct_align,
+			fs->direct_align, DIRECT_IDLE_BUFS))
+		return SQFS_ERR;
+
+	if ((flags = fcntl(fs->fd, F_GETFL)) == -1 ||
+			fcntl(fs->fd, F_SETFL, flags | O_DIRECT) == -1) {
+		sqfs_bufpool_destroy(&fs->direct_pool);
+		return SQFS_UNSUP;
+	}
+
+	/* Some filesystems accept the flag, but fail the actual reads */
+	fs->direct_io = true;
+	if (sqfs_md_block_read(fs, fs->sb.inode_table_start, &data_size, &block)) {
+		fs->direct_io = false;
+		fcntl(fs->fd, F_SETFL, flags);
+		sqfs_bufpool_destroy(&fs->direct_pool);
+		return SQFS_UNSUP;
+	}
+	sqfs_block_dispose(block);
+
+#ifdef POSIX_FADV_DONTNEED
+	/* Drop what we already pulled in while opening the image */
+	posix_fadvise(fs->fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	return SQFS_OK;
+#else
+	return SQFS_UNSUP;
+#endif
+}
+
+static void sqfs_md_preload_free(sqfs *fs) {
+	while (fs->md_preload_count)
+		sqfs_block_dispose(fs->md_preload[--fs->md_preload_count].block);
+	free(fs->md_preload);
+	fs->md_preload = NULL;
+}
+
 void sqfs_destroy(sqfs *fs) {
+	/* First, since their threads use everything else */
+	sqfs_mempressure_destroy(&fs->mempressure);
+	sqfs_prefetch_destroy(&fs->prefetch);
+	sqfs_profile_destroy(&fs->profile);
 	sqfs_table_destroy(&fs->id_table);
 	sqfs_table_destroy(&fs->frag_table);
 	if (sqfs_export_ok(fs))
@@ -128,7 +256,100 @@ void sqfs_destroy(sqfs *fs) {
 	sqfs_cache_destroy(&fs->md_cache);
 	sqfs_cache_destroy(&fs->data_cache);
 	sqfs_cache_destroy(&fs->frag_cache);
+	sqfs_cache_destroy(&fs->raw_cache);
 	sqfs_cache_destroy(&fs->blockidx);
+	sqfs_bufpool_destroy(&fs->direct_pool);
+	sqfs_md_preload_free(fs);
+	/* After the caches, which write to it as they're emptied */
+	sqfs_diskcache_destroy(&fs->disk_cache);
+	sqfs_shmcache_destroy(&fs->shm_cache);
+	sqfs_cache_destroy(&fs->content_cache_own);
+}
+
+/* Key space used by caches that outlive this process, when keyed by content
+ * rather than by position in one image */
+#define SQFS_CONTENT_ID 0x636f6e74656e7473ULL
+
+/* Identify an image for caches that outlive this process */
+static sqfs_err sqfs_cache_id(sqfs *fs, uint64_t *id) {
+	if (fs->content_cache) {
+		*id = SQFS_CONTENT_ID;
+		return SQFS_OK;
+	}
+	return sqfs_image_id(fs, id);
+}
+
+sqfs_err sqfs_disk_cache_enable(sqfs *fs, const char *dir,
+		uint64_t max_bytes) {
+	uint64_t id;
+	if (fs->disk_cache)
+		return SQFS_OK;
+	if (sqfs_cache_id(fs, &id))
+		return SQFS_ERR;
+	return sqfs_diskcache_init(&fs->disk_cache, dir, id, max_bytes);
+}
+
+sqfs_err sqfs_shm_cache_enable(sqfs *fs, size_t count) {
+	uint64_t id;
+	if (fs->shm_cache)
+		return SQFS_OK;
+	if (sqfs_cache_id(fs, &id))
+		return SQFS_ERR;
+	return sqfs_shmcache_init(&fs->shm_cache, id, count, fs->sb.block_size);
+}
+
+sqfs_err sqfs_cache_sizes_set(sqfs *fs, size_t data, size_t frag,
+		size_t compressed) {
+	sqfs_err err = SQFS_OK;
+	if (data) {
+		sqfs_cache_destroy(&fs->data_cache);
+		err |= sqfs_block_cache_init(&fs->data_cache, data);
+	}
+	if (frag) {
+		sqfs_cache_destroy(&fs->frag_cache);
+		err |= sqfs_block_cache_init(&fs->frag_cache, frag);
+	}
+	if (compressed) {
+		sqfs_cache_destroy(&fs->raw_cache);
+		err |= sqfs_block_cache_init(&fs->raw_cache, compressed);
+	}
+	return err ? SQFS_ERR : SQFS_OK;
+}
+
+void sqfs_cache_shrink(sqfs *fs, unsigned shift) {
+	sqfs_cache *caches[] = { &fs->data_cache, &fs->frag_cache,
+		&fs->raw_cache, &fs->content_cache_own };
+	size_t i;
+
+	for (i = 0; i < sizeof(caches) / sizeof(*caches); ++i) {
+		if (*caches[i])
+			sqfs_cache_limit(caches[i], sqfs_cache_count(caches[i]) >> shift);
+	}
+	if (fs->direct_pool)
+		sqfs_bufpool_idle_set(&fs->direct_pool, shift ? 0 : DIRECT_IDLE_BUFS);
+}
+
+sqfs_err sqfs_partial_decode_enable(sqfs *fs) {
+	if (!sqfs_stream_supported(fs->sb.compression))
+		return SQFS_UNSUP;
+	fs->partial_decode = true;
+	return SQFS_OK;
+}
+
+sqfs_err sqfs_content_cache_enable(sqfs *fs, sqfs_cache *shared, size_t count) {
+	if (fs->content_cache)
+		return SQFS_OK;
+	/* Too late, they're already keyed by position */
+	if (fs->disk_cache || fs->shm_cache)
+		return SQFS_ERR;
+
+	if (!shared) {
+		if (sqfs_block_cache_init(&fs->content_cache_own, count))
+			return SQFS_ERR;
+		shared = &fs->content_cache_own;
+	}
+	fs->content_cache = shared;
+	return SQFS_OK;
 }
 
 void sqfs_md_header(uint16_t hdr, bool *compressed, uint16_t *size) {
@@ -143,17 +364,98 @@ void sqfs_data_header(uint32_t hdr, bool *compressed, uint32_t *size) {
 	*size = hdr & ~SQUASHFS_COMPRESSED_BIT_BLOCK;
 }
 
-sqfs_err sqfs_block_read(sqfs *fs, sqfs_off_t pos, bool compressed,
+/* Read image bytes starting at pos with direct I/O. The surrounding aligned
+ * range is read into a bounce buffer; on success *data points to the bytes
+ * at pos, and *avail says how many were read (at most 'want'). The bounce
+ * buffer must be returned to fs->direct_pool. */
+static sqfs_err sqfs_direct_read(sqfs *fs, sqfs_off_t pos, size_t want,
+		void **bounce, char **data, size_t *avail) {
+	sqfs_off_t start = pos + fs->offset;
+	size_t shift = (size_t)(start % fs->direct_align);
+	size_t len = shift + want;
+	ssize_t got;
+
+	len = sqfs_divceil(len, fs->direct_align) * fs->direct_align;
+	if (len > sqfs_bufpool_size(&fs->direct_pool))
+		return SQFS_ERR;
+	if (!(*bounce = sqfs_bufpool_get(&fs->direct_pool)))
+		return SQFS_ERR;
+
+	got = sqfs_image_pread(fs, *bounce, len, start - shift);
+	if (got <= 0 || (size_t)got <= shift) {
+		sqfs_bufpool_put(&fs->direct_pool, *bounce);
+		*bounce = NULL;
+		return SQFS_ERR;
+	}
+
+	*data = (char*)*bounce + shift;
+	*avail = (size_t)got - shift;
+	if (*avail > want)
+		*avail = want;
+	return SQFS_OK;
+}
+
+/* Make a block from raw image data, which is left untouched */
+static sqfs_err sqfs_block_decode(sqfs *fs, const char *raw, bool compressed,
 		uint32_t size, size_t outsize, sqfs_block **block) {
 	sqfs_err err = SQFS_ERR;
 	if (!(*block = malloc(sizeof(**block))))
 		return SQFS_ERR;
+	(*block)->refcount = 1;
+	
+	if (!compressed)
+		outsize = size;
+	if (!((*block)->data = malloc(outsize)))
+		goto error;
+	
+	if (compressed) {
+		err = sqfs_decompress(fs, (void*)raw, size, (*block)->data, &outsize);
+		if (err)
+			goto error;
+	} else {
+		memcpy((*block)->data, raw, size);
+	}
+	(*block)->size = outsize;
+	return SQFS_OK;
+
+error:
+	sqfs_block_dispose(*block);
+	*block = NULL;
+	return err;
+}
+
+sqfs_err sqfs_block_read(sqfs *fs, sqfs_off_t pos, bool compressed,
+		uint32_t size, size_t outsize, sqfs_block **block) {
+	sqfs_err err = SQFS_ERR;
+
+	SQFS_PROBE3(block__read__start, (int64_t)pos, size, (int)compressed);
+	if (fs->direct_io) {
+		void *bounce;
+		char *raw;
+		size_t avail;
+		if ((err = sqfs_direct_read(fs, pos, size, &bounce, &raw, &avail))) {
+			SQFS_PROBE2(block__read__done, (int64_t)pos, (int)err);
+			return err;
+		}
+		if (avail == size)
+			err = sqfs_block_decode(fs, raw, compressed, size, outsize, block);
+		else
+			err = SQFS_ERR;
+		sqfs_bufpool_put(&fs->direct_pool, bounce);
+		SQFS_PROBE2(block__read__done, (int64_t)pos, (int)err);
+		return err;
+	}
+
+	if (!(*block = malloc(sizeof(**block)))) {
+		SQFS_PROBE2(block__read__done, (int64_t)pos, (int)SQFS_ERR);
+		return SQFS_ERR;
+	}
 	/* start with refcount one, so dispose on failure path works as expected. */
 	(*block)->refcount = 1;
 	if (!((*block)->data = malloc(size)))
 		goto error;
 	
-	if (sqfs_pread(fs->fd, (*block)->data, size, pos + fs->offset) != size)
+	if (sqfs_image_pread(fs, (*block)->data, size, pos + fs->offset) != size)
 		goto error;
 
 	if (compressed) {
@@ -161,7 +463,7 @@ sqfs_err sqfs_block_read(sqfs *fs, sqfs_off_t pos, bool compressed,
 		if (!decomp)
 			goto error;
 		
-		err = fs->decompressor((*block)->data, size, decomp, &outsize);
+		err = sqfs_decompress(fs, (*block)->data, size, decomp, &outsize);
 		if (err) {
 			free(decomp);
 			goto error;
@@ -173,11 +475,44 @@ sqfs_err sqfs_block_read(sqfs *fs, sqfs_off_t pos, bool compressed,
 		(*block)->size = size;
 	}
 
+	SQFS_PROBE2(block__read__done, (int64_t)pos, (int)SQFS_OK);
 	return SQFS_OK;
 
 error:
 	sqfs_block_dispose(*block);
 	*block = NULL;
+	SQFS_PROBE2(block__read__done, (int64_t)pos, (int)err);
+	return err;
+}
+
+/* With direct I/O, fetch the header and the block in a single read */
+static sqfs_err sqfs_md_block_read_direct(sqfs *fs, sqfs_off_t pos,
+		size_t *data_size, sqfs_block **block) {
+	sqfs_err err = SQFS_ERR;
+	void *bounce;
+	char *raw;
+	size_t avail;
+	uint16_t hdr;
+	bool compressed;
+	uint16_t size;
+
+	err = sqfs_direct_read(fs, pos, sizeof(hdr) + SQUASHFS_METADATA_SIZE,
+		&bounce, &raw, &avail);
+	if (err)
+		return err;
+
+	err = SQFS_ERR;
+	if (avail >= sizeof(hdr)) {
+		memcpy(&hdr, raw, sizeof(hdr));
+		sqfs_swapin16(&hdr);
+		sqfs_md_header(hdr, &compressed, &size);
+		if (avail >= sizeof(hdr) + size) {
+			err = sqfs_block_decode(fs, raw + sizeof(hdr), compressed, size,
+				SQUASHFS_METADATA_SIZE, block);
+			*data_size = sizeof(hdr) + size;
+		}
+	}
+	sqfs_bufpool_put(&fs->direct_pool, bounce);
 	return err;
 }
 
@@ -190,7 +525,10 @@ sqfs_err sqfs_md_block_read(sqfs *fs, sqfs_off_t pos, size_t *data_size,
 	
 	*data_size = 0;
 	
-	if (sqfs_pread(fs->fd, &hdr, sizeof(hdr), pos + fs->offset) != sizeof(hdr))
+	if (fs->direct_io)
+		return sqfs_md_block_read_direct(fs, pos, data_size, block);
+	
+	if (sqfs_image_pread(fs, &hdr, sizeof(hdr), pos + fs->offset) != sizeof(hdr))
 		return SQFS_ERR;
 	pos += sizeof(hdr);
 	*data_size += sizeof(hdr);
@@ -213,16 +551,174 @@ sqfs_err sqfs_data_block_read(sqfs *fs, sqfs_off_t pos, uint32_t hdr,
 		fs->sb.block_size, block);
 }
 
+/* The inode and directory tables are followed by the metadata blocks of the
+ * other tables, and then their indices. Those blocks are harmless to load, so
+ * just stop at the first index. */
+static sqfs_off_t sqfs_md_preload_end(sqfs *fs) {
+	uint64_t starts[] = {
+		fs->sb.fragment_table_start,
+		fs->sb.lookup_table_start,
+		fs->sb.id_table_start,
+		fs->sb.xattr_id_table_start,
+	};
+	uint64_t end = fs->sb.bytes_used;
+	size_t i;
+
+	for (i = 0; i < sizeof(starts) / sizeof(starts[0]); ++i) {
+		if (starts[i] > fs->sb.directory_table_start && starts[i] < end)
+			end = starts[i];
+	}
+	return end;
+}
+
+sqfs_err sqfs_md_preload(sqfs *fs) {
+	sqfs_err err = SQFS_OK;
+	sqfs_bufpool pool = NULL;
+	size_t align = fs->direct_io ? fs->direct_align : sizeof(void*);
+	char *buf = NULL;
+	sqfs_off_t pos, end, wstart = 0;
+	size_t wlen = 0, cap = 0;
+
+	if (fs->md_preload_count)
+		return SQFS_OK;
+
+	/* A private pool, so the buffer is aligned enough for direct I/O */
+	if (sqfs_bufpool_init(&pool, MD_PRELOAD_CHUNK, align, 0) ||
+			!(buf = sqfs_bufpool_get(&pool))) {
+		sqfs_bufpool_destroy(&pool);
+		return SQFS_ERR;
+	}
+
+	end = sqfs_md_preload_end(fs);
+	for (pos = fs->sb.inode_table_start; pos < end; ) {
+		struct sqfs_md_preloaded *md;
+		size_t want = sizeof(uint16_t) + SQUASHFS_METADATA_SIZE;
+		uint16_t hdr;
+		bool compressed;
+		uint16_t size;
+		const char *raw;
+
+		if (want > (size_t)(end - pos))
+			want = end - pos;
+		if (pos + want > wstart + wlen) {
+			sqfs_off_t at = pos + fs->offset;
+			size_t shift = (size_t)(at % align);
+			ssize_t got = sqfs_image_pread(fs, buf, MD_PRELOAD_CHUNK, at - shift);
+			if (got <= 0 || (size_t)got <= shift) {
+				err = SQFS_ERR;
+				break;
+			}
+			wstart = pos - shift;
+			wlen = got;
+		}
+
+		raw = buf + (pos - wstart);
+		if (wstart + wlen - pos < sizeof(hdr)) {
+			err = SQFS_ERR;
+			break;
+		}
+		memcpy(&hdr, raw, sizeof(hdr));
+		sqfs_swapin16(&hdr);
+		sqfs_md_header(hdr, &compressed, &size);
+		if (wstart + wlen - pos < sizeof(hdr) + size) {
+			err = SQFS_ERR;
+			break;
+		}
+
+		if (fs->md_preload_count == cap) {
+			size_t ncap = cap ? cap * 2 : 64;
+			struct sqfs_md_preloaded *grown = realloc(fs->md_preload,
+				ncap * sizeof(*grown));
+			if (!grown) {
+				err = SQFS_ERR;
+				break;
+			}
+			fs->md_preload = grown;
+			cap = ncap;
+		}
+		md = &fs->md_preload[fs->md_preload_count];
+		md->pos = pos;
+		md->data_size = sizeof(hdr) + size;
+		err = sqfs_block_decode(fs, raw + sizeof(hdr), compressed, size,
+			SQUASHFS_METADATA_SIZE, &md->block);
+		if (err)
+			break;
+		++fs->md_preload_count;
+		pos += md->data_size;
+	}
+
+	sqfs_bufpool_put(&pool, buf);
+	sqfs_bufpool_destroy(&pool);
+
+	if (err)
+		sqfs_md_preload_free(fs);
+	return err;
+}
+
+/* Start filling a block cache entry */
+static void sqfs_block_cache_entry_init(sqfs_block_cache_entry *entry,
+		sqfs_off_t pos) {
+	entry->data_size = 0;
+	entry->spill = NULL;
+	entry->pos = pos;
+	entry->check = 0;
+	memset(&entry->digest, 0, sizeof(entry->digest));
+	entry->partial = NULL;
+	entry->partial_failed = false;
+}
+
+static int sqfs_md_preloaded_cmp(const void *key, const void *elem) {
+	sqfs_off_t pos = *(const sqfs_off_t*)key;
+	const struct sqfs_md_preloaded *md = elem;
+	return pos < md->pos ? -1 : pos > md->pos;
+}
+
 sqfs_err sqfs_md_cache(sqfs *fs, sqfs_off_t *pos, sqfs_block **block) {
-	sqfs_block_cache_entry *entry = sqfs_cache_get(&fs->md_cache, *pos);
+	sqfs_block_cache_entry *entry;
+
+	SQFS_PROBE1(md__cache__start, (int64_t)*pos);
+	if (fs->profile) {
+		sqfs_profile_entry pe = { SQFS_PROFILE_MD };
+		pe.pos = *pos;
+		sqfs_profile_access(&fs->profile, &pe);
+	}
+
+	if (fs->md_preload_count) {
+		struct sqfs_md_preloaded *md = bsearch(pos, fs->md_preload,
+			fs->md_preload_count, sizeof(*md), sqfs_md_preloaded_cmp);
+		if (md) {
+			SQFS_PROBE2(md__cache__done, (int64_t)*pos, (int)SQFS_OK);
+			*block = md->block;
+			*pos += md->data_size;
+			sqfs_block_ref(md->block);
+			return SQFS_OK;
+		}
+	}
+
+	entry = sqfs_cache_get(&fs->md_cache, *pos);
 	if (!sqfs_cache_entry_valid(&fs->md_cache, entry)) {
 		sqfs_err err = SQFS_OK;
-		/* fprintf(stderr, "MD BLOCK: %12llx\n", (long long)*pos); */
-		err = sqfs_md_block_read(fs, *pos,
-			&entry->data_size, &entry->block);
-		if (err) {
-			sqfs_cache_put(&fs->md_cache, entry);
-			return err;
+		/* A disk cache keyed by content is shared with other images, where
+		 * metadata positions mean something else */
+		sqfs_diskcache spill = fs->content_cache ? NULL : fs->disk_cache;
+		uint64_t span = sqfs_trace_begin();
+		SQFS_PROBE1(md__cache__miss, (int64_t)*pos);
+		sqfs_block_cache_entry_init(entry, *pos);
+		if (!spill || !sqfs_diskcache_get(&spill, *pos, NULL,
+				&entry->data_size, &entry->block)) {
+			/* fprintf(stderr, "MD BLOCK: %12llx\n", (long long)*pos); */
+			err = sqfs_md_block_read(fs, *pos,
+				&entry->data_size, &entry->block);
+			if (span)
+				sqfs_trace_span(span, "cache", "md_fill", "pos", *pos,
+					NULL, 0);
+			if (err) {
+				sqfs_cache_put(&fs->md_cache, entry);
+				SQFS_PROBE2(md__cache__done, (int64_t)*pos, (int)err);
+				return err;
+			}
+			sqfs_cache_count_bytes(&fs->md_cache, entry->block->size);
+			entry->spill = spill;
 		}
 		sqfs_cache_entry_mark_valid(&fs->md_cache, entry);
 	}
@@ -233,6 +729,7 @@ sqfs_err sqfs_md_cache(sqfs *fs, sqfs_off_t *pos, sqfs_block **block) {
 	 * obviously want one. Therefore all callers must eventually call deref
 	 * by means of calling sqfs_block_dispose().
 	 */
+	SQFS_PROBE2(md__cache__done, (int64_t)*pos, (int)SQFS_OK);
 	*block = entry->block;
 	*pos += entry->data_size;
 
@@ -245,19 +742,393 @@ sqfs_err sqfs_md_cache(sqfs *fs, sqfs_off_t *pos, sqfs_block **block) {
 	return SQFS_OK;
 }
 
+/* Raw bytes of a data block, as stored in the image */
+typedef struct {
+	char *data;
+	sqfs_block *cached;	/* if held by the compressed tier */
+	void *buf;			/* otherwise, buffer to release */
+} sqfs_raw;
+
+static sqfs_err sqfs_raw_read(sqfs *fs, sqfs_off_t pos, size_t size,
+		void **buf, char **data) {
+	if (fs->direct_io) {
+		size_t avail;
+		sqfs_err err = sqfs_direct_read(fs, pos, size, buf, data, &avail);
+		if (!err && avail != size) {
+			sqfs_bufpool_put(&fs->direct_pool, *buf);
+			err = SQFS_ERR;
+		}
+		return err;
+	}
+
+	if (!(*buf = malloc(size ? size : 1)))
+		return SQFS_ERR;
+	if (sqfs_image_pread(fs, *buf, size, pos + fs->offset) != size) {
+		free(*buf);
+		return SQFS_ERR;
+	}
+	*data = *buf;
+	return SQFS_OK;
+}
+
+static void sqfs_raw_release(sqfs *fs, void *buf) {
+	if (fs->direct_io)
+		sqfs_bufpool_put(&fs->direct_pool, buf);
+	else
+		free(buf);
+}
+
+sqfs_err sqfs_image_id(sqfs *fs, uint64_t *id) {
+	uint64_t offset = fs->offset;
+	sqfs_off_t pos, end = fs->sb.bytes_used;
+	uint64_t h[2];
+
+	if (fs->image_id_known) {
+		*id = fs->image_id;
+		return SQFS_OK;
+	}
+	if (fs->sb.inode_table_start > fs->sb.bytes_used)
+		return SQFS_ERR;
+
+	sqfs_hash128(offset, &fs->sb, sizeof(fs->sb), h);
+	/* Everything from the inode table on is metadata */
+	for (pos = fs->sb.inode_table_start; pos < end; ) {
+		size_t size = fs->sb.block_size;
+		void *buf;
+		char *data;
+		if ((sqfs_off_t)size > end - pos)
+			size = end - pos;
+		if (sqfs_raw_read(fs, pos, size, &buf, &data))
+			return SQFS_ERR;
+		sqfs_hash128(h[0], data, size, h);
+		sqfs_raw_release(fs, buf);
+		pos += size;
+	}
+
+	fs->image_id = h[0];
+	fs->image_id_known = true;
+	*id = fs->image_id;
+	return SQFS_OK;
+}
+
+/* Get the raw bytes of a data block. Compressed blocks go through the
+ * compressed tier, if there is one. Uncompressed blocks would take just as
+ * much room there as in the decompressed caches, so they don't. */
+static sqfs_err sqfs_raw_get(sqfs *fs, sqfs_off_t pos, size_t size,
+		bool compressed, sqfs_raw *raw) {
+	sqfs_block_cache_entry *entry;
+	sqfs_err err;
+
+	raw->cached = NULL;
+	raw->buf = NULL;
+	if (!fs->raw_cache || !compressed)
+		return sqfs_raw_read(fs, pos, size, &raw->buf, &raw->data);
+
+	entry = sqfs_cache_get(&fs->raw_cache, pos);
+	if (!sqfs_cache_entry_valid(&fs->raw_cache, entry)) {
+		sqfs_block *block;
+		void *buf;
+		char *data;
+
+		if ((err = sqfs_raw_read(fs, pos, size, &buf, &data))) {
+			sqfs_cache_put(&fs->raw_cache, entry);
+			return err;
+		}
+		/* Direct I/O buffers are too big to keep, copy those */
+		if (!(block = malloc(sizeof(*block)))) {
+			sqfs_raw_release(fs, buf);
+			sqfs_cache_put(&fs->raw_cache, entry);
+			return SQFS_ERR;
+		}
+		block->refcount = 1;
+		block->size = size;
+		if (fs->direct_io) {
+			if ((block->data = malloc(size ? size : 1)))
+				memcpy(block->data, data, size);
+			sqfs_raw_release(fs, buf);
+		} else {
+			block->data = buf;
+		}
+		if (!block->data) {
+			free(block);
+			sqfs_cache_put(&fs->raw_cache, entry);
+			return SQFS_ERR;
+		}
+
+		sqfs_block_cache_entry_init(entry, pos);
+		entry->block = block;
+		sqfs_cache_count_bytes(&fs->raw_cache, size);
+		sqfs_cache_entry_mark_valid(&fs->raw_cache, entry);
+	}
+	raw->cached = entry->block;
+	sqfs_block_ref(raw->cached);
+	sqfs_cache_put(&fs->raw_cache, entry);
+
+	if (raw->cached->size != size) {
+		sqfs_block_dispose(raw->cached);
+		return SQFS_ERR;
+	}
+	raw->data = raw->cached->data;
+	return SQFS_OK;
+}
+
+static void sqfs_raw_put(sqfs *fs, sqfs_raw *raw) {
+	if (raw->cached)
+		sqfs_block_dispose(raw->cached);
+	else
+		sqfs_raw_release(fs, raw->buf);
+}
+
+/* Read and decompress a data block, through the compressed tier */
+static sqfs_err sqfs_data_block_fetch(sqfs *fs, sqfs_off_t pos, uint32_t hdr,
+		sqfs_block **block) {
+	sqfs_err err;
+	bool compressed;
+	uint32_t size;
+	sqfs_raw raw;
+
+	if (!fs->raw_cache)
+		return sqfs_data_block_read(fs, pos, hdr, block);
+
+	sqfs_data_header(hdr, &compressed, &size);
+	if ((err = sqfs_raw_get(fs, pos, size, compressed, &raw)))
+		return err;
+	err = sqfs_block_decode(fs, raw.data, compressed, size, fs->sb.block_size,
+		block);
+	sqfs_raw_put(fs, &raw);
+	return err;
+}
+
+/* Fill a data cache entry by content. The compressed bytes are read and
+ * hashed, and only decompressed if no cache has a block with that hash.
+ * The in-memory cache is keyed by a fast hash, with the rest of it checked
+ * on a hit. The shared memory and disk caches may hold blocks from other
+ * images and processes, so they are keyed by part of a SHA-256 digest, and
+ * every hit there is checked against all of it. It's only computed on a
+ * miss in memory, when those tiers are in use. */
+static sqfs_err sqfs_data_cache_fill_content(sqfs *fs,
+		sqfs_block_cache_entry *entry, sqfs_off_t pos, uint32_t hdr) {
+	sqfs_block_cache_entry *centry;
+	unsigned char type[2];
+	sqfs_err err;
+	bool compressed;
+	uint32_t size;
+	uint64_t h[2];
+	sqfs_raw raw;
+
+	sqfs_data_header(hdr, &compressed, &size);
+	if ((err = sqfs_raw_get(fs, pos, size, compressed, &raw)))
+		return err;
+	type[0] = fs->sb.compression;
+	type[1] = compressed;
+	sqfs_hash128(type[0] << 8 | type[1], raw.data, size, h);
+
+	sqfs_block_cache_entry_init(entry, h[0]);
+
+	centry = sqfs_cache_get(fs->content_cache, h[0]);
+	if (sqfs_cache_entry_valid(fs->content_cache, centry) &&
+			centry->check != h[1]) {
+		/* A different block with the same key. Decode this one privately,
+		 * and keep it out of the shared caches. */
+		sqfs_cache_put(fs->content_cache, centry);
+		err = sqfs_block_decode(fs, raw.data, compressed, size,
+			fs->sb.block_size, &entry->block);
+		sqfs_raw_put(fs, &raw);
+		return err;
+	}
+	if (!sqfs_cache_entry_valid(fs->content_cache, centry)) {
+		sqfs_digest digest;
+		uint64_t key = 0;
+		size_t aux;
+
+		sqfs_block_cache_entry_init(centry, h[0]);
+		centry->check = h[1];
+		if (fs->shm_cache || fs->disk_cache) {
+			sqfs_sha256 ctx;
+			sqfs_sha256_init(&ctx);
+			sqfs_sha256_update(&ctx, type, sizeof(type));
+			sqfs_sha256_update(&ctx, raw.data, size);
+			sqfs_sha256_final(&ctx, &digest);
+			key = sqfs_digest_key(&digest);
+			/* Spilled to disk under the digest */
+			entry->pos = key;
+			entry->digest = digest;
+		}
+
+		if (fs->shm_cache && sqfs_shmcache_get(&fs->shm_cache, key, &digest,
+				&centry->block)) {
+			entry->spill = fs->disk_cache;
+		} else {
+			if (!fs->disk_cache || !sqfs_diskcache_get(&fs->disk_cache, key,
+					&digest, &aux, &centry->block)) {
+				err = sqfs_block_decode(fs, raw.data, compressed, size,
+					fs->sb.block_size, &centry->block);
+				if (err) {
+					sqfs_cache_put(fs->content_cache, centry);
+					sqfs_raw_put(fs, &raw);
+					return err;
+				}
+				sqfs_cache_count_bytes(fs->content_cache,
+					centry->block->size);
+				entry->spill = fs->disk_cache;
+			}
+			if (fs->shm_cache)
+				sqfs_shmcache_put(&fs->shm_cache, key, &digest, centry->block);
+		}
+		sqfs_cache_entry_mark_valid(fs->content_cache, centry);
+	}
+	entry->block = centry->block;
+	sqfs_block_ref(entry->block);
+	sqfs_cache_put(fs->content_cache, centry);
+
+	sqfs_raw_put(fs, &raw);
+	return SQFS_OK;
+}
+
+/* Fill a data cache entry with a block that's not decompressed yet, and the
+ * decoder that will do it as needed */
+static sqfs_err sqfs_data_cache_fill_partial(sqfs *fs,
+		sqfs_block_cache_entry *entry, sqfs_off_t pos, uint32_t size) {
+	sqfs_err err;
+	sqfs_block *block;
+	sqfs_raw raw;
+
+	if ((err = sqfs_raw_get(fs, pos, size, true, &raw)))
+		return err;
+	err = sqfs_stream_init(&entry->partial, fs->sb.compression, raw.data,
+		size, fs->sb.block_size);
+	sqfs_raw_put(fs, &raw);
+	if (err)
+		return err;
+
+	if (!(block = malloc(sizeof(*block))))
+		goto error;
+	block->refcount = 1;
+	block->size = 0;
+	if (!(block->data = malloc(fs->sb.block_size))) {
+		free(block);
+		goto error;
+	}
+	entry->block = block;
+	return SQFS_OK;
+
+error:
+	sqfs_stream_destroy(&entry->partial);
+	return SQFS_ERR;
+}
+
+/* Fill a data cache entry, trying the shared and disk caches before
+ * reading the image */
+static sqfs_err sqfs_data_cache_fill(sqfs *fs, sqfs_cache *cache,
+		sqfs_block_cache_entry *entry, sqfs_off_t pos, uint32_t hdr) {
+	sqfs_err err;
+
+	if (fs->content_cache)
+		return sqfs_data_cache_fill_content(fs, entry, pos, hdr);
+
+	sqfs_block_cache_entry_init(entry, pos);
+	if (fs->shm_cache && sqfs_shmcache_get(&fs->shm_cache, pos, NULL,
+			&entry->block)) {
+		/* Whoever put it there may not have a disk cache */
+		entry->spill = fs->disk_cache;
+		return SQFS_OK;
+	}
+	if (!fs->disk_cache || !sqfs_diskcache_get(&fs->disk_cache, pos, NULL,
+			&entry->data_size, &entry->block)) {
+		bool compressed;
+		uint32_t size;
+		sqfs_data_header(hdr, &compressed, &size);
+		/* Shared and spilled once it's complete */
+		if (fs->partial_decode && compressed)
+			return sqfs_data_cache_fill_partial(fs, entry, pos, size);
+
+		if ((err = sqfs_data_block_fetch(fs, pos, hdr, &entry->block)))
+			return err;
+		sqfs_cache_count_bytes(cache, entry->block->size);
+		entry->data_size = 0;
+		entry->spill = fs->disk_cache;
+	}
+	if (fs->shm_cache)
+		sqfs_shmcache_put(&fs->shm_cache, pos, NULL, entry->block);
+	return SQFS_OK;
+}
+
+/* Decompress more of a partially decompressed block, until it has 'want'
+ * bytes or is complete. Called with the entry held. */
+static sqfs_err sqfs_data_cache_extend(sqfs *fs, sqfs_cache *cache,
+		sqfs_block_cache_entry *entry, size_t want) {
+	sqfs_block *block = entry->block;
+	size_t outpos = block->size;
+	uint64_t start;
+	bool done;
+	sqfs_err err;
+
+	if (entry->partial_failed)
+		return SQFS_ERR;
+	if (!entry->partial)
+		return SQFS_OK; /* complete, just short */
+
+	SQFS_PROBE1(decompress__start, want);
+	start = sqfs_clock_ns();
+	err = sqfs_stream_decode(&entry->partial, block->data, fs->sb.block_size,
+		want, &outpos, &done);
+	SQFS_IO_COUNT(fs, decompress_ns, sqfs_clock_ns() - start);
+	SQFS_PROBE2(decompress__done, outpos - block->size, (int)err);
+	if (sqfs_trace_on)
+		sqfs_trace_span(start, "decompress", "decompress_partial", "from",
+			block->size, "to", outpos);
+	SQFS_IO_COUNT(fs, decompressed_bytes, (uint64_t)(outpos - block->size));
+	sqfs_cache_count_bytes(cache, outpos - block->size);
+	block->size = outpos;
+	if (err) {
+		/* What was decoded is still good, but nothing more will be */
+		sqfs_stream_destroy(&entry->partial);
+		entry->partial_failed = true;
+		return err;
+	}
+	if (done) {
+		sqfs_stream_destroy(&entry->partial);
+		entry->spill = fs->disk_cache;
+		if (fs->shm_cache)
+			sqfs_shmcache_put(&fs->shm_cache, entry->pos, NULL, block);
+	}
+	return SQFS_OK;
+}
+
 sqfs_err sqfs_data_cache(sqfs *fs, sqfs_cache *cache, sqfs_off_t pos,
 		uint32_t hdr, sqfs_block **block) {
-	sqfs_block_cache_entry *entry = sqfs_cache_get(cache, pos);
+	return sqfs_data_cache_prefix(fs, cache, pos, hdr, (size_t)-1, block,
+		NULL);
+}
+
+sqfs_err sqfs_data_cache_prefix(sqfs *fs, sqfs_cache *cache, sqfs_off_t pos,
+		uint32_t hdr, size_t want, sqfs_block **block, size_t *avail) {
+	sqfs_block_cache_entry *entry;
+
+	SQFS_PROBE2(data__cache__start, (int64_t)pos, want);
+	entry = sqfs_cache_get(cache, pos);
 	if (!sqfs_cache_entry_valid(cache, entry)) {
-		sqfs_err err = SQFS_OK;
-		err = sqfs_data_block_read(fs, pos, hdr,
-			&entry->block);
+		uint64_t span = sqfs_trace_begin();
+		sqfs_err err;
+		SQFS_PROBE1(data__cache__miss, (int64_t)pos);
+		err = sqfs_data_cache_fill(fs, cache, entry, pos, hdr);
+		if (span)
+			sqfs_trace_span(span, "cache", "data_fill", "pos", pos, NULL, 0);
 		if (err) {
-            sqfs_cache_put(cache, entry);
+			sqfs_cache_put(cache, entry);
+			SQFS_PROBE2(data__cache__done, (int64_t)pos, (int)err);
 			return err;
 		}
 		sqfs_cache_entry_mark_valid(cache, entry);
 	}
+	if (entry->block->size < want) {
+		sqfs_err err = sqfs_data_cache_extend(fs, cache, entry, want);
+		if (err) {
+			sqfs_cache_put(cache, entry);
+			SQFS_PROBE2(data__cache__done, (int64_t)pos, (int)err);
+			return err;
+		}
+	}
 	/* block is created with refcount 1, which accounts for presence in the
 	 * cache (will be decremented on eviction).
 	 *
@@ -267,10 +1138,13 @@ sqfs_err sqfs_data_cache(sqfs *fs, sqfs_cache *cache, sqfs_off_t pos,
 	 */
 	*block = entry->block;
 	sqfs_block_ref(*block);
+	if (avail)
+		*avail = entry->block->size;
     /* it is now safe to evict the entry from the cache, we have a
      * reference to the block so eviction will not destroy it.
      */
 	sqfs_cache_put(cache, entry);
+	SQFS_PROBE2(data__cache__done, (int64_t)pos, (int)SQFS_OK);
 	return SQFS_OK;
 }
 
@@ -283,6 +1157,10 @@ void sqfs_block_dispose(sqfs_block *block) {
 
 static void sqfs_block_cache_dispose(void *data) {
 	sqfs_block_cache_entry *entry = (sqfs_block_cache_entry*)data;
+	sqfs_stream_destroy(&entry->partial);
+	if (entry->spill)
+		sqfs_diskcache_put(&entry->spill, entry->pos, &entry->digest,
+			entry->data_size, entry->block);
 	sqfs_block_dispose(entry->block);
 }
 
@@ -406,6 +1284,7 @@ sqfs_err sqfs_inode_get(sqfs *fs, sqfs_inode *inode, sqfs_inode_id id) {
 	
 	memset(inode, 0, sizeof(*inode));
 	inode->xattr = SQUASHFS_INVALID_XATTR;
+	inode->id = id;
 	
 	sqfs_md_cursor_inode(&cur, id, fs->sb.inode_table_start);
 	inode->next = cur;
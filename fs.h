@@ -33,6 +33,13 @@
 #include "decompress.h"
 #include "table.h"
 
+/* Totals since the filesystem was opened */
+typedef struct {
+	uint64_t read_bytes;	/* read from the image file */
+	uint64_t decompressed_bytes;
+	uint64_t decompress_ns;	/* time spent decompressing */
+} sqfs_io_stats;
+
 struct sqfs {
 	sqfs_fd_t fd;
 	size_t offset;
@@ -46,11 +53,46 @@ struct sqfs {
 	sqfs_cache md_cache;
 	sqfs_cache data_cache;
 	sqfs_cache frag_cache;
+	sqfs_cache raw_cache;	/* compressed data and fragment blocks, if set */
 	sqfs_cache blockidx;
 	sqfs_decompressor decompressor;
 	
 	struct squashfs_xattr_id_table xattr_info;
 	sqfs_table xattr_table;
+
+	/* Direct I/O: fd bypasses the page cache, reads go through
+	 * aligned bounce buffers */
+	bool direct_io;
+	size_t direct_align;
+	sqfs_bufpool direct_pool;
+
+	/* Preloaded metadata blocks, sorted by position and never evicted */
+	struct sqfs_md_preloaded *md_preload;
+	size_t md_preload_count;
+
+	/* Blocks evicted from the caches are kept here, if set */
+	sqfs_diskcache disk_cache;
+	/* Data and fragment blocks shared with other processes, if set */
+	sqfs_shmcache shm_cache;
+	/* If set, data blocks are found by a hash of their compressed bytes */
+	sqfs_cache *content_cache;
+	sqfs_cache content_cache_own;
+	/* Decompress data blocks only as far as reads need */
+	bool partial_decode;
+
+	/* Block accesses are recorded here, or replayed from here, if set */
+	sqfs_profile profile;
+	/* Fetches files near those looked up, if set */
+	sqfs_prefetch prefetch;
+	/* Shrinks the caches when memory is short, if set */
+	sqfs_mempressure mempressure;
+
+	/* Work done on the image, see sqfs_io_stats_get */
+	sqfs_io_stats io_stats;
+
+	/* See sqfs_image_id, computed on first use */
+	uint64_t image_id;
+	bool image_id_known;
 };
 
 typedef uint32_t sqfs_xattr_idx;
@@ -58,6 +100,7 @@ struct sqfs_inode {
 	struct squashfs_base_inode base;
 	int nlink;
 	sqfs_xattr_idx xattr;
+	sqfs_inode_id id;	/* where it was read from */
 	
 	sqfs_md_cursor next;
 	
@@ -93,6 +136,64 @@ sqfs_err sqfs_init(sqfs *fs, sqfs_fd_t fd, size_t offset);
 sqfs_err sqfs_init_with_subdir(sqfs *fs, sqfs_fd_t fd, size_t offset, const char *subdir);
 void sqfs_destroy(sqfs *fs);
 
+/* Read the image with O_DIRECT from now on, so compressed data doesn't
+ * occupy the kernel page cache. Returns SQFS_UNSUP if the platform or
+ * the underlying filesystem can't do it. */
+sqfs_err sqfs_direct_io_enable(sqfs *fs);
+
+/* Read and decompress the whole inode and directory tables up front, with
+ * large sequential reads. Later metadata lookups in that range never touch
+ * the image. Must be called before the filesystem is used concurrently. */
+sqfs_err sqfs_md_preload(sqfs *fs);
+
+/* Identify the image, for caches and profiles that outlive this process.
+ * This is a fast hash of the superblock, the offset, and all the metadata
+ * tables from the inode table on, which give the position and size of every
+ * block. Computed on first use, which reads those tables. */
+sqfs_err sqfs_image_id(sqfs *fs, uint64_t *id);
+
+/* Keep decompressed blocks in directory 'dir', so they survive a remount.
+ * Entries are keyed by sqfs_image_id(). If 'max_bytes' isn't zero, the
+ * least recently used entries of all images in 'dir' are removed to keep
+ * it about that size. */
+sqfs_err sqfs_disk_cache_enable(sqfs *fs, const char *dir,
+	uint64_t max_bytes);
+
+/* Share up to 'count' decompressed data blocks with other processes using
+ * the same image. Returns SQFS_UNSUP if the platform can't do it. */
+sqfs_err sqfs_shm_cache_enable(sqfs *fs, size_t count);
+
+/* Find data blocks by a hash of their compressed bytes and the compression
+ * type, so identical blocks at any offset, in any image, are decompressed
+ * once. Blocks are kept in 'shared', a block cache that may serve several
+ * filesystems, or if that's NULL in a private cache of 'count' blocks. It's
+ * keyed by a fast 128-bit hash; the disk and shared memory caches, which
+ * other processes fill, use a SHA-256 digest instead.
+ * Call this before enabling the disk or shared memory caches, so they are
+ * keyed by content too, and can be shared with other images. */
+sqfs_err sqfs_content_cache_enable(sqfs *fs, sqfs_cache *shared, size_t count);
+
+/* Set the number of blocks held by each in-memory cache tier, discarding
+ * their contents. Zero leaves a tier as it is. The compressed tier holds
+ * data and fragment blocks as stored in the image, below the decompressed
+ * caches, so a miss there costs only decompression; it's off by default. */
+sqfs_err sqfs_cache_sizes_set(sqfs *fs, size_t data, size_t frag,
+	size_t compressed);
+
+/* Use 1/2^shift of the blocks in the data, fragment and compressed caches,
+ * and keep no idle direct I/O buffers unless shift is zero. Safe to call
+ * while the filesystem is in use. */
+void sqfs_cache_shrink(sqfs *fs, unsigned shift);
+
+/* Decompress data blocks incrementally, only as far as reads into them
+ * need, keeping the decoder state in the cache to continue later. Returns
+ * SQFS_UNSUP if the image's compression can't be decoded that way. Blocks
+ * found by content are still decompressed whole. */
+sqfs_err sqfs_partial_decode_enable(sqfs *fs);
+
+/* Read the I/O counters. Safe to call while the filesystem is in use. */
+void sqfs_io_stats_get(sqfs *fs, sqfs_io_stats *stats);
+
 /* Ok to call these even on incompletely constructed filesystems */
 void sqfs_version(sqfs *fs, int *major, int *minor);
 sqfs_compression_type sqfs_compression(sqfs *fs);
@@ -104,7 +205,22 @@ void sqfs_data_header(uint32_t hdr, bool *compressed, uint32_t *size);
 typedef struct {
 	sqfs_block *block;
 	size_t data_size;
+	/* Where to write the block when it's evicted, if anywhere */
+	sqfs_diskcache spill;
+	sqfs_off_t pos;
+	/* What the block was decoded from, when it's keyed by content: the
+	 * rest of the fast hash for memory, a digest for the disk cache */
+	uint64_t check;
+	sqfs_digest digest;
+	/* Decoder for the rest of a partially decompressed block, if any */
+	sqfs_stream partial;
+	bool partial_failed;
 } sqfs_block_cache_entry;
+struct sqfs_md_preloaded {
+	sqfs_off_t pos;
+	size_t data_size;
+	sqfs_block *block;
+};
 sqfs_err sqfs_block_cache_init(sqfs_cache *cache, size_t count);
 sqfs_err sqfs_block_read(sqfs *fs, sqfs_off_t pos, bool compressed, uint32_t size,
 	size_t outsize, sqfs_block **block);
@@ -119,6 +235,10 @@ sqfs_err sqfs_data_block_read(sqfs *fs, sqfs_off_t pos, uint32_t hdr,
 sqfs_err sqfs_md_cache(sqfs *fs, sqfs_off_t *pos, sqfs_block **block);
 sqfs_err sqfs_data_cache(sqfs *fs, sqfs_cache *cache, sqfs_off_t pos,
 	uint32_t hdr, sqfs_block **block);
+/* Like sqfs_data_cache(), but the block may only be decompressed as far as
+ * 'want' bytes. Use only the first *avail bytes of it, not block->size. */
+sqfs_err sqfs_data_cache_prefix(sqfs *fs, sqfs_cache *cache, sqfs_off_t pos,
+	uint32_t hdr, size_t want, sqfs_block **block, size_t *avail);
 
 void sqfs_md_cursor_inode(sqfs_md_cursor *cur, sqfs_inode_id id, sqfs_off_t base);
 
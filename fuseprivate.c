@@ -85,6 +85,28 @@ int sqfs_usage(char *progname, bool fuse_usage, bool ll_usage) {
 		fprintf(stderr, "    -o timeout=N           idle N seconds for automatic unmount\n");
 		fprintf(stderr, "    -o uid=N               set file owner to uid N\n");
 		fprintf(stderr, "    -o gid=N               set file group to gid N\n");
+		fprintf(stderr, "    -o direct_io_image     read ARCHIVE with O_DIRECT, bypassing the page cache\n");
+		fprintf(stderr, "    -o preload_metadata    load all inodes and directories at mount time\n");
+		fprintf(stderr, "    -o disk_cache=DIR      keep decompressed blocks in DIR across mounts\n");
+		fprintf(stderr, "    -o disk_cache_size=N   keep DIR to about N MiB, removing the least\n"
+				"                           recently used blocks\n");
+		fprintf(stderr, "    -o shared_cache=N      share N decompressed blocks with other mounts\n"
+				"                           of the same ARCHIVE\n");
+		fprintf(stderr, "    -o content_cache=N     find blocks by content, keeping N in memory;\n"
+				"                           shared and disk caches then work across images\n");
+		fprintf(stderr, "    -o data_cache=N        keep N decompressed data blocks in memory\n");
+		fprintf(stderr, "    -o frag_cache=N        keep N decompressed fragment blocks in memory\n");
+		fprintf(stderr, "    -o compressed_cache=N  keep N compressed blocks in memory\n");
+		fprintf(stderr, "    -o profile_record=FILE record the order blocks are first used in FILE\n");
+		fprintf(stderr, "    -o profile_replay=FILE prefetch blocks in the order recorded in FILE\n");
+		fprintf(stderr, "    -o profile_all         record every block access, for squashfuse_cachesim\n");
+		fprintf(stderr, "    -o prefetch_siblings=N prefetch the start of the N files after each\n"
+				"                           file looked up in a directory\n");
+		fprintf(stderr, "    -o partial_decompress  decompress data blocks only as far as reads need\n");
+		fprintf(stderr, "    -o memory_pressure     shrink caches while memory is short\n");
+		fprintf(stderr, "    -o metrics_socket=PATH serve Prometheus metrics on a Unix socket\n");
+		fprintf(stderr, "    -o trace=FILE          write spans of each request to FILE, for\n"
+				"                           chrome://tracing or Perfetto\n");
 	}
 
 	if (fuse_usage) {
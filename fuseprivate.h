@@ -51,6 +51,23 @@ typedef struct {
 	int uid;
 	int gid;
 	const char *notify_pipe;
+	int direct_io_image;
+	int preload_metadata;
+	const char *disk_cache;
+	size_t disk_cache_size;
+	size_t shared_cache;
+	size_t content_cache;
+	size_t data_cache;
+	size_t frag_cache;
+	size_t compressed_cache;
+	const char *profile_record;
+	const char *profile_replay;
+	int profile_all;
+	size_t prefetch_siblings;
+	int partial_decompress;
+	int memory_pressure;
+	const char *metrics_socket;
+	const char *trace;
 } sqfs_opts;
 int sqfs_opt_proc(void *data, const char *arg, int key,
 	struct fuse_args *outargs);
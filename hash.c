@@ -129,3 +129,185 @@ sqfs_err sqfs_hash_remove(sqfs_hash *h, sqfs_hash_key k) {
 	}
 	return SQFS_OK;
 }
+
+#define SQFS_HASH128_P0 0xa0761d6478bd642fULL
+#define SQFS_HASH128_P1 0xe7037ed1a0b428dbULL
+#define SQFS_HASH128_P2 0x8ebc6af09c88c6e3ULL
+#define SQFS_HASH128_P3 0x589965cc75374cc3ULL
+
+/* Multiply to 128 bits, and fold the halves together */
+static uint64_t sqfs_hash128_mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+	__extension__ unsigned __int128 r = (unsigned __int128)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+	uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+	uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+	uint64_t t = ll + (hl << 32), lo = t + (lh << 32);
+	uint64_t hi = hh + (hl >> 32) + (lh >> 32) + (t < ll) + (lo < t);
+	return lo ^ hi;
+#endif
+}
+
+static uint64_t sqfs_hash128_read(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+void sqfs_hash128(uint64_t seed, const void *buf, size_t size,
+		uint64_t out[2]) {
+	const unsigned char *p = buf;
+	unsigned char tail[32];
+	uint64_t a = seed ^ SQFS_HASH128_P0, b = seed ^ SQFS_HASH128_P3;
+	uint64_t len = size;
+
+	/* Two independent lanes of 16 bytes each */
+	for (; size > sizeof(tail); p += sizeof(tail), size -= sizeof(tail)) {
+		a = sqfs_hash128_mix(sqfs_hash128_read(p) ^ SQFS_HASH128_P1,
+			sqfs_hash128_read(p + 8) ^ a);
+		b = sqfs_hash128_mix(sqfs_hash128_read(p + 16) ^ SQFS_HASH128_P2,
+			sqfs_hash128_read(p + 24) ^ b);
+	}
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, p, size);
+	a = sqfs_hash128_mix(sqfs_hash128_read(tail) ^ SQFS_HASH128_P1,
+		sqfs_hash128_read(tail + 8) ^ a);
+	b = sqfs_hash128_mix(sqfs_hash128_read(tail + 16) ^ SQFS_HASH128_P2,
+		sqfs_hash128_read(tail + 24) ^ b);
+
+	out[0] = sqfs_hash128_mix(a ^ len, b ^ SQFS_HASH128_P0);
+	out[1] = sqfs_hash128_mix(b ^ SQFS_HASH128_P1, out[0] ^ a);
+}
+
+uint64_t sqfs_hash_bytes(uint64_t h, const void *buf, size_t size) {
+	const unsigned char *p = buf;
+	while (size--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static const uint32_t sqfs_sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SQFS_ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* One round, with the working variables renamed rather than moved */
+#define SQFS_SHA256_ROUND(a, b, c, d, e, f, g, h, i) do { \
+	uint32_t t1 = h + (SQFS_ROR32(e, 6) ^ SQFS_ROR32(e, 11) ^ \
+		SQFS_ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sqfs_sha256_k[i] + w[i]; \
+	uint32_t t2 = (SQFS_ROR32(a, 2) ^ SQFS_ROR32(a, 13) ^ \
+		SQFS_ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c)); \
+	d += t1; \
+	h = t1 + t2; \
+} while (0)
+
+static void sqfs_sha256_block(sqfs_sha256 *ctx, const unsigned char *p) {
+	uint32_t w[64], a, b, c, d, e, f, g, h;
+	int i;
+
+	for (i = 0; i < 16; ++i, p += 4)
+		w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+			(uint32_t)p[2] << 8 | p[3];
+	for (; i < 64; ++i) {
+		uint32_t s0 = SQFS_ROR32(w[i - 15], 7) ^ SQFS_ROR32(w[i - 15], 18) ^
+			(w[i - 15] >> 3);
+		uint32_t s1 = SQFS_ROR32(w[i - 2], 17) ^ SQFS_ROR32(w[i - 2], 19) ^
+			(w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	a = ctx->state[0];
+	b = ctx->state[1];
+	c = ctx->state[2];
+	d = ctx->state[3];
+	e = ctx->state[4];
+	f = ctx->state[5];
+	g = ctx->state[6];
+	h = ctx->state[7];
+	for (i = 0; i < 64; i += 8) {
+		SQFS_SHA256_ROUND(a, b, c, d, e, f, g, h, i);
+		SQFS_SHA256_ROUND(h, a, b, c, d, e, f, g, i + 1);
+		SQFS_SHA256_ROUND(g, h, a, b, c, d, e, f, i + 2);
+		SQFS_SHA256_ROUND(f, g, h, a, b, c, d, e, i + 3);
+		SQFS_SHA256_ROUND(e, f, g, h, a, b, c, d, i + 4);
+		SQFS_SHA256_ROUND(d, e, f, g, h, a, b, c, i + 5);
+		SQFS_SHA256_ROUND(c, d, e, f, g, h, a, b, i + 6);
+		SQFS_SHA256_ROUND(b, c, d, e, f, g, h, a, i + 7);
+	}
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+	ctx->state[5] += f;
+	ctx->state[6] += g;
+	ctx->state[7] += h;
+}
+
+void sqfs_sha256_init(sqfs_sha256 *ctx) {
+	static const uint32_t init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(ctx->state, init, sizeof(init));
+	ctx->len = 0;
+}
+
+void sqfs_sha256_update(sqfs_sha256 *ctx, const void *buf, size_t size) {
+	const unsigned char *p = buf;
+	size_t fill = ctx->len % sizeof(ctx->buf);
+
+	ctx->len += size;
+	if (fill) {
+		size_t take = sizeof(ctx->buf) - fill;
+		if (take > size)
+			take = size;
+		memcpy(ctx->buf + fill, p, take);
+		p += take;
+		size -= take;
+		if (fill + take < sizeof(ctx->buf))
+			return;
+		sqfs_sha256_block(ctx, ctx->buf);
+	}
+	for (; size >= sizeof(ctx->buf); p += sizeof(ctx->buf),
+			size -= sizeof(ctx->buf))
+		sqfs_sha256_block(ctx, p);
+	memcpy(ctx->buf, p, size);
+}
+
+void sqfs_sha256_final(sqfs_sha256 *ctx, sqfs_digest *digest) {
+	static const unsigned char pad[64] = { 0x80 };
+	unsigned char bits[8];
+	uint64_t len = ctx->len * 8;
+	size_t fill = ctx->len % sizeof(ctx->buf);
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		bits[i] = len >> (56 - 8 * i);
+	sqfs_sha256_update(ctx, pad, (fill < 56 ? 56 : 120) - fill);
+	sqfs_sha256_update(ctx, bits, sizeof(bits));
+	for (i = 0; i < 32; ++i)
+		digest->bytes[i] = ctx->state[i / 4] >> (24 - 8 * (i % 4));
+}
+
+uint64_t sqfs_digest_key(const sqfs_digest *digest) {
+	uint64_t key = 0;
+	int i;
+	for (i = 0; i < 8; ++i)
+		key = key << 8 | digest->bytes[i];
+	return key;
+}
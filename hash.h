@@ -60,4 +60,31 @@ sqfs_hash_value sqfs_hash_get(sqfs_hash *h, sqfs_hash_key k);
 sqfs_err sqfs_hash_add(sqfs_hash *h, sqfs_hash_key k, sqfs_hash_value v);
 sqfs_err sqfs_hash_remove(sqfs_hash *h, sqfs_hash_key k);
 
+/* FNV-1a hash of a byte string, for identifiers and checksums. Start with
+ * SQFS_HASH_BYTES_INIT, or continue from a previous result. */
+#define SQFS_HASH_BYTES_INIT 0xcbf29ce484222325ULL
+uint64_t sqfs_hash_bytes(uint64_t h, const void *buf, size_t size);
+
+/* Fast 128-bit hash of a byte string, to identify content within one
+ * process or an image by its metadata. It's not cryptographic: crafted
+ * input can collide. Continue across buffers by passing out[0] as the next
+ * 'seed'. */
+void sqfs_hash128(uint64_t seed, const void *buf, size_t size,
+	uint64_t out[2]);
+
+/* SHA-256, for content that must not be confused with other content even
+ * when it comes from another image or process */
+typedef struct {
+	uint32_t state[8];
+	uint64_t len;
+	unsigned char buf[64];
+} sqfs_sha256;
+
+void sqfs_sha256_init(sqfs_sha256 *ctx);
+void sqfs_sha256_update(sqfs_sha256 *ctx, const void *buf, size_t size);
+void sqfs_sha256_final(sqfs_sha256 *ctx, sqfs_digest *digest);
+
+/* The first 64 bits of a digest, for use as a cache key */
+uint64_t sqfs_digest_key(const sqfs_digest *digest);
+
 #endif
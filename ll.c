@@ -24,9 +24,15 @@
  */
 #include "ll.h"
 #include "fuseprivate.h"
+#include "ll_metrics.h"
 #include "stat.h"
 
+#include "mempressure.h"
 #include "nonstd.h"
+#include "prefetch.h"
+#include "probe.h"
+#include "profile.h"
+#include "trace.h"
 
 #include <errno.h>
 #include <float.h>
@@ -39,6 +45,10 @@
 
 static const double SQFS_TIMEOUT = DBL_MAX;
 
+/* How many blocks a profile replay may fetch before they're used. Much more
+ * than this and they'd be evicted from the default caches before use. */
+#define SQFS_LL_PROFILE_AHEAD 16
+
 /* See comment near alarm_tick for details of how idle timeouts are
    managed. */
 
@@ -90,10 +100,37 @@ static inline sig_atomic_t get_open_refcount(void) {
 #endif
 }
 
+#ifdef __GNUC__
+typedef struct {
+	const char *name;
+	fuse_ino_t ino;
+	uint64_t span;
+} sqfs_ll_op_info;
+
+static void sqfs_ll_op_done(sqfs_ll_op_info *op) {
+	SQFS_PROBE1(op__done, op->name);
+	if (op->span)
+		sqfs_trace_span(op->span, "fuse", op->name, "ino", op->ino, NULL, 0);
+}
+/* Fire op__start and start a trace span now, and finish both when the
+ * operation returns, after it has replied */
+#define SQFS_LL_OP(name, ino) \
+	sqfs_ll_op_info sqfs_ll_op __attribute__((cleanup(sqfs_ll_op_done))) = \
+		{ name, ino, sqfs_trace_begin() }; \
+	SQFS_PROBE2(op__start, sqfs_ll_op.name, (uint64_t)sqfs_ll_op.ino)
+#else
+#define SQFS_LL_OP(name, ino) ((void)0)
+#endif
+
+int sqfs_ll_open_handles(void) {
+	return get_open_refcount();
+}
+
 void sqfs_ll_op_getattr(fuse_req_t req, fuse_ino_t ino,
 		struct fuse_file_info *fi) {
 	sqfs_ll_i lli;
 	struct stat st;
+	SQFS_LL_OP("getattr", ino);
 	update_access_time();
 	if (sqfs_ll_iget(req, &lli, ino))
 		return;
@@ -109,6 +146,7 @@ void sqfs_ll_op_getattr(fuse_req_t req, fuse_ino_t ino,
 void sqfs_ll_op_opendir(fuse_req_t req, fuse_ino_t ino,
 		struct fuse_file_info *fi) {
 	sqfs_ll_i *lli;
+	SQFS_LL_OP("opendir", ino);
 	update_access_time();
 	
 	fi->fh = (intptr_t)NULL;
@@ -134,12 +172,14 @@ void sqfs_ll_op_opendir(fuse_req_t req, fuse_ino_t ino,
 
 void sqfs_ll_op_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 			      mode_t mode, struct fuse_file_info *fi) {
+	SQFS_LL_OP("create", parent);
 	update_access_time();
 	fuse_reply_err(req, EROFS);
 }
 
 void sqfs_ll_op_releasedir(fuse_req_t req, fuse_ino_t ino,
 		struct fuse_file_info *fi) {
+	SQFS_LL_OP("releasedir", ino);
 	update_access_time();
 	update_open_refcount(-1);
 	free((sqfs_ll_i*)(intptr_t)fi->fh);
@@ -171,6 +211,7 @@ void sqfs_ll_op_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
 	sqfs_ll_i *lli = (sqfs_ll_i*)(intptr_t)fi->fh;
 	int err = 0;
 	
+	SQFS_LL_OP("readdir", ino);
 	update_access_time();
 
 #ifdef SQFS_BROKEN_DIR_OFFSETS
@@ -251,6 +292,7 @@ void sqfs_ll_op_lookup(fuse_req_t req, fuse_ino_t parent,
 	bool found;
 	sqfs_inode inode;
 	
+	SQFS_LL_OP("lookup", parent);
 	update_access_time();
 	if (sqfs_ll_iget(req, &lli, parent))
 		return;
@@ -283,6 +325,11 @@ void sqfs_ll_op_lookup(fuse_req_t req, fuse_ino_t parent,
 	if (sqfs_inode_get(&lli.ll->fs, &inode, sqfs_dentry_inode(&entry))) {
 		fuse_reply_err(req, ENOENT);
 	} else {
+		if (lli.ll->fs.prefetch && S_ISREG(inode.base.mode))
+			sqfs_prefetch_siblings(&lli.ll->fs.prefetch,
+				lli.ll->ino_sqfs(lli.ll, parent),
+				sqfs_dentry_next_offset(&entry));
+
 		struct fuse_entry_param fentry;
 		memset(&fentry, 0, sizeof(fentry));
 		if (sqfs_stat(&lli.ll->fs, &inode, &fentry.attr)) {
@@ -301,6 +348,7 @@ void sqfs_ll_op_open(fuse_req_t req, fuse_ino_t ino,
 	sqfs_inode *inode;
 	sqfs_ll *ll;
 	
+	SQFS_LL_OP("open", ino);
 	update_access_time();
 	if (fi->flags & (O_WRONLY | O_RDWR)) {
 		fuse_reply_err(req, EROFS);
@@ -332,6 +380,7 @@ void sqfs_ll_op_release(fuse_req_t req, fuse_ino_t ino,
 		struct fuse_file_info *fi) {
 	free((sqfs_inode*)(intptr_t)fi->fh);
 	fi->fh = 0;
+	SQFS_LL_OP("release", ino);
 	update_access_time();
 	update_open_refcount(-1);
 	fuse_reply_err(req, 0);
@@ -350,6 +399,7 @@ void sqfs_ll_op_read(fuse_req_t req, fuse_ino_t ino,
 		return;
 	}
 	
+	SQFS_LL_OP("read", ino);
 	update_access_time();
 	osize = size;
 	err = sqfs_read_range(&ll->fs, inode, off, &osize, buf);
@@ -358,15 +408,44 @@ void sqfs_ll_op_read(fuse_req_t req, fuse_ino_t ino,
 	} else if (osize == 0) { /* EOF */
 		fuse_reply_buf(req, NULL, 0);
 	} else {
+		if (ll->metrics)
+			sqfs_ll_metrics_read(&ll->metrics, osize);
+		SQFS_PROBE1(read__reply__start, (int64_t)osize);
 		fuse_reply_buf(req, buf, osize);
+		SQFS_PROBE1(read__reply__done, (int64_t)osize);
 	}
 	free(buf);
 }
 
+#ifdef SQFS_LL_LSEEK
+/* Lets cp --sparse and the like skip holes without reading them. Nothing
+ * else reaches us, the kernel handles the other kinds of seek. */
+void sqfs_ll_op_lseek(fuse_req_t req, fuse_ino_t ino, off_t off, int whence,
+		struct fuse_file_info *fi) {
+	sqfs_ll *ll = fuse_req_userdata(req);
+	sqfs_inode *inode = (sqfs_inode*)(intptr_t)fi->fh;
+	sqfs_off_t found;
+
+	SQFS_LL_OP("lseek", ino);
+	update_access_time();
+	if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+		fuse_reply_err(req, EINVAL);
+	} else if (sqfs_seek_data(&ll->fs, inode, off, whence == SEEK_DATA,
+			&found)) {
+		fuse_reply_err(req, EIO);
+	} else if (found < 0) {
+		fuse_reply_err(req, ENXIO);
+	} else {
+		fuse_reply_lseek(req, found);
+	}
+}
+#endif
+
 void sqfs_ll_op_readlink(fuse_req_t req, fuse_ino_t ino) {
 	char *dst;
 	size_t size;
 	sqfs_ll_i lli;
+	SQFS_LL_OP("readlink", ino);
 	update_access_time();
 	if (sqfs_ll_iget(req, &lli, ino))
 		return;
@@ -391,6 +470,7 @@ void sqfs_ll_op_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size) {
 	char *buf;
 	int ferr;
 	
+	SQFS_LL_OP("listxattr", ino);
 	update_access_time();
 	if (sqfs_ll_iget(req, &lli, ino))
 		return;
@@ -429,6 +509,7 @@ void sqfs_ll_op_getxattr(fuse_req_t req, fuse_ino_t ino,
 	}
 #endif
 	
+	SQFS_LL_OP("getxattr", ino);
 	update_access_time();
 	if (sqfs_ll_iget(req, &lli, ino))
 		return;
@@ -456,6 +537,7 @@ void sqfs_ll_op_forget(fuse_req_t req, fuse_ino_t ino,
 #endif
 		) {
 	sqfs_ll_i lli;
+	SQFS_LL_OP("forget", ino);
 	update_access_time();
 	sqfs_ll_iget(req, &lli, SQFS_FUSE_INODE_NONE);
 	lli.ll->ino_forget(lli.ll, ino, nlookup);
@@ -467,6 +549,7 @@ void stfs_ll_op_statfs(fuse_req_t req, fuse_ino_t ino) {
 	struct statvfs st;
 	int err;
 
+	SQFS_LL_OP("statfs", ino);
 	ll = fuse_req_userdata(req);
 	err = sqfs_statfs(&ll->fs, &st);
 	if (err == 0) {
@@ -479,6 +562,17 @@ void stfs_ll_op_statfs(fuse_req_t req, fuse_ino_t ino) {
 void sqfs_ll_op_init(void *userdata, struct fuse_conn_info *conn) {
 	sqfs_ll *ll = userdata;
 
+	/* Now that we've daemonized, threads are safe to start */
+	if (ll->fs.profile)
+		sqfs_profile_replay_start(&ll->fs.profile, &ll->fs,
+			SQFS_LL_PROFILE_AHEAD);
+	if (ll->fs.prefetch)
+		sqfs_prefetch_start(&ll->fs.prefetch);
+	if (ll->fs.mempressure)
+		sqfs_mempressure_start(&ll->fs.mempressure);
+	if (ll->metrics)
+		sqfs_ll_metrics_start(&ll->metrics);
+
 	notify_mount_ready_async(ll->fs.notify_pipe, NOTIFY_SUCCESS);
 }
 
@@ -28,8 +28,17 @@
 #include "squashfuse.h"
 
 #include <fuse_lowlevel.h>
+#include <unistd.h>
+
+/* FUSE 3.8 passes SEEK_DATA and SEEK_HOLE on to us, if we can answer them */
+#if HAVE_DECL_FUSE_REPLY_LSEEK && defined(SEEK_DATA) && defined(SEEK_HOLE)
+#define SQFS_LL_LSEEK 1
+#endif
 
 typedef struct sqfs_ll sqfs_ll;
+/* See ll_metrics.h, which isn't installed */
+typedef struct sqfs_ll_metrics_internal *sqfs_ll_metrics;
+
 struct sqfs_ll {
 	sqfs fs;
 	
@@ -47,6 +56,9 @@ struct sqfs_ll {
 	/* Private data, and how to destroy it */
 	void *ino_data;
 	void (*ino_destroy)(sqfs_ll *ll);	
+
+	/* Served while mounted, if set */
+	sqfs_ll_metrics metrics;
 };
 
 sqfs_err sqfs_ll_init(sqfs_ll *ll);
@@ -99,6 +111,11 @@ void sqfs_ll_op_read(fuse_req_t req, fuse_ino_t ino,
 
 void sqfs_ll_op_readlink(fuse_req_t req, fuse_ino_t ino);
 
+#ifdef SQFS_LL_LSEEK
+void sqfs_ll_op_lseek(fuse_req_t req, fuse_ino_t ino, off_t off, int whence,
+		struct fuse_file_info *fi);
+#endif
+
 void sqfs_ll_op_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size);
 
 void sqfs_ll_op_getxattr(fuse_req_t req, fuse_ino_t ino,
@@ -118,6 +135,9 @@ void sqfs_ll_op_forget(fuse_req_t req, fuse_ino_t ino,
 
 void sqfs_ll_op_init(void *userdata, struct fuse_conn_info *conn);
 
+/* Number of files and directories currently open */
+int sqfs_ll_open_handles(void);
+
 void stfs_ll_op_statfs(fuse_req_t req, fuse_ino_t ino);
 
 
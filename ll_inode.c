@@ -25,6 +25,7 @@
 #include "ll.h"
 
 #include "hash.h"
+#include "ll_metrics.h"
 #include "nonstd.h"
 
 #include <errno.h>
@@ -337,6 +338,7 @@ sqfs_err sqfs_ll_init(sqfs_ll *ll) {
 }
 
 void sqfs_ll_destroy(sqfs_ll *ll) {
+	sqfs_ll_metrics_destroy(&ll->metrics);
 	sqfs_destroy(&ll->fs);
 	if (ll->ino_destroy)
 		ll->ino_destroy(ll);
@@ -24,9 +24,14 @@
  */
 #include "ll.h"
 #include "fuseprivate.h"
+#include "ll_metrics.h"
 #include "stat.h"
 
+#include "mempressure.h"
 #include "nonstd.h"
+#include "prefetch.h"
+#include "profile.h"
+#include "trace.h"
 
 #include <errno.h>
 #include <float.h>
@@ -37,6 +42,9 @@
 #include <signal.h>
 #include <unistd.h>
 
+/* Private data blocks kept with -o shared_cache, unless -o data_cache */
+#define SQFS_LL_SHARED_DATA_BLKS 8
+
 
 #if defined(SQFS_SIGTERM_HANDLER)
 #include <sys/utsname.h>
@@ -136,6 +144,7 @@ int main(int argc, char *argv[]) {
 	
 	int err;
 	int sqfs_err;
+	uint64_t image_id;
 	sqfs_ll *ll = NULL;
 	struct fuse_opt fuse_opts[] = {
 		{"offset=%zu", offsetof(sqfs_opts, offset), 0},
@@ -144,6 +153,23 @@ int main(int argc, char *argv[]) {
 		{"gid=%d", offsetof(sqfs_opts, gid), 0},
 		{"subdir=%s", offsetof(sqfs_opts, subdir), 0},
 		{"notify_pipe=%s", offsetof(sqfs_opts, notify_pipe), 0},
+		{"direct_io_image", offsetof(sqfs_opts, direct_io_image), 1},
+		{"preload_metadata", offsetof(sqfs_opts, preload_metadata), 1},
+		{"disk_cache=%s", offsetof(sqfs_opts, disk_cache), 0},
+		{"disk_cache_size=%zu", offsetof(sqfs_opts, disk_cache_size), 0},
+		{"shared_cache=%zu", offsetof(sqfs_opts, shared_cache), 0},
+		{"content_cache=%zu", offsetof(sqfs_opts, content_cache), 0},
+		{"data_cache=%zu", offsetof(sqfs_opts, data_cache), 0},
+		{"frag_cache=%zu", offsetof(sqfs_opts, frag_cache), 0},
+		{"compressed_cache=%zu", offsetof(sqfs_opts, compressed_cache), 0},
+		{"profile_record=%s", offsetof(sqfs_opts, profile_record), 0},
+		{"profile_replay=%s", offsetof(sqfs_opts, profile_replay), 0},
+		{"profile_all", offsetof(sqfs_opts, profile_all), 1},
+		{"prefetch_siblings=%zu", offsetof(sqfs_opts, prefetch_siblings), 0},
+		{"partial_decompress", offsetof(sqfs_opts, partial_decompress), 1},
+		{"memory_pressure", offsetof(sqfs_opts, memory_pressure), 1},
+		{"metrics_socket=%s", offsetof(sqfs_opts, metrics_socket), 0},
+		{"trace=%s", offsetof(sqfs_opts, trace), 0},
 		FUSE_OPT_END
 	};
 	
@@ -159,6 +185,9 @@ int main(int argc, char *argv[]) {
 	sqfs_ll_ops.release		= sqfs_ll_op_release;
 	sqfs_ll_ops.read		= sqfs_ll_op_read;
 	sqfs_ll_ops.readlink	= sqfs_ll_op_readlink;
+#ifdef SQFS_LL_LSEEK
+	sqfs_ll_ops.lseek		= sqfs_ll_op_lseek;
+#endif
 	sqfs_ll_ops.listxattr	= sqfs_ll_op_listxattr;
 	sqfs_ll_ops.getxattr	= sqfs_ll_op_getxattr;
 	sqfs_ll_ops.forget		= sqfs_ll_op_forget;
@@ -179,6 +208,23 @@ int main(int argc, char *argv[]) {
 	opts.gid = 0;
 	opts.subdir = NULL;
 	opts.notify_pipe = NULL;
+	opts.direct_io_image = 0;
+	opts.preload_metadata = 0;
+	opts.disk_cache = NULL;
+	opts.disk_cache_size = 0;
+	opts.shared_cache = 0;
+	opts.content_cache = 0;
+	opts.data_cache = 0;
+	opts.frag_cache = 0;
+	opts.compressed_cache = 0;
+	opts.profile_record = NULL;
+	opts.profile_replay = NULL;
+	opts.profile_all = 0;
+	opts.prefetch_siblings = 0;
+	opts.partial_decompress = 0;
+	opts.memory_pressure = 0;
+	opts.metrics_socket = NULL;
+	opts.trace = NULL;
 	if (fuse_opt_parse(&args, &opts, fuse_opts, sqfs_opt_proc) == -1) {
 		err = sqfs_usage(argv[0], true, true);
 		goto out;
@@ -225,6 +271,114 @@ int main(int argc, char *argv[]) {
 
 	/* OPEN FS */
 	err = !(ll = sqfs_ll_open_with_subdir(opts.image, opts.offset, opts.subdir));
+	if (!err && opts.direct_io_image && sqfs_direct_io_enable(&ll->fs)) {
+		fprintf(stderr, "Can't read this image with direct I/O\n");
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
+	if (!err && opts.preload_metadata && sqfs_md_preload(&ll->fs)) {
+		fprintf(stderr, "Can't preload metadata\n");
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
+	/* Only an optimization, whole blocks work for any compression */
+	if (!err && opts.partial_decompress &&
+			sqfs_partial_decode_enable(&ll->fs))
+		fprintf(stderr, "Can't decompress this image partially, "
+			"decompressing whole blocks\n");
+	if (!err && sqfs_cache_sizes_set(&ll->fs, opts.data_cache,
+			opts.frag_cache, opts.compressed_cache)) {
+		fprintf(stderr, "Can't allocate caches\n");
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
+	/* Before the other caches, which then key blocks the same way */
+	if (!err && opts.content_cache &&
+			sqfs_content_cache_enable(&ll->fs, NULL, opts.content_cache)) {
+		fprintf(stderr, "Can't set up content cache\n");
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
+	if (!err && opts.disk_cache &&
+			sqfs_disk_cache_enable(&ll->fs, opts.disk_cache,
+				(uint64_t)opts.disk_cache_size << 20)) {
+		fprintf(stderr, "Can't use disk cache directory %s\n", opts.disk_cache);
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
+	if (!err && opts.shared_cache &&
+			(sqfs_err = sqfs_shm_cache_enable(&ll->fs, opts.shared_cache))) {
+		/* Only fatal if it can never work */
+		if (sqfs_err == SQFS_UNSUP) {
+			fprintf(stderr, "Can't set up shared memory cache\n");
+			sqfs_ll_destroy(ll);
+			err = 1;
+		} else {
+			fprintf(stderr, "Can't share memory cache, using a private one\n");
+		}
+	}
+	/* Blocks are copied out of the segment, so a full private cache would
+	 * hold a second copy of most of them in each process */
+	if (!err && ll->fs.shm_cache && !opts.data_cache &&
+			sqfs_cache_sizes_set(&ll->fs, SQFS_LL_SHARED_DATA_BLKS, 0, 0)) {
+		fprintf(stderr, "Can't allocate caches\n");
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
+	/* Replay starts later, in sqfs_ll_op_init(), since we may fork */
+	if (!err && opts.profile_record && opts.profile_replay) {
+		fprintf(stderr, "Can't record and replay a profile at once\n");
+		sqfs_ll_destroy(ll);
+		err = 1;
+	} else if (!err && (opts.profile_record || opts.profile_replay) &&
+			sqfs_image_id(&ll->fs, &image_id)) {
+		fprintf(stderr, "Can't read the image's metadata tables\n");
+		sqfs_ll_destroy(ll);
+		err = 1;
+	} else if (!err && opts.profile_record &&
+			sqfs_profile_record_open(&ll->fs.profile, opts.profile_record,
+				image_id, opts.profile_all)) {
+		fprintf(stderr, "Can't write profile %s\n", opts.profile_record);
+		sqfs_ll_destroy(ll);
+		err = 1;
+	} else if (!err && opts.profile_replay && (sqfs_err =
+			sqfs_profile_load(&ll->fs.profile, opts.profile_replay, image_id))) {
+		if (sqfs_err == SQFS_BADFORMAT)
+			fprintf(stderr, "Profile %s wasn't recorded from this image\n",
+				opts.profile_replay);
+		else
+			fprintf(stderr, "Can't read profile %s\n", opts.profile_replay);
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
+	if (!err && opts.prefetch_siblings && sqfs_prefetch_init(&ll->fs.prefetch,
+			&ll->fs, opts.prefetch_siblings)) {
+		fprintf(stderr, "Can't set up sibling prefetch\n");
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
+	if (!err && opts.memory_pressure &&
+			sqfs_mempressure_init(&ll->fs.mempressure, &ll->fs)) {
+		fprintf(stderr, "Can't watch for memory pressure\n");
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
+	/* Served from sqfs_ll_op_init(), once we've forked */
+	if (!err && opts.metrics_socket) {
+		if (sqfs_ll_metrics_init(&ll->metrics, ll, opts.metrics_socket)) {
+			fprintf(stderr, "Can't serve metrics on %s\n", opts.metrics_socket);
+			sqfs_ll_destroy(ll);
+			err = 1;
+		} else {
+			sqfs_ll_metrics_wrap(&ll->metrics, &sqfs_ll_ops);
+		}
+	}
+	/* Finished at the end, once every traced thread is done */
+	if (!err && opts.trace && sqfs_trace_open(opts.trace)) {
+		fprintf(stderr, "Can't write trace %s\n", opts.trace);
+		sqfs_ll_destroy(ll);
+		err = 1;
+	}
 	
 	/* STARTUP FUSE */
 	if (!err) {
@@ -277,6 +431,7 @@ int main(int argc, char *argv[]) {
 	}
 
 out:
+	sqfs_trace_close();
 	if (err) {
 		if (opts.notify_pipe) {
 			notify_mount_ready(opts.notify_pipe, NOTIFY_FAILURE);
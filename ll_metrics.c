@@ -0,0 +1,668 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ll_metrics.h"
+
+#include "ll.h"
+
+#include <stdlib.h>
+
+#ifdef SQFS_MULTITHREADED
+
+#include "nonstd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* How long to wait for a client to say whether it speaks HTTP */
+#define SQFS_LL_METRICS_REQUEST_MS 100
+/* How long to wait for the rest of a request, or to send a reply */
+#define SQFS_LL_METRICS_IO_SECS 1
+#define SQFS_LL_METRICS_REQUEST_MAX 4096
+
+typedef enum {
+	SQFS_LL_OP_GETATTR,
+	SQFS_LL_OP_OPENDIR,
+	SQFS_LL_OP_RELEASEDIR,
+	SQFS_LL_OP_READDIR,
+	SQFS_LL_OP_LOOKUP,
+	SQFS_LL_OP_OPEN,
+	SQFS_LL_OP_CREATE,
+	SQFS_LL_OP_RELEASE,
+	SQFS_LL_OP_READ,
+	SQFS_LL_OP_READLINK,
+	SQFS_LL_OP_LISTXATTR,
+	SQFS_LL_OP_GETXATTR,
+	SQFS_LL_OP_FORGET,
+	SQFS_LL_OP_STATFS,
+	SQFS_LL_OP_LSEEK,
+	SQFS_LL_OP_COUNT
+} sqfs_ll_op;
+
+static const char *const sqfs_ll_op_names[SQFS_LL_OP_COUNT] = {
+	"getattr", "opendir", "releasedir", "readdir", "lookup", "open",
+	"create", "release", "read", "readlink", "listxattr", "getxattr",
+	"forget", "statfs", "lseek"
+};
+
+/* Upper bounds of the histogram buckets, in nanoseconds. There's one more
+ * bucket for anything slower. */
+static const uint64_t sqfs_ll_metrics_bounds[] = {
+	10000, 50000, 100000, 500000,
+	1000000, 5000000, 10000000, 50000000,
+	100000000, 500000000, 1000000000
+};
+#define SQFS_LL_METRICS_BUCKETS \
+	(sizeof(sqfs_ll_metrics_bounds) / sizeof(sqfs_ll_metrics_bounds[0]) + 1)
+
+typedef struct {
+	uint64_t buckets[SQFS_LL_METRICS_BUCKETS];
+	uint64_t sum_ns;
+} sqfs_ll_metrics_histogram;
+
+typedef struct sqfs_ll_metrics_internal {
+	struct sqfs_ll *ll;
+	struct fuse_lowlevel_ops ops;	/* the wrapped operations */
+	bool wrapped[SQFS_LL_OP_COUNT];
+	sqfs_ll_metrics_histogram latency[SQFS_LL_OP_COUNT];
+	uint64_t read_bytes;
+
+	char *path;
+	bool bound;		/* so path is ours to remove */
+	int listen;
+	int stop[2];	/* pipe, written to stop the server */
+	pthread_t thread;
+	bool running;
+} sqfs_ll_metrics_internal;
+
+/* A growing buffer to format the reply into */
+typedef struct {
+	char *data;
+	size_t len, cap;
+	bool failed;
+} sqfs_ll_metrics_buf;
+
+static void sqfs_ll_metrics_printf(sqfs_ll_metrics_buf *b, const char *fmt,
+		...) {
+	va_list ap;
+	int n;
+
+	if (b->failed)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+	va_end(ap);
+	if (n < 0) {
+		b->failed = true;
+		return;
+	}
+	if ((size_t)n >= b->cap - b->len) {
+		size_t cap = b->cap * 2 + n;
+		char *data = realloc(b->data, cap);
+		if (!data) {
+			b->failed = true;
+			return;
+		}
+		b->data = data;
+		b->cap = cap;
+		va_start(ap, fmt);
+		vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+		va_end(ap);
+	}
+	b->len += n;
+}
+
+static uint64_t sqfs_ll_metrics_load(const uint64_t *v) {
+	return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+static void sqfs_ll_metrics_format_ops(sqfs_ll_metrics_internal *m,
+		sqfs_ll_metrics_buf *b) {
+	size_t op, i;
+
+	sqfs_ll_metrics_printf(b,
+		"# HELP squashfuse_op_duration_seconds Time taken by FUSE operations.\n"
+		"# TYPE squashfuse_op_duration_seconds histogram\n");
+	for (op = 0; op < SQFS_LL_OP_COUNT; ++op) {
+		sqfs_ll_metrics_histogram *h = &m->latency[op];
+		const char *name = sqfs_ll_op_names[op];
+		uint64_t count = 0;
+
+		if (!m->wrapped[op])
+			continue;
+		for (i = 0; i < SQFS_LL_METRICS_BUCKETS; ++i) {
+			count += sqfs_ll_metrics_load(&h->buckets[i]);
+			if (i + 1 < SQFS_LL_METRICS_BUCKETS) {
+				sqfs_ll_metrics_printf(b, "squashfuse_op_duration_seconds_bucket"
+					"{op=\"%s\",le=\"%g\"} %llu\n", name,
+					sqfs_ll_metrics_bounds[i] / 1e9, (unsigned long long)count);
+			} else {
+				sqfs_ll_metrics_printf(b, "squashfuse_op_duration_seconds_bucket"
+					"{op=\"%s\",le=\"+Inf\"} %llu\n", name,
+					(unsigned long long)count);
+			}
+		}
+		sqfs_ll_metrics_printf(b,
+			"squashfuse_op_duration_seconds_sum{op=\"%s\"} %.9f\n"
+			"squashfuse_op_duration_seconds_count{op=\"%s\"} %llu\n",
+			name, sqfs_ll_metrics_load(&h->sum_ns) / 1e9,
+			name, (unsigned long long)count);
+	}
+}
+
+typedef struct {
+	const char *name;
+	sqfs_cache *cache;
+} sqfs_ll_metrics_cache;
+
+static void sqfs_ll_metrics_format_caches(sqfs_ll_metrics_internal *m,
+		sqfs_ll_metrics_buf *b) {
+	sqfs *fs = &m->ll->fs;
+	sqfs_ll_metrics_cache caches[6];
+	sqfs_cache_counters stats[6];
+	size_t n = 0, i, f;
+	static const struct {
+		const char *name, *help;
+		size_t offset;
+		bool seconds;
+	} counters[] = {
+		{ "squashfuse_cache_hits_total", "Cache lookups that hit.",
+			offsetof(sqfs_cache_counters, hits), false },
+		{ "squashfuse_cache_misses_total", "Cache lookups that missed.",
+			offsetof(sqfs_cache_counters, misses), false },
+		{ "squashfuse_cache_evictions_total",
+			"Valid cache entries displaced by a miss.",
+			offsetof(sqfs_cache_counters, evictions), false },
+		{ "squashfuse_cache_fills_total", "Cache misses that were filled.",
+			offsetof(sqfs_cache_counters, fills), false },
+		{ "squashfuse_cache_fill_seconds_total",
+			"Time from cache misses until they were filled.",
+			offsetof(sqfs_cache_counters, fill_ns), true },
+		{ "squashfuse_cache_fill_bytes_total",
+			"Bytes produced to fill cache entries.",
+			offsetof(sqfs_cache_counters, bytes), false },
+	};
+
+	caches[n].name = "metadata";
+	caches[n++].cache = &fs->md_cache;
+	caches[n].name = "data";
+	caches[n++].cache = &fs->data_cache;
+	caches[n].name = "fragment";
+	caches[n++].cache = &fs->frag_cache;
+	if (fs->raw_cache) {
+		caches[n].name = "compressed";
+		caches[n++].cache = &fs->raw_cache;
+	}
+	if (fs->content_cache) {
+		caches[n].name = "content";
+		caches[n++].cache = fs->content_cache;
+	}
+	caches[n].name = "block_index";
+	caches[n++].cache = &fs->blockidx;
+
+	for (i = 0; i < n; ++i)
+		sqfs_cache_stats(caches[i].cache, &stats[i]);
+
+	for (f = 0; f < sizeof(counters) / sizeof(counters[0]); ++f) {
+		sqfs_ll_metrics_printf(b, "# HELP %s %s\n# TYPE %s counter\n",
+			counters[f].name, counters[f].help, counters[f].name);
+		for (i = 0; i < n; ++i) {
+			uint64_t v = *(uint64_t*)((char*)&stats[i] + counters[f].offset);
+			if (counters[f].seconds) {
+				sqfs_ll_metrics_printf(b, "%s{cache=\"%s\"} %.9f\n",
+					counters[f].name, caches[i].name, v / 1e9);
+			} else {
+				sqfs_ll_metrics_printf(b, "%s{cache=\"%s\"} %llu\n",
+					counters[f].name, caches[i].name, (unsigned long long)v);
+			}
+		}
+	}
+
+	sqfs_ll_metrics_printf(b,
+		"# HELP squashfuse_cache_entries Entries the cache may use.\n"
+		"# TYPE squashfuse_cache_entries gauge\n");
+	for (i = 0; i < n; ++i) {
+		sqfs_ll_metrics_printf(b, "squashfuse_cache_entries{cache=\"%s\"} %zu\n",
+			caches[i].name, stats[i].entries);
+	}
+}
+
+static void sqfs_ll_metrics_format(sqfs_ll_metrics_internal *m,
+		sqfs_ll_metrics_buf *b) {
+	sqfs_io_stats io;
+
+	sqfs_ll_metrics_format_ops(m, b);
+	sqfs_ll_metrics_format_caches(m, b);
+
+	sqfs_io_stats_get(&m->ll->fs, &io);
+	sqfs_ll_metrics_printf(b,
+		"# HELP squashfuse_read_bytes_total Bytes returned by reads.\n"
+		"# TYPE squashfuse_read_bytes_total counter\n"
+		"squashfuse_read_bytes_total %llu\n"
+		"# HELP squashfuse_image_read_bytes_total Bytes read from the image.\n"
+		"# TYPE squashfuse_image_read_bytes_total counter\n"
+		"squashfuse_image_read_bytes_total %llu\n"
+		"# HELP squashfuse_decompressed_bytes_total Bytes produced by decompression.\n"
+		"# TYPE squashfuse_decompressed_bytes_total counter\n"
+		"squashfuse_decompressed_bytes_total %llu\n"
+		"# HELP squashfuse_decompress_seconds_total Time spent decompressing.\n"
+		"# TYPE squashfuse_decompress_seconds_total counter\n"
+		"squashfuse_decompress_seconds_total %.9f\n"
+		"# HELP squashfuse_open_handles Files and directories currently open.\n"
+		"# TYPE squashfuse_open_handles gauge\n"
+		"squashfuse_open_handles %d\n",
+		(unsigned long long)sqfs_ll_metrics_load(&m->read_bytes),
+		(unsigned long long)io.read_bytes,
+		(unsigned long long)io.decompressed_bytes,
+		io.decompress_ns / 1e9,
+		(int)sqfs_ll_open_handles());
+}
+
+static void sqfs_ll_metrics_record(sqfs_ll_metrics_internal *m, sqfs_ll_op op,
+		uint64_t ns) {
+	sqfs_ll_metrics_histogram *h = &m->latency[op];
+	size_t i = 0;
+	while (i + 1 < SQFS_LL_METRICS_BUCKETS && ns > sqfs_ll_metrics_bounds[i])
+		++i;
+	__atomic_fetch_add(&h->buckets[i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+}
+
+/* Time an operation. Each one replies before returning, and the request is
+ * gone after that, so find the metrics first. */
+#define SQFS_LL_METRICS_TIME(req, op, field, args) do { \
+		sqfs_ll_metrics_internal *m = \
+			((struct sqfs_ll*)fuse_req_userdata(req))->metrics; \
+		uint64_t start = sqfs_clock_ns(); \
+		m->ops.field args; \
+		sqfs_ll_metrics_record(m, op, sqfs_clock_ns() - start); \
+	} while (0)
+
+static void sqfs_ll_metrics_getattr(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_GETATTR, getattr, (req, ino, fi));
+}
+
+static void sqfs_ll_metrics_opendir(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_OPENDIR, opendir, (req, ino, fi));
+}
+
+static void sqfs_ll_metrics_releasedir(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_RELEASEDIR, releasedir,
+		(req, ino, fi));
+}
+
+static void sqfs_ll_metrics_readdir(fuse_req_t req, fuse_ino_t ino,
+		size_t size, off_t off, struct fuse_file_info *fi) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_READDIR, readdir,
+		(req, ino, size, off, fi));
+}
+
+static void sqfs_ll_metrics_lookup(fuse_req_t req, fuse_ino_t parent,
+		const char *name) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_LOOKUP, lookup, (req, parent, name));
+}
+
+static void sqfs_ll_metrics_open(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_OPEN, open, (req, ino, fi));
+}
+
+static void sqfs_ll_metrics_create(fuse_req_t req, fuse_ino_t parent,
+		const char *name, mode_t mode, struct fuse_file_info *fi) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_CREATE, create,
+		(req, parent, name, mode, fi));
+}
+
+static void sqfs_ll_metrics_release(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_RELEASE, release, (req, ino, fi));
+}
+
+static void sqfs_ll_metrics_read_op(fuse_req_t req, fuse_ino_t ino,
+		size_t size, off_t off, struct fuse_file_info *fi) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_READ, read, (req, ino, size, off, fi));
+}
+
+static void sqfs_ll_metrics_readlink(fuse_req_t req, fuse_ino_t ino) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_READLINK, readlink, (req, ino));
+}
+
+static void sqfs_ll_metrics_listxattr(fuse_req_t req, fuse_ino_t ino,
+		size_t size) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_LISTXATTR, listxattr,
+		(req, ino, size));
+}
+
+static void sqfs_ll_metrics_getxattr(fuse_req_t req, fuse_ino_t ino,
+		const char *name, size_t size
+#ifdef FUSE_XATTR_POSITION
+		, uint32_t position
+#endif
+		) {
+#ifdef FUSE_XATTR_POSITION
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_GETXATTR, getxattr,
+		(req, ino, name, size, position));
+#else
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_GETXATTR, getxattr,
+		(req, ino, name, size));
+#endif
+}
+
+static void sqfs_ll_metrics_forget(fuse_req_t req, fuse_ino_t ino,
+#ifdef HAVE_FUSE_LL_FORGET_OP_64T
+		uint64_t nlookup
+#else
+		unsigned long nlookup
+#endif
+		) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_FORGET, forget, (req, ino, nlookup));
+}
+
+static void sqfs_ll_metrics_statfs(fuse_req_t req, fuse_ino_t ino) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_STATFS, statfs, (req, ino));
+}
+
+#ifdef SQFS_LL_LSEEK
+static void sqfs_ll_metrics_lseek(fuse_req_t req, fuse_ino_t ino, off_t off,
+		int whence, struct fuse_file_info *fi) {
+	SQFS_LL_METRICS_TIME(req, SQFS_LL_OP_LSEEK, lseek,
+		(req, ino, off, whence, fi));
+}
+#endif
+
+void sqfs_ll_metrics_wrap(sqfs_ll_metrics *mp, struct fuse_lowlevel_ops *ops) {
+	sqfs_ll_metrics_internal *m = *mp;
+	m->ops = *ops;
+#define SQFS_LL_METRICS_WRAP(op, field, fn) \
+	if (ops->field) { \
+		ops->field = fn; \
+		m->wrapped[op] = true; \
+	}
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_GETATTR, getattr, sqfs_ll_metrics_getattr);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_OPENDIR, opendir, sqfs_ll_metrics_opendir);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_RELEASEDIR, releasedir,
+		sqfs_ll_metrics_releasedir);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_READDIR, readdir, sqfs_ll_metrics_readdir);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_LOOKUP, lookup, sqfs_ll_metrics_lookup);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_OPEN, open, sqfs_ll_metrics_open);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_CREATE, create, sqfs_ll_metrics_create);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_RELEASE, release, sqfs_ll_metrics_release);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_READ, read, sqfs_ll_metrics_read_op);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_READLINK, readlink,
+		sqfs_ll_metrics_readlink);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_LISTXATTR, listxattr,
+		sqfs_ll_metrics_listxattr);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_GETXATTR, getxattr,
+		sqfs_ll_metrics_getxattr);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_FORGET, forget, sqfs_ll_metrics_forget);
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_STATFS, statfs, sqfs_ll_metrics_statfs);
+#ifdef SQFS_LL_LSEEK
+	SQFS_LL_METRICS_WRAP(SQFS_LL_OP_LSEEK, lseek, sqfs_ll_metrics_lseek);
+#endif
+#undef SQFS_LL_METRICS_WRAP
+}
+
+void sqfs_ll_metrics_read(sqfs_ll_metrics *mp, size_t bytes) {
+	__atomic_fetch_add(&(*mp)->read_bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+}
+
+static bool sqfs_ll_metrics_send(int fd, const char *data, size_t len) {
+	while (len) {
+#ifdef MSG_NOSIGNAL
+		ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+#else
+		ssize_t sent = send(fd, data, len, 0);
+#endif
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		data += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+/* Answer one client. Anything that doesn't send a GET request straight away
+ * gets the bare text, so a plain socket client works as well as curl. */
+static void sqfs_ll_metrics_serve(sqfs_ll_metrics_internal *m, int fd) {
+	static const char header[] = "HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Connection: close\r\n\r\n";
+	char req[SQFS_LL_METRICS_REQUEST_MAX];
+	size_t got = 0;
+	bool http = false;
+	struct pollfd pfd;
+	struct timeval tv;
+	sqfs_ll_metrics_buf b;
+
+	tv.tv_sec = SQFS_LL_METRICS_IO_SECS;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, SQFS_LL_METRICS_REQUEST_MS) > 0) {
+		/* Read the whole request, so closing doesn't reset the
+		 * connection before the client sees the reply */
+		while (got < sizeof(req) - 1) {
+			ssize_t r = recv(fd, req + got, sizeof(req) - 1 - got, 0);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				break;
+			got += r;
+			req[got] = '\0';
+			if (got >= 4 && memcmp(req, "GET ", 4) != 0)
+				break;
+			if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+				break;
+		}
+		http = got >= 4 && memcmp(req, "GET ", 4) == 0;
+	}
+
+	b.len = 0;
+	b.cap = 16 * 1024;
+	b.failed = false;
+	if (!(b.data = malloc(b.cap)))
+		return;
+	sqfs_ll_metrics_format(m, &b);
+	if (!b.failed && (!http ||
+			sqfs_ll_metrics_send(fd, header, sizeof(header) - 1)))
+		sqfs_ll_metrics_send(fd, b.data, b.len);
+	free(b.data);
+}
+
+static void *sqfs_ll_metrics_worker(void *arg) {
+	sqfs_ll_metrics_internal *m = arg;
+
+	while (true) {
+		struct pollfd fds[2];
+		int fd, flags;
+
+		fds[0].fd = m->stop[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = m->listen;
+		fds[1].events = POLLIN;
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[0].revents)
+			break;
+		if (!fds[1].revents)
+			continue;
+
+		/* The client may be gone by now, so the socket doesn't block */
+		if ((fd = accept(m->listen, NULL, NULL)) == -1)
+			continue;
+		/* Some systems pass on O_NONBLOCK, we want the timeouts instead */
+		if ((flags = fcntl(fd, F_GETFL)) != -1)
+			fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+		sqfs_ll_metrics_serve(m, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+/* Whether path is a socket nobody is listening on */
+static bool sqfs_ll_metrics_stale(const struct sockaddr_un *addr) {
+	struct stat st;
+	bool stale = false;
+	int fd;
+
+	if (lstat(addr->sun_path, &st) || !S_ISSOCK(st.st_mode))
+		return false;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		return false;
+	if (connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == -1)
+		stale = errno == ECONNREFUSED;
+	close(fd);
+	return stale;
+}
+
+sqfs_err sqfs_ll_metrics_init(sqfs_ll_metrics *mp, struct sqfs_ll *ll,
+		const char *path) {
+	sqfs_ll_metrics_internal *m;
+	struct sockaddr_un addr;
+	char cwd[PATH_MAX];
+	int flags;
+
+	if (!(m = calloc(1, sizeof(*m))))
+		return SQFS_ERR;
+	m->ll = ll;
+	m->listen = -1;
+	m->stop[0] = m->stop[1] = -1;
+
+	/* We may chdir when daemonizing, but still want to remove it later */
+	if (path[0] == '/') {
+		m->path = strdup(path);
+	} else if (getcwd(cwd, sizeof(cwd))) {
+		if ((m->path = malloc(strlen(cwd) + strlen(path) + 2)))
+			sprintf(m->path, "%s/%s", cwd, path);
+	}
+	if (!m->path || strlen(m->path) >= sizeof(addr.sun_path))
+		goto error;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, m->path);
+
+	if ((m->listen = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		goto error;
+	fcntl(m->listen, F_SETFD, FD_CLOEXEC);
+	if ((flags = fcntl(m->listen, F_GETFL)) == -1 ||
+			fcntl(m->listen, F_SETFL, flags | O_NONBLOCK) == -1)
+		goto error;
+	if (bind(m->listen, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		if (errno != EADDRINUSE || !sqfs_ll_metrics_stale(&addr) ||
+				unlink(m->path) == -1 ||
+				bind(m->listen, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+			goto error;
+	}
+	m->bound = true;
+	if (listen(m->listen, 16) == -1 || pipe(m->stop))
+		goto error;
+
+	*mp = m;
+	return SQFS_OK;
+
+error:
+	sqfs_ll_metrics_destroy(&m);
+	return SQFS_ERR;
+}
+
+void sqfs_ll_metrics_destroy(sqfs_ll_metrics *mp) {
+	sqfs_ll_metrics_internal *m;
+	if (!mp || !*mp)
+		return;
+	m = *mp;
+
+	if (m->running) {
+		char c = 0;
+		while (write(m->stop[1], &c, 1) == -1 && errno == EINTR)
+			;
+		pthread_join(m->thread, NULL);
+	}
+	if (m->stop[0] != -1) {
+		close(m->stop[0]);
+		close(m->stop[1]);
+	}
+	if (m->listen != -1)
+		close(m->listen);
+	if (m->bound)
+		unlink(m->path);
+	free(m->path);
+	free(m);
+	*mp = NULL;
+}
+
+sqfs_err sqfs_ll_metrics_start(sqfs_ll_metrics *mp) {
+	sqfs_ll_metrics_internal *m = *mp;
+	if (m->running)
+		return SQFS_OK;
+	if (pthread_create(&m->thread, NULL, sqfs_ll_metrics_worker, m))
+		return SQFS_ERR;
+	m->running = true;
+	return SQFS_OK;
+}
+
+#else /* SQFS_MULTITHREADED */
+
+sqfs_err sqfs_ll_metrics_init(sqfs_ll_metrics *m, struct sqfs_ll *ll,
+		const char *path) {
+	return SQFS_UNSUP;
+}
+
+void sqfs_ll_metrics_destroy(sqfs_ll_metrics *m) {
+}
+
+sqfs_err sqfs_ll_metrics_start(sqfs_ll_metrics *m) {
+	return SQFS_UNSUP;
+}
+
+void sqfs_ll_metrics_wrap(sqfs_ll_metrics *m, struct fuse_lowlevel_ops *ops) {
+}
+
+void sqfs_ll_metrics_read(sqfs_ll_metrics *m, size_t bytes) {
+}
+
+#endif /* SQFS_MULTITHREADED */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_LL_METRICS_H
+#define SQFS_LL_METRICS_H
+
+#include "ll.h"
+
+/* Live metrics for squashfuse_ll
+ *  - Counts and latency histograms of each FUSE operation, taken by
+ *    wrapping the operations
+ *  - Cache statistics, bytes served, bytes read from the image and
+ *    decompressed, time spent decompressing, and open files
+ *  - Served in the Prometheus text format to anything that connects to a
+ *    Unix domain socket, with an HTTP header if it sends a GET request
+ *  - Only available in multithreaded builds
+ */
+
+/* Listen on a socket at path, replacing a stale one */
+sqfs_err sqfs_ll_metrics_init(sqfs_ll_metrics *m, struct sqfs_ll *ll,
+	const char *path);
+void sqfs_ll_metrics_destroy(sqfs_ll_metrics *m);
+
+/* Start serving. Do this only once the process won't fork again. */
+sqfs_err sqfs_ll_metrics_start(sqfs_ll_metrics *m);
+
+/* Replace the operations in ops with ones that time them, and then call the
+ * originals. The FUSE userdata must be the sqfs_ll. */
+void sqfs_ll_metrics_wrap(sqfs_ll_metrics *m, struct fuse_lowlevel_ops *ops);
+
+/* Count bytes returned by a read */
+void sqfs_ll_metrics_read(sqfs_ll_metrics *m, size_t bytes);
+
+#endif
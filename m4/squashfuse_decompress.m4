@@ -66,3 +66,51 @@ AC_DEFUN([SQ_CHECK_DECOMPRESS],[
 	])
 	SQ_KEEP_FLAGS($1,[$sq_dec_ok])
 ])
+
+# SQ_CHECK_LIBDEFLATE
+#
+# Check for libdeflate, a faster decoder for zlib images. It's not a
+# compression type of its own, so it stays out of sq_decompressors.
+#
+# On success define HAVE_LIBDEFLATE and set LIBDEFLATE_CPPFLAGS and
+# LIBDEFLATE_LIBS.
+AC_DEFUN([SQ_CHECK_LIBDEFLATE],[
+	SQ_SAVE_FLAGS
+
+	sq_want=yes
+	sq_specified=no
+	AC_ARG_WITH([libdeflate],
+		AS_HELP_STRING([--with-libdeflate=DIR],[libdeflate prefix directory]),[
+		AS_IF([test "x$withval" = xno],[
+			sq_want=no
+		],[
+			sq_specified=yes
+			CPPFLAGS="$CPPFLAGS -I$withval/include"
+			LIBS="$LIBS -L$withval/lib"
+		])
+	])
+
+	sq_deflate_ok=
+	AS_IF([test "x$sq_want" = xyes],[
+		sq_lib=deflate
+		AS_IF([test "x$sq_specified" = xno],[
+			SQ_PKG([LIBDEFLATE],[libdeflate],[sq_lib=],[:])
+		])
+
+		sq_deflate_ok=yes
+		AC_SEARCH_LIBS([libdeflate_zlib_decompress],[$sq_lib],,
+			[sq_deflate_ok=])
+		AS_IF([test "x$sq_deflate_ok" = xyes],
+			[AC_CHECK_HEADER([libdeflate.h],,[sq_deflate_ok=])])
+
+		AS_IF([test "x$sq_deflate_ok" = xyes],[
+			AC_DEFINE([HAVE_LIBDEFLATE],1,
+				[Define to decode zlib images with libdeflate])
+			sq_decompressors_pkgconf="$sq_decompressors_pkgconf libdeflate"
+		],[
+			AS_IF([test "x$sq_specified" = xyes],
+				[AC_MSG_FAILURE([Asked for libdeflate, but it can't be found])])
+		])
+	])
+	SQ_KEEP_FLAGS([LIBDEFLATE],[$sq_deflate_ok])
+])
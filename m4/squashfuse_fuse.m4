@@ -305,6 +305,9 @@ AC_DEFUN([SQ_FUSE_API_VERSION],[
 
 		AC_CHECK_DECLS([fuse_cmdline_help],,,
 		        [#include <fuse_lowlevel.h>])
+
+		AC_CHECK_DECLS([fuse_reply_lseek],[sq_fuse_lseek=yes],,
+		        [#include <fuse_lowlevel.h>])
 	])
 	
 	SQ_RESTORE_FLAGS
@@ -99,6 +99,7 @@ AS_IF([test "x$sq_cv_decl_makedev_qnx" = xyes],
 # SQ_CHECK_DECL_ENOATTR([IF_NOT_FOUND]) - ENOATTR error code
 # SQ_CHECK_DECL_DAEMON		- daemon() in unistd.h
 # SQ_CHECK_DECL_SYMLINK   - symlink() in unistd.h
+# SQ_CHECK_DECL_CLOCK_GETTIME	- clock_gettime() with CLOCK_MONOTONIC
 
 AC_DEFUN([SQ_CHECK_DECL_MAKEDEV],[
 SQ_CHECK_DECL_MAKEDEV_QNX([
@@ -137,3 +138,22 @@ AC_DEFUN([SQ_CHECK_DECL_DAEMON],
 	[SQ_CHECK_NONSTD(daemon,[#include <unistd.h>],[(void)daemon;])])
 AC_DEFUN([SQ_CHECK_DECL_SYMLINK],
 	[SQ_CHECK_NONSTD(symlink,[#include <unistd.h>],[(void)symlink;])])
+AC_DEFUN([SQ_CHECK_DECL_CLOCK_GETTIME],[
+AC_SEARCH_LIBS([clock_gettime],[rt])
+SQ_CHECK_NONSTD(clock_gettime,[#include <time.h>],
+	[struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);])
+])
+
+# SQ_CHECK_SDT
+#
+# Check for USDT probes in the style of SystemTap's sys/sdt.h, which cost a
+# single nop each until something like bpftrace or perf attaches.
+AC_DEFUN([SQ_CHECK_SDT],[
+AC_CACHE_CHECK([for USDT probes in sys/sdt.h],[sq_cv_sdt],[
+	AC_COMPILE_IFELSE([AC_LANG_PROGRAM([#include <sys/sdt.h>],
+		[int x = 0; STAP_PROBE1(squashfuse, test, x);])],
+		[sq_cv_sdt=yes],[sq_cv_sdt=no])
+])
+AS_IF([test "x$sq_cv_sdt" = xyes],
+	[AC_DEFINE([HAVE_SDT_PROBES],[1],[Define to add USDT probes])])
+])
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "mempressure.h"
+
+#include "fs.h"
+
+#include <stdlib.h>
+
+#if defined(SQFS_MULTITHREADED) && defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Notify when tasks stall on memory for 150ms in any 2s window. Windows
+ * that are multiples of 2s are allowed without privileges. */
+#define SQFS_MEMPRESSURE_TRIGGER "some 150000 2000000"
+/* How often to read memory.events, when there's no PSI */
+#define SQFS_MEMPRESSURE_POLL_MS 1000
+/* How long without pressure before growing the caches one step */
+#define SQFS_MEMPRESSURE_QUIET_MS (30 * 1000)
+/* Shrink to no less than 1/2^this */
+#define SQFS_MEMPRESSURE_MAX_SHIFT 4
+
+typedef struct sqfs_mempressure_internal {
+	sqfs *fs;
+	int psi;		/* PSI trigger, or -1 */
+	int events;		/* cgroup memory.events, or -1 */
+	uint64_t last_events;
+	int stop[2];	/* pipe, written to stop the worker */
+	pthread_t thread;
+	bool running;
+} sqfs_mempressure_internal;
+
+/* The cgroup v2 directory this process is in, or NULL */
+static char *sqfs_mempressure_cgroup(void) {
+	char line[4096], *dir = NULL;
+	FILE *f = fopen("/proc/self/cgroup", "r");
+	if (!f)
+		return NULL;
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			if ((dir = malloc(strlen(line) + sizeof("/sys/fs/cgroup"))))
+				sprintf(dir, "/sys/fs/cgroup%s", line + 3);
+			break;
+		}
+	}
+	fclose(f);
+	return dir;
+}
+
+static int sqfs_mempressure_psi_open(const char *path) {
+	int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (write(fd, SQFS_MEMPRESSURE_TRIGGER,
+			sizeof(SQFS_MEMPRESSURE_TRIGGER)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Count of times the cgroup hit memory.high or memory.max */
+static bool sqfs_mempressure_events_read(int fd, uint64_t *count) {
+	char buf[1024], *line;
+	ssize_t got = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (got <= 0)
+		return false;
+	buf[got] = '\0';
+
+	*count = 0;
+	for (line = buf; line && *line; line = strchr(line, '\n')) {
+		unsigned long long n;
+		if (*line == '\n')
+			++line;
+		if (sscanf(line, "high %llu", &n) == 1 ||
+				sscanf(line, "max %llu", &n) == 1)
+			*count += n;
+	}
+	return true;
+}
+
+sqfs_err sqfs_mempressure_init(sqfs_mempressure *mp, sqfs *fs) {
+	sqfs_mempressure_internal *m;
+	char *cgroup, path[4096];
+
+	if (!(m = calloc(1, sizeof(*m))))
+		return SQFS_ERR;
+	m->fs = fs;
+	m->psi = m->events = -1;
+	m->stop[0] = m->stop[1] = -1;
+
+	if ((cgroup = sqfs_mempressure_cgroup())) {
+		snprintf(path, sizeof(path), "%s/memory.pressure", cgroup);
+		m->psi = sqfs_mempressure_psi_open(path);
+		if (m->psi == -1) {
+			snprintf(path, sizeof(path), "%s/memory.events", cgroup);
+			m->events = open(path, O_RDONLY | O_CLOEXEC);
+		}
+		free(cgroup);
+	}
+	if (m->psi == -1 && m->events == -1)
+		m->psi = sqfs_mempressure_psi_open("/proc/pressure/memory");
+	if (m->events != -1 &&
+			!sqfs_mempressure_events_read(m->events, &m->last_events)) {
+		close(m->events);
+		m->events = -1;
+	}
+	if (m->psi == -1 && m->events == -1) {
+		free(m);
+		return SQFS_UNSUP;
+	}
+
+	if (pipe(m->stop)) {
+		sqfs_mempressure_destroy(&m);
+		return SQFS_ERR;
+	}
+	*mp = m;
+	return SQFS_OK;
+}
+
+void sqfs_mempressure_destroy(sqfs_mempressure *mp) {
+	sqfs_mempressure_internal *m;
+	if (!mp || !*mp)
+		return;
+	m = *mp;
+
+	if (m->running) {
+		char c = 0;
+		while (write(m->stop[1], &c, 1) == -1 && errno == EINTR)
+			;
+		pthread_join(m->thread, NULL);
+	}
+	if (m->stop[0] != -1) {
+		close(m->stop[0]);
+		close(m->stop[1]);
+	}
+	if (m->psi != -1)
+		close(m->psi);
+	if (m->events != -1)
+		close(m->events);
+	free(m);
+	*mp = NULL;
+}
+
+static uint64_t sqfs_mempressure_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *sqfs_mempressure_worker(void *arg) {
+	sqfs_mempressure_internal *m = arg;
+	unsigned shift = 0;
+	uint64_t calm_since = sqfs_mempressure_now_ms();
+
+	while (true) {
+		struct pollfd fds[2];
+		nfds_t n = 1;
+		bool pressure = false;
+		int timeout = -1;
+		uint64_t now;
+
+		fds[0].fd = m->stop[0];
+		fds[0].events = POLLIN;
+		if (m->psi != -1) {
+			fds[n].fd = m->psi;
+			fds[n++].events = POLLPRI;
+		}
+		/* Wake when the quiet period ends, to grow the caches back */
+		if (shift) {
+			uint64_t calm = sqfs_mempressure_now_ms() - calm_since;
+			timeout = calm < SQFS_MEMPRESSURE_QUIET_MS ?
+				(int)(SQFS_MEMPRESSURE_QUIET_MS - calm) : 0;
+		}
+		if (m->psi == -1 && (timeout == -1 ||
+				timeout > SQFS_MEMPRESSURE_POLL_MS))
+			timeout = SQFS_MEMPRESSURE_POLL_MS;
+		if (poll(fds, n, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[0].revents)
+			break;
+
+		if (m->psi != -1) {
+			if (fds[1].revents & (POLLERR | POLLNVAL))
+				break; /* the trigger is gone */
+			pressure = fds[1].revents & POLLPRI;
+		} else {
+			uint64_t count;
+			if (sqfs_mempressure_events_read(m->events, &count)) {
+				pressure = count != m->last_events;
+				m->last_events = count;
+			}
+		}
+
+		now = sqfs_mempressure_now_ms();
+		if (pressure) {
+			calm_since = now;
+			if (shift < SQFS_MEMPRESSURE_MAX_SHIFT)
+				sqfs_cache_shrink(m->fs, ++shift);
+		} else if (shift && now - calm_since >= SQFS_MEMPRESSURE_QUIET_MS) {
+			calm_since = now;
+			sqfs_cache_shrink(m->fs, --shift);
+		}
+	}
+	return NULL;
+}
+
+sqfs_err sqfs_mempressure_start(sqfs_mempressure *mp) {
+	sqfs_mempressure_internal *m = *mp;
+	if (m->running)
+		return SQFS_OK;
+	if (pthread_create(&m->thread, NULL, sqfs_mempressure_worker, m))
+		return SQFS_ERR;
+	m->running = true;
+	return SQFS_OK;
+}
+
+#else /* SQFS_MULTITHREADED && __linux__ */
+
+sqfs_err sqfs_mempressure_init(sqfs_mempressure *mp, sqfs *fs) {
+	return SQFS_UNSUP;
+}
+
+void sqfs_mempressure_destroy(sqfs_mempressure *mp) {
+}
+
+sqfs_err sqfs_mempressure_start(sqfs_mempressure *mp) {
+	return SQFS_UNSUP;
+}
+
+#endif /* SQFS_MULTITHREADED && __linux__ */
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_MEMPRESSURE_H
+#define SQFS_MEMPRESSURE_H
+
+#include "common.h"
+
+/* Elastic cache sizes under memory pressure
+ *  - Watches the process's cgroup, or the whole system, with a PSI trigger
+ *    where the kernel has them, or by polling the cgroup's memory.events
+ *  - Each sign of pressure halves the data, fragment and compressed caches,
+ *    down to a sixteenth, and drops idle direct I/O buffers
+ *  - After a quiet period they double again, back to their full size
+ *  - Only available on Linux, in multithreaded builds
+ */
+
+/* Find something to watch. Returns SQFS_UNSUP if there's nothing. */
+sqfs_err sqfs_mempressure_init(sqfs_mempressure *mp, sqfs *fs);
+void sqfs_mempressure_destroy(sqfs_mempressure *mp);
+
+/* Start watching. Do this only once the process won't fork again. */
+sqfs_err sqfs_mempressure_start(sqfs_mempressure *mp);
+
+#endif
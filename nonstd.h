@@ -37,4 +37,7 @@ int sqfs_enoattr();
 
 int sqfs_symlink(const char *target, const char *linkpath);
 
+/* Monotonic time in nanoseconds, for measuring intervals */
+uint64_t sqfs_clock_ns(void);
+
 #endif
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "prefetch.h"
+
+#include "dir.h"
+#include "file.h"
+#include "fs.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#ifdef SQFS_MULTITHREADED
+
+#include <pthread.h>
+
+#define SQFS_PREFETCH_QUEUE 64
+
+/* Atomic, since sqfs_prefetch_run() checks it without the lock */
+#define SQFS_PREFETCH_STOPPED(p) __atomic_load_n(&(p)->stop, __ATOMIC_RELAXED)
+#define SQFS_PREFETCH_SET_STOPPED(p) \
+	__atomic_store_n(&(p)->stop, true, __ATOMIC_RELAXED)
+
+typedef struct {
+	sqfs_inode_id dir;
+	sqfs_off_t offset;
+} sqfs_prefetch_job;
+
+typedef struct sqfs_prefetch_internal {
+	sqfs *fs;
+	size_t siblings;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running, stop;
+
+	sqfs_prefetch_job queue[SQFS_PREFETCH_QUEUE];
+	size_t head, count;
+
+	/* The range of the most recent directory already covered, so lookups
+	 * of files we just prefetched don't ask for more of the same */
+	sqfs_inode_id last_dir;
+	sqfs_off_t last_from, last_to;
+} sqfs_prefetch_internal;
+
+sqfs_err sqfs_prefetch_init(sqfs_prefetch *pf, sqfs *fs, size_t siblings) {
+	sqfs_prefetch_internal *p;
+
+	if (!siblings)
+		return SQFS_ERR;
+	if (!(p = calloc(1, sizeof(*p))))
+		return SQFS_ERR;
+	if (pthread_mutex_init(&p->lock, NULL)) {
+		free(p);
+		return SQFS_ERR;
+	}
+	if (pthread_cond_init(&p->cond, NULL)) {
+		pthread_mutex_destroy(&p->lock);
+		free(p);
+		return SQFS_ERR;
+	}
+	p->fs = fs;
+	p->siblings = siblings;
+	*pf = p;
+	return SQFS_OK;
+}
+
+void sqfs_prefetch_destroy(sqfs_prefetch *pf) {
+	sqfs_prefetch_internal *p;
+	if (!pf || !*pf)
+		return;
+	p = *pf;
+
+	if (p->running) {
+		pthread_mutex_lock(&p->lock);
+		SQFS_PREFETCH_SET_STOPPED(p);
+		pthread_cond_signal(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+		pthread_join(p->thread, NULL);
+	}
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+	*pf = NULL;
+}
+
+/* Fetch the blocks that reading the start of a file would need */
+static void sqfs_prefetch_file(sqfs *fs, sqfs_inode *inode) {
+	sqfs_block *block;
+
+	if (inode->xtra.reg.frag_idx != SQUASHFS_INVALID_FRAG) {
+		size_t offset, size;
+		if (sqfs_frag_block(fs, inode, &offset, &size, &block) == SQFS_OK)
+			sqfs_block_dispose(block);
+	}
+
+	if (sqfs_blocklist_count(fs, inode)) {
+		sqfs_blocklist bl;
+		sqfs_blocklist_init(fs, inode, &bl);
+		if (sqfs_blocklist_next(&bl) == SQFS_OK && bl.input_size != 0 &&
+				sqfs_data_cache(fs, &fs->data_cache, bl.block, bl.header,
+					&block) == SQFS_OK)
+			sqfs_block_dispose(block);
+	}
+}
+
+/* Returns the offset just past the last entry looked at */
+static sqfs_off_t sqfs_prefetch_run(sqfs_prefetch_internal *p,
+		const sqfs_prefetch_job *job) {
+	sqfs *fs = p->fs;
+	sqfs_inode inode;
+	sqfs_dir dir;
+	sqfs_dir_entry entry;
+	sqfs_off_t end = job->offset;
+	sqfs_err err;
+	size_t n;
+
+	if (sqfs_inode_get(fs, &inode, job->dir) || !S_ISDIR(inode.base.mode))
+		return end;
+	if (sqfs_dir_open(fs, &inode, &dir, job->offset))
+		return end;
+
+	sqfs_dentry_init(&entry, NULL);
+	for (n = 0; n < p->siblings && !SQFS_PREFETCH_STOPPED(p) &&
+			sqfs_dir_next(fs, &dir, &entry, &err); ++n) {
+		end = sqfs_dentry_next_offset(&entry);
+		if (!S_ISREG(sqfs_dentry_mode(&entry)))
+			continue;
+		if (sqfs_inode_get(fs, &inode, sqfs_dentry_inode(&entry)))
+			continue;
+		sqfs_prefetch_file(fs, &inode);
+	}
+	return end;
+}
+
+static void *sqfs_prefetch_worker(void *arg) {
+	sqfs_prefetch_internal *p = arg;
+
+	pthread_mutex_lock(&p->lock);
+	while (!p->stop) {
+		sqfs_prefetch_job job;
+		sqfs_off_t end;
+
+		if (!p->count) {
+			pthread_cond_wait(&p->cond, &p->lock);
+			continue;
+		}
+		job = p->queue[p->head];
+		p->head = (p->head + 1) % SQFS_PREFETCH_QUEUE;
+		--p->count;
+		pthread_mutex_unlock(&p->lock);
+
+		end = sqfs_prefetch_run(p, &job);
+
+		pthread_mutex_lock(&p->lock);
+		if (p->last_dir == job.dir && p->last_from == job.offset)
+			p->last_to = end;
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+sqfs_err sqfs_prefetch_start(sqfs_prefetch *pf) {
+	sqfs_prefetch_internal *p = *pf;
+	if (p->running)
+		return SQFS_OK;
+	if (pthread_create(&p->thread, NULL, sqfs_prefetch_worker, p))
+		return SQFS_ERR;
+	p->running = true;
+	return SQFS_OK;
+}
+
+void sqfs_prefetch_siblings(sqfs_prefetch *pf, sqfs_inode_id dir,
+		sqfs_off_t offset) {
+	sqfs_prefetch_internal *p = *pf;
+
+	pthread_mutex_lock(&p->lock);
+	if (p->running && !(p->last_dir == dir && offset >= p->last_from &&
+			offset < p->last_to) && p->count < SQFS_PREFETCH_QUEUE) {
+		size_t tail = (p->head + p->count) % SQFS_PREFETCH_QUEUE;
+		p->queue[tail].dir = dir;
+		p->queue[tail].offset = offset;
+		++p->count;
+
+		/* Assume it covers the rest of the directory until we know more */
+		p->last_dir = dir;
+		p->last_from = offset;
+		p->last_to = INT64_MAX;
+		pthread_cond_signal(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+#else /* SQFS_MULTITHREADED */
+
+sqfs_err sqfs_prefetch_init(sqfs_prefetch *pf, sqfs *fs, size_t siblings) {
+	return SQFS_UNSUP;
+}
+
+void sqfs_prefetch_destroy(sqfs_prefetch *pf) {
+}
+
+sqfs_err sqfs_prefetch_start(sqfs_prefetch *pf) {
+	return SQFS_UNSUP;
+}
+
+void sqfs_prefetch_siblings(sqfs_prefetch *pf, sqfs_inode_id dir,
+		sqfs_off_t offset) {
+}
+
+#endif /* SQFS_MULTITHREADED */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_PREFETCH_H
+#define SQFS_PREFETCH_H
+
+#include "common.h"
+
+/* Background prefetching of files near the ones being used
+ *  - Files that follow a looked-up file in its directory are probably
+ *    stored right after it, and likely to be wanted soon
+ *  - Their fragment blocks and first data blocks are fetched into the
+ *    usual caches, by a worker thread
+ *  - Requests are dropped rather than queued without bound
+ *  - Only available in multithreaded builds
+ */
+
+/* Prefetch for up to 'siblings' files following each requested entry */
+sqfs_err sqfs_prefetch_init(sqfs_prefetch *pf, sqfs *fs, size_t siblings);
+void sqfs_prefetch_destroy(sqfs_prefetch *pf);
+
+/* Start the worker. Do this only once the process won't fork again. */
+sqfs_err sqfs_prefetch_start(sqfs_prefetch *pf);
+
+/* Prefetch the files after directory offset 'offset' in directory 'dir',
+ * typically the next_offset of an entry just looked up */
+void sqfs_prefetch_siblings(sqfs_prefetch *pf, sqfs_inode_id dir,
+	sqfs_off_t offset);
+
+#endif
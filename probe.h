@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_PROBE_H
+#define SQFS_PROBE_H
+
+#include "common.h"
+
+/* USDT probes, in the "squashfuse" provider, for tracing with bpftrace,
+ * perf or SystemTap. Each is a nop until something attaches. Probes named
+ * *__start and *__done bracket a stage of a read, so the time between them
+ * can be attributed to it. Image positions and sizes come first, and the
+ * *__done probes end with the sqfs_err result where there is one:
+ *
+ *   op__start(name, ino), op__done(name)	each squashfuse_ll operation
+ *   read__reply__start(size), read__reply__done(size)
+ *   data__cache__start(pos, want), data__cache__miss(pos),
+ *     data__cache__done(pos, err)
+ *   md__cache__start(pos), md__cache__miss(pos), md__cache__done(pos, err)
+ *   block__read__start(pos, size, compressed), block__read__done(pos, err)
+ *   io__start(pos, size), io__done(pos, got)	reading the image
+ *   decompress__start(size), decompress__done(outsize, err)
+ *   cache__lock__start(cache, key), cache__lock__done(cache, key)
+ *     waiting for an entry
+ *
+ * Arguments aren't evaluated in builds without probes, so they must not
+ * have side effects. */
+#ifdef HAVE_SDT_PROBES
+# include <sys/sdt.h>
+# define SQFS_PROBE1(name, a) STAP_PROBE1(squashfuse, name, a)
+# define SQFS_PROBE2(name, a, b) STAP_PROBE2(squashfuse, name, a, b)
+# define SQFS_PROBE3(name, a, b, c) STAP_PROBE3(squashfuse, name, a, b, c)
+#else
+# define SQFS_PROBE1(name, a) ((void)0)
+# define SQFS_PROBE2(name, a, b) ((void)0)
+# define SQFS_PROBE3(name, a, b, c) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "profile.h"
+
+#include "file.h"
+#include "fs.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SQFS_PROFILE_VERSION 3
+
+#ifdef SQFS_MULTITHREADED
+#include <pthread.h>
+# define SQFS_PROFILE_LOCK(p) pthread_mutex_lock(&(p)->lock)
+# define SQFS_PROFILE_UNLOCK(p) pthread_mutex_unlock(&(p)->lock)
+#else
+# define SQFS_PROFILE_LOCK(p)
+# define SQFS_PROFILE_UNLOCK(p)
+#endif
+
+/* Open-addressed map from block key to profile position */
+typedef struct {
+	uint64_t *keys;	/* zero is empty */
+	size_t *vals;
+	size_t capacity, size;
+} sqfs_profile_map;
+
+typedef struct sqfs_profile_internal {
+	FILE *out;					/* when recording */
+	bool all;					/* recording repeat accesses too */
+	sqfs_profile_entry *entries;	/* when replaying */
+	size_t count;
+	sqfs_profile_map map;		/* blocks seen, or where they're replayed */
+#ifdef SQFS_MULTITHREADED
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running, stop;
+	bool done;			/* replay finished, set atomically */
+	size_t demand;		/* furthest entry readers have reached */
+	size_t ahead;
+	sqfs *fs;
+#endif
+} sqfs_profile_internal;
+
+static uint64_t sqfs_profile_key(const sqfs_profile_entry *e) {
+	return ((uint64_t)e->pos << 2 | e->kind) + 1;
+}
+
+static size_t sqfs_profile_slot(const sqfs_profile_map *m, uint64_t key) {
+	uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+	size_t i = (size_t)(h >> 17) & (m->capacity - 1);
+	while (m->keys[i] && m->keys[i] != key)
+		i = (i + 1) & (m->capacity - 1);
+	return i;
+}
+
+static sqfs_err sqfs_profile_map_grow(sqfs_profile_map *m) {
+	sqfs_profile_map n;
+	size_t i;
+
+	n.capacity = m->capacity ? m->capacity * 2 : 1024;
+	n.size = m->size;
+	n.keys = calloc(n.capacity, sizeof(*n.keys));
+	n.vals = calloc(n.capacity, sizeof(*n.vals));
+	if (!n.keys || !n.vals) {
+		free(n.keys);
+		free(n.vals);
+		return SQFS_ERR;
+	}
+	for (i = 0; i < m->capacity; ++i) {
+		if (m->keys[i]) {
+			size_t j = sqfs_profile_slot(&n, m->keys[i]);
+			n.keys[j] = m->keys[i];
+			n.vals[j] = m->vals[i];
+		}
+	}
+	free(m->keys);
+	free(m->vals);
+	*m = n;
+	return SQFS_OK;
+}
+
+/* Add a key if it's not there. Returns true if it was added. */
+static bool sqfs_profile_map_add(sqfs_profile_map *m, uint64_t key,
+		size_t val) {
+	size_t i;
+	if (m->size * 2 >= m->capacity && sqfs_profile_map_grow(m))
+		return false;
+	i = sqfs_profile_slot(m, key);
+	if (m->keys[i])
+		return false;
+	m->keys[i] = key;
+	m->vals[i] = val;
+	++m->size;
+	return true;
+}
+
+#ifdef SQFS_MULTITHREADED
+static bool sqfs_profile_map_get(const sqfs_profile_map *m, uint64_t key,
+		size_t *val) {
+	size_t i;
+	if (!m->capacity)
+		return false;
+	i = sqfs_profile_slot(m, key);
+	if (!m->keys[i])
+		return false;
+	*val = m->vals[i];
+	return true;
+}
+#endif
+
+static sqfs_err sqfs_profile_new(sqfs_profile *prof) {
+	sqfs_profile_internal *p = calloc(1, sizeof(*p));
+	if (!p)
+		return SQFS_ERR;
+#ifdef SQFS_MULTITHREADED
+	if (pthread_mutex_init(&p->lock, NULL)) {
+		free(p);
+		return SQFS_ERR;
+	}
+	if (pthread_cond_init(&p->cond, NULL)) {
+		pthread_mutex_destroy(&p->lock);
+		free(p);
+		return SQFS_ERR;
+	}
+#endif
+	*prof = p;
+	return SQFS_OK;
+}
+
+sqfs_err sqfs_profile_record_open(sqfs_profile *prof, const char *path,
+		uint64_t id, bool all) {
+	sqfs_err err;
+	if ((err = sqfs_profile_new(prof)))
+		return err;
+	if (!((*prof)->out = fopen(path, "w"))) {
+		sqfs_profile_destroy(prof);
+		return SQFS_ERR;
+	}
+	(*prof)->all = all;
+	fprintf((*prof)->out, "# squashfuse %s %d %016llx\n",
+		all ? "trace" : "profile", SQFS_PROFILE_VERSION, (unsigned long long)id);
+	return SQFS_OK;
+}
+
+bool sqfs_profile_parse(const char *line, sqfs_profile_entry *e) {
+	unsigned long long pos, index, inode;
+	unsigned long hdr;
+
+	memset(e, 0, sizeof(*e));
+	switch (line[0]) {
+		case 'M':
+			if (sscanf(line + 1, "%llu", &pos) != 1)
+				return false;
+			e->kind = SQFS_PROFILE_MD;
+			break;
+		case 'D':
+			if (sscanf(line + 1, "%llu %llu %llu %lu", &inode, &index, &pos,
+					&hdr) != 4)
+				return false;
+			e->kind = SQFS_PROFILE_DATA;
+			e->inode = inode;
+			e->index = index;
+			e->hdr = hdr;
+			break;
+		case 'F':
+			if (sscanf(line + 1, "%llu %llu %lu", &inode, &pos, &hdr) != 3)
+				return false;
+			e->kind = SQFS_PROFILE_FRAG;
+			e->inode = inode;
+			e->hdr = hdr;
+			break;
+		default:
+			return false;
+	}
+	e->pos = pos;
+	return true;
+}
+
+/* Check that a header line is for the image with identifier 'id' */
+static bool sqfs_profile_header_ok(const char *line, uint64_t id) {
+	char kind[16];
+	unsigned long long found;
+	int version;
+
+	if (sscanf(line, "# squashfuse %15s %d %llx", kind, &version,
+			&found) != 3)
+		return false;
+	return (!strcmp(kind, "profile") || !strcmp(kind, "trace")) &&
+		version == SQFS_PROFILE_VERSION && found == id;
+}
+
+sqfs_err sqfs_profile_load(sqfs_profile *prof, const char *path,
+		uint64_t id) {
+	sqfs_profile_internal *p;
+	sqfs_err err = SQFS_OK;
+	size_t cap = 0;
+	char line[256];
+	FILE *f;
+
+	if (!(f = fopen(path, "r")))
+		return SQFS_ERR;
+	/* Positions in a profile of another image would fetch the wrong things */
+	if (!fgets(line, sizeof(line), f) || !sqfs_profile_header_ok(line, id)) {
+		err = ferror(f) ? SQFS_ERR : SQFS_BADFORMAT;
+		fclose(f);
+		return err;
+	}
+	if ((err = sqfs_profile_new(prof))) {
+		fclose(f);
+		return err;
+	}
+	p = *prof;
+
+	while (!err && fgets(line, sizeof(line), f)) {
+		sqfs_profile_entry e;
+		if (!sqfs_profile_parse(line, &e))
+			continue;
+		if (p->count == cap) {
+			size_t ncap = cap ? cap * 2 : 1024;
+			sqfs_profile_entry *grown = realloc(p->entries,
+				ncap * sizeof(*grown));
+			if (!grown) {
+				err = SQFS_ERR;
+				break;
+			}
+			p->entries = grown;
+			cap = ncap;
+		}
+		/* Readers report progress by key, so remember where each is */
+		if (sqfs_profile_map_add(&p->map, sqfs_profile_key(&e), p->count))
+			p->entries[p->count++] = e;
+	}
+	if (ferror(f))
+		err = SQFS_ERR;
+	fclose(f);
+
+	if (err)
+		sqfs_profile_destroy(prof);
+	return err;
+}
+
+void sqfs_profile_access(sqfs_profile *prof, const sqfs_profile_entry *e) {
+	sqfs_profile_internal *p = *prof;
+	uint64_t key = sqfs_profile_key(e);
+
+#ifdef SQFS_MULTITHREADED
+	/* Once the replay is over, readers have nothing to report */
+	if (!p->out && __atomic_load_n(&p->done, __ATOMIC_RELAXED))
+		return;
+#endif
+	SQFS_PROFILE_LOCK(p);
+	if (p->out) {
+		if (p->all || sqfs_profile_map_add(&p->map, key, 0)) {
+			switch (e->kind) {
+				case SQFS_PROFILE_MD:
+					fprintf(p->out, "M %" PRIu64 "\n", (uint64_t)e->pos);
+					break;
+				case SQFS_PROFILE_DATA:
+					fprintf(p->out, "D %" PRIu64 " %" PRIu64 " %" PRIu64 " %lu\n",
+						(uint64_t)e->inode, e->index, (uint64_t)e->pos,
+						(unsigned long)e->hdr);
+					break;
+				case SQFS_PROFILE_FRAG:
+					fprintf(p->out, "F %" PRIu64 " %" PRIu64 " %lu\n",
+						(uint64_t)e->inode, (uint64_t)e->pos,
+						(unsigned long)e->hdr);
+					break;
+			}
+		}
+	}
+#ifdef SQFS_MULTITHREADED
+	/* The replay's own accesses don't count */
+	else if (p->running && !pthread_equal(pthread_self(), p->thread)) {
+		size_t idx;
+		if (sqfs_profile_map_get(&p->map, key, &idx) && idx >= p->demand) {
+			p->demand = idx + 1;
+			pthread_cond_signal(&p->cond);
+		}
+	}
+#endif
+	SQFS_PROFILE_UNLOCK(p);
+}
+
+#ifdef SQFS_MULTITHREADED
+
+/* Check an entry against the image, so a damaged or edited profile can't
+ * fill the caches from the wrong ranges */
+static bool sqfs_profile_valid(sqfs *fs, const sqfs_profile_entry *e) {
+	struct squashfs_fragment_entry frag;
+	sqfs_blocklist bl;
+	sqfs_inode inode;
+	sqfs_off_t start;
+
+	if (e->kind == SQFS_PROFILE_MD)
+		return e->pos >= (sqfs_off_t)fs->sb.inode_table_start &&
+			e->pos < (sqfs_off_t)fs->sb.bytes_used;
+
+	if (sqfs_inode_get(fs, &inode, e->inode) || !S_ISREG(inode.base.mode))
+		return false;
+	if (e->kind == SQFS_PROFILE_FRAG)
+		return !sqfs_frag_entry(fs, &frag, inode.xtra.reg.frag_idx) &&
+			frag.start_block == (uint64_t)e->pos && frag.size == e->hdr;
+
+	if (e->index >= sqfs_blocklist_count(fs, &inode))
+		return false;
+	start = (sqfs_off_t)e->index * fs->sb.block_size;
+	if (sqfs_blockidx_blocklist(fs, &inode, &bl, start))
+		return false;
+	do {
+		if (sqfs_blocklist_next(&bl))
+			return false;
+	} while (bl.pos < (uint64_t)start);
+	return bl.input_size && bl.block == (uint64_t)e->pos &&
+		bl.header == e->hdr;
+}
+
+static void sqfs_profile_fetch(sqfs *fs, const sqfs_profile_entry *e) {
+	sqfs_block *block = NULL;
+	sqfs_off_t pos = e->pos;
+
+	if (!sqfs_profile_valid(fs, e))
+		return;
+	switch (e->kind) {
+		case SQFS_PROFILE_MD:
+			sqfs_md_cache(fs, &pos, &block);
+			break;
+		case SQFS_PROFILE_DATA:
+			sqfs_data_cache(fs, &fs->data_cache, pos, e->hdr, &block);
+			break;
+		case SQFS_PROFILE_FRAG:
+			sqfs_data_cache(fs, &fs->frag_cache, pos, e->hdr, &block);
+			break;
+	}
+	/* Errors don't matter, the reader will find them if they're real */
+	if (block)
+		sqfs_block_dispose(block);
+}
+
+static void *sqfs_profile_replay(void *arg) {
+	sqfs_profile_internal *p = arg;
+	size_t i;
+
+	for (i = 0; i < p->count; ++i) {
+		bool stop;
+		pthread_mutex_lock(&p->lock);
+		while (!p->stop && i >= p->demand + p->ahead)
+			pthread_cond_wait(&p->cond, &p->lock);
+		/* Skip what readers already fetched for themselves */
+		if (i < p->demand)
+			i = p->demand;
+		stop = p->stop;
+		pthread_mutex_unlock(&p->lock);
+
+		if (stop || i >= p->count)
+			break;
+		sqfs_profile_fetch(p->fs, &p->entries[i]);
+	}
+	__atomic_store_n(&p->done, true, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+sqfs_err sqfs_profile_replay_start(sqfs_profile *prof, sqfs *fs,
+		size_t ahead) {
+	sqfs_profile_internal *p = *prof;
+	if (p->out || p->running || !ahead)
+		return SQFS_ERR;
+
+	p->fs = fs;
+	p->ahead = ahead;
+	p->demand = 0;
+	p->stop = false;
+	p->done = false;
+	/* Set before the thread runs, so it can recognize itself */
+	pthread_mutex_lock(&p->lock);
+	p->running = true;
+	if (pthread_create(&p->thread, NULL, sqfs_profile_replay, p)) {
+		p->running = false;
+		pthread_mutex_unlock(&p->lock);
+		return SQFS_ERR;
+	}
+	pthread_mutex_unlock(&p->lock);
+	return SQFS_OK;
+}
+
+#else
+
+sqfs_err sqfs_profile_replay_start(sqfs_profile *prof, sqfs *fs,
+		size_t ahead) {
+	return SQFS_UNSUP;
+}
+
+#endif /* SQFS_MULTITHREADED */
+
+void sqfs_profile_destroy(sqfs_profile *prof) {
+	sqfs_profile_internal *p;
+	if (!prof || !*prof)
+		return;
+	p = *prof;
+
+#ifdef SQFS_MULTITHREADED
+	if (p->running) {
+		pthread_mutex_lock(&p->lock);
+		p->stop = true;
+		pthread_cond_signal(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+		pthread_join(p->thread, NULL);
+		p->running = false;
+	}
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+#endif
+	if (p->out)
+		fclose(p->out);
+	free(p->entries);
+	free(p->map.keys);
+	free(p->map.vals);
+	free(p);
+	*prof = NULL;
+}
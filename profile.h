@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_PROFILE_H
+#define SQFS_PROFILE_H
+
+#include "common.h"
+
+/* Block access profiles
+ *  - Recording notes the first access to each block, in order, or else
+ *    every access, as a trace for squashfuse_cachesim
+ *  - Replaying prefetches the recorded blocks on a background thread,
+ *    staying a bounded distance ahead of the accesses actually made
+ *  - Replay is only available in multithreaded builds
+ *
+ * The file format is text. It starts with a header naming the image:
+ *   # squashfuse profile 3 <id>      or 'trace', <id> from sqfs_image_id()
+ * and continues with one access per line:
+ *   M <pos>                          metadata block
+ *   D <inode> <index> <pos> <hdr>    data block 'index' of a file
+ *   F <inode> <pos> <hdr>            fragment block
+ * where <inode> is an inode id. Other lines starting with '#' are comments.
+ * Replay checks each entry against the image before fetching it.
+ */
+
+typedef enum {
+	SQFS_PROFILE_MD,
+	SQFS_PROFILE_DATA,
+	SQFS_PROFILE_FRAG
+} sqfs_profile_kind;
+
+typedef struct {
+	sqfs_profile_kind kind;
+	sqfs_inode_id inode;
+	uint64_t index;
+	sqfs_off_t pos;
+	uint32_t hdr;
+} sqfs_profile_entry;
+
+/* Start recording to a new file at 'path', for the image with identifier
+ * 'id', every access if 'all' */
+sqfs_err sqfs_profile_record_open(sqfs_profile *prof, const char *path,
+	uint64_t id, bool all);
+/* Load a recorded profile, to replay it on the image with identifier 'id'.
+ * Returns SQFS_BADFORMAT if it was recorded from another image. */
+sqfs_err sqfs_profile_load(sqfs_profile *prof, const char *path,
+	uint64_t id);
+/* Stops any replay, and finishes writing any recording */
+void sqfs_profile_destroy(sqfs_profile *prof);
+
+/* Note an access made by a reader */
+void sqfs_profile_access(sqfs_profile *prof, const sqfs_profile_entry *e);
+
+/* Parse one line of a profile. Returns false for comments and junk. */
+bool sqfs_profile_parse(const char *line, sqfs_profile_entry *e);
+
+/* Prefetch the loaded profile into fs's caches on a background thread,
+ * at most 'ahead' accesses in front of the readers. Start this only once
+ * the process won't fork again. */
+sqfs_err sqfs_profile_replay_start(sqfs_profile *prof, sqfs *fs, size_t ahead);
+
+#endif
@@ -11,6 +11,7 @@ pkgs.mkShell {
     lzo
     lz4
     xz
+    libdeflate
   ];
 
   nativeBuildInputs = with pkgs; [
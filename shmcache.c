@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "shmcache.h"
+
+#include "hash.h"
+
+#include <stdlib.h>
+
+#if defined(SQFS_MULTITHREADED) && !defined(_WIN32) && \
+		HAVE_DECL_PTHREAD_MUTEXATTR_SETROBUST
+# define SQFS_SHMCACHE_ENABLED 1
+#endif
+
+#ifdef SQFS_SHMCACHE_ENABLED
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SQFS_SHMCACHE_MAGIC 0x43485153 /* "SQHC" */
+#define SQFS_SHMCACHE_VERSION 2
+#define SQFS_SHMCACHE_ALIGN 64
+/* How often to start over, if the segment is removed while we open it */
+#define SQFS_SHMCACHE_TRIES 16
+
+typedef struct {
+	uint32_t magic; /* written last, once the segment is ready */
+	uint32_t version;
+	uint64_t id;
+	uint64_t count;
+	uint64_t slot_size;
+} sqfs_shmcache_hdr;
+
+typedef struct {
+	pthread_mutex_t lock;
+	enum { EMPTY, FULL } state;
+	uint64_t pos;
+	uint64_t size;
+	sqfs_digest digest; /* zero if stored without one */
+	/* followed by slot_size bytes of data */
+} sqfs_shmcache_slot;
+
+typedef struct sqfs_shmcache_internal {
+	char name[64];
+	int fd;		/* holds a shared lock while attached */
+	char *base;
+	size_t len;
+	size_t count, slot_size, stride;
+} sqfs_shmcache_internal;
+
+/* What a segment holds */
+typedef enum {
+	SQFS_SHMCACHE_READY,
+	SQFS_SHMCACHE_UNSET,	/* nothing, or what a dead creator left */
+	SQFS_SHMCACHE_OTHER		/* a layout we can't use */
+} sqfs_shmcache_state;
+
+static size_t sqfs_shmcache_round(size_t n) {
+	return (n + SQFS_SHMCACHE_ALIGN - 1) & ~(size_t)(SQFS_SHMCACHE_ALIGN - 1);
+}
+
+static void sqfs_shmcache_geometry(sqfs_shmcache_internal *s, size_t count,
+		size_t slot_size) {
+	s->count = count;
+	s->slot_size = slot_size;
+	s->stride = sqfs_shmcache_round(sizeof(sqfs_shmcache_slot) + slot_size);
+	s->len = sqfs_shmcache_round(sizeof(sqfs_shmcache_hdr)) + count * s->stride;
+}
+
+static sqfs_shmcache_slot *sqfs_shmcache_slot_at(sqfs_shmcache_internal *s,
+		size_t i) {
+	return (sqfs_shmcache_slot*)(s->base +
+		sqfs_shmcache_round(sizeof(sqfs_shmcache_hdr)) + i * s->stride);
+}
+
+static sqfs_err sqfs_shmcache_map(sqfs_shmcache_internal *s, size_t len) {
+	s->len = len;
+	s->base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (s->base == MAP_FAILED) {
+		s->base = NULL;
+		return SQFS_ERR;
+	}
+	return SQFS_OK;
+}
+
+static void sqfs_shmcache_unmap(sqfs_shmcache_internal *s) {
+	if (s->base)
+		munmap(s->base, s->len);
+	s->base = NULL;
+}
+
+/* Map the segment as it is, if it's usable */
+static sqfs_shmcache_state sqfs_shmcache_check(sqfs_shmcache_internal *s,
+		uint64_t id, size_t slot_size) {
+	sqfs_shmcache_hdr *hdr;
+	struct stat st;
+
+	if (fstat(s->fd, &st) == -1 || (size_t)st.st_size < sizeof(*hdr))
+		return SQFS_SHMCACHE_UNSET;
+	if (sqfs_shmcache_map(s, st.st_size))
+		return SQFS_SHMCACHE_OTHER;
+
+	hdr = (sqfs_shmcache_hdr*)s->base;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SQFS_SHMCACHE_MAGIC) {
+		sqfs_shmcache_unmap(s);
+		return SQFS_SHMCACHE_UNSET;
+	}
+	if (hdr->version != SQFS_SHMCACHE_VERSION || hdr->id != id ||
+			hdr->slot_size < slot_size || !hdr->count) {
+		sqfs_shmcache_unmap(s);
+		return SQFS_SHMCACHE_OTHER;
+	}
+	sqfs_shmcache_geometry(s, hdr->count, hdr->slot_size);
+	if ((size_t)st.st_size < s->len) {
+		sqfs_shmcache_unmap(s);
+		return SQFS_SHMCACHE_OTHER;
+	}
+	s->len = st.st_size;
+	return SQFS_SHMCACHE_READY;
+}
+
+/* Lay out the segment from scratch. Called with it locked exclusively. */
+static sqfs_err sqfs_shmcache_create(sqfs_shmcache_internal *s,
+		uint64_t id, size_t count, size_t slot_size) {
+	sqfs_shmcache_hdr *hdr;
+	pthread_mutexattr_t attr;
+	sqfs_err err = SQFS_OK;
+	size_t i;
+
+	sqfs_shmcache_geometry(s, count, slot_size);
+	/* Truncating first clears any old magic */
+	if (ftruncate(s->fd, 0) == -1 || ftruncate(s->fd, s->len) == -1)
+		return SQFS_ERR;
+	if (sqfs_shmcache_map(s, s->len))
+		return SQFS_ERR;
+
+	if (pthread_mutexattr_init(&attr))
+		return SQFS_ERR;
+	if (pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) ||
+			pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST))
+		err = SQFS_UNSUP;
+	for (i = 0; !err && i < s->count; ++i) {
+		sqfs_shmcache_slot *slot = sqfs_shmcache_slot_at(s, i);
+		slot->state = EMPTY;
+		if (pthread_mutex_init(&slot->lock, &attr))
+			err = SQFS_ERR;
+	}
+	pthread_mutexattr_destroy(&attr);
+	if (err)
+		return err;
+
+	hdr = (sqfs_shmcache_hdr*)s->base;
+	hdr->version = SQFS_SHMCACHE_VERSION;
+	hdr->id = id;
+	hdr->count = s->count;
+	hdr->slot_size = s->slot_size;
+	__atomic_store_n(&hdr->magic, SQFS_SHMCACHE_MAGIC, __ATOMIC_RELEASE);
+	return SQFS_OK;
+}
+
+/* Open and attach to the segment, setting it up if nobody else is using it.
+ * Sets 'retry' if it's worth starting over. */
+static sqfs_err sqfs_shmcache_open(sqfs_shmcache_internal *s, uint64_t id,
+		size_t count, size_t slot_size, bool *retry) {
+	sqfs_shmcache_state state;
+	struct stat st;
+	sqfs_err err;
+
+	*retry = false;
+	if ((s->fd = shm_open(s->name, O_RDWR | O_CREAT, 0600)) == -1)
+		return SQFS_ERR;
+
+	if (flock(s->fd, LOCK_EX | LOCK_NB) == 0) {
+		/* We're alone. Anything unusable, including a segment whose creator
+		 * died halfway, can be replaced. */
+		if (sqfs_shmcache_check(s, id, slot_size) != SQFS_SHMCACHE_READY) {
+			if ((err = sqfs_shmcache_create(s, id, count, slot_size))) {
+				shm_unlink(s->name);
+				return err;
+			}
+		}
+		if (flock(s->fd, LOCK_SH) == -1)
+			return SQFS_ERR;
+	} else {
+		/* Others have it, wait for any of them setting it up */
+		if (flock(s->fd, LOCK_SH) == -1)
+			return SQFS_ERR;
+		state = sqfs_shmcache_check(s, id, slot_size);
+		if (state != SQFS_SHMCACHE_READY) {
+			/* If its creator died, try again to take it over */
+			*retry = state == SQFS_SHMCACHE_UNSET;
+			return SQFS_ERR;
+		}
+	}
+
+	/* Its last user may have removed it before we got our lock */
+	if (fstat(s->fd, &st) == -1)
+		return SQFS_ERR;
+	if (st.st_nlink == 0) {
+		*retry = true;
+		return SQFS_ERR;
+	}
+	return SQFS_OK;
+}
+
+static void sqfs_shmcache_close(sqfs_shmcache_internal *s) {
+	sqfs_shmcache_unmap(s);
+	if (s->fd != -1)
+		close(s->fd);
+	s->fd = -1;
+}
+
+sqfs_err sqfs_shmcache_init(sqfs_shmcache *sc, uint64_t id, size_t count,
+		size_t slot_size) {
+	sqfs_shmcache_internal *s;
+	sqfs_err err = SQFS_ERR;
+	bool retry = true;
+	int tries;
+
+	if (!count)
+		return SQFS_ERR;
+	if (!(s = calloc(1, sizeof(*s))))
+		return SQFS_ERR;
+	s->fd = -1;
+	/* Images with different block sizes never share a segment */
+	snprintf(s->name, sizeof(s->name), "/squashfuse-%016llx-%zu",
+		(unsigned long long)id, slot_size);
+
+	for (tries = 0; retry && tries < SQFS_SHMCACHE_TRIES; ++tries) {
+		if (tries)
+			usleep(1000);
+		if (!(err = sqfs_shmcache_open(s, id, count, slot_size, &retry)))
+			break;
+		sqfs_shmcache_close(s);
+	}
+
+	if (err) {
+		free(s);
+		return err;
+	}
+	*sc = s;
+	return SQFS_OK;
+}
+
+void sqfs_shmcache_destroy(sqfs_shmcache *sc) {
+	sqfs_shmcache_internal *s;
+	if (!sc || !*sc)
+		return;
+	s = *sc;
+
+	sqfs_shmcache_unmap(s);
+	/* The last one out removes it. Anyone opening it meanwhile will see
+	 * that, once they have their lock. */
+	if (flock(s->fd, LOCK_EX | LOCK_NB) == 0)
+		shm_unlink(s->name);
+	sqfs_shmcache_close(s);
+	free(s);
+	*sc = NULL;
+}
+
+static sqfs_shmcache_slot *sqfs_shmcache_lock(sqfs_shmcache_internal *s,
+		sqfs_off_t pos) {
+	uint64_t key = pos;
+	size_t i = sqfs_hash_bytes(SQFS_HASH_BYTES_INIT, &key, sizeof(key)) %
+		s->count;
+	sqfs_shmcache_slot *slot = sqfs_shmcache_slot_at(s, i);
+	int r = pthread_mutex_lock(&slot->lock);
+
+	if (r == EOWNERDEAD) {
+		/* The owner died mid-update, so the contents are suspect */
+		slot->state = EMPTY;
+		pthread_mutex_consistent(&slot->lock);
+	} else if (r) {
+		return NULL;
+	}
+	return slot;
+}
+
+bool sqfs_shmcache_get(sqfs_shmcache *sc, sqfs_off_t pos,
+		const sqfs_digest *check, sqfs_block **block) {
+	sqfs_shmcache_slot *slot;
+	sqfs_block *b = NULL;
+
+	if (!(slot = sqfs_shmcache_lock(*sc, pos)))
+		return false;
+	if (slot->state == FULL && slot->pos == (uint64_t)pos &&
+			(!check || !memcmp(&slot->digest, check, sizeof(*check))) &&
+			(b = malloc(sizeof(*b)))) {
+		b->refcount = 1;
+		b->size = slot->size;
+		if ((b->data = malloc(b->size ? b->size : 1))) {
+			memcpy(b->data, slot + 1, b->size);
+		} else {
+			free(b);
+			b = NULL;
+		}
+	}
+	pthread_mutex_unlock(&slot->lock);
+
+	if (b)
+		*block = b;
+	return b != NULL;
+}
+
+void sqfs_shmcache_put(sqfs_shmcache *sc, sqfs_off_t pos,
+		const sqfs_digest *digest, const sqfs_block *block) {
+	sqfs_shmcache_slot *slot;
+
+	if (block->size > (*sc)->slot_size)
+		return;
+	if (!(slot = sqfs_shmcache_lock(*sc, pos)))
+		return;
+	slot->state = EMPTY;
+	slot->pos = pos;
+	slot->size = block->size;
+	if (digest)
+		slot->digest = *digest;
+	else
+		memset(&slot->digest, 0, sizeof(slot->digest));
+	memcpy(slot + 1, block->data, block->size);
+	slot->state = FULL;
+	pthread_mutex_unlock(&slot->lock);
+}
+
+#else /* SQFS_SHMCACHE_ENABLED */
+
+sqfs_err sqfs_shmcache_init(sqfs_shmcache *sc, uint64_t id, size_t count,
+		size_t slot_size) {
+	return SQFS_UNSUP;
+}
+
+void sqfs_shmcache_destroy(sqfs_shmcache *sc) {
+}
+
+bool sqfs_shmcache_get(sqfs_shmcache *sc, sqfs_off_t pos,
+		const sqfs_digest *check, sqfs_block **block) {
+	return false;
+}
+
+void sqfs_shmcache_put(sqfs_shmcache *sc, sqfs_off_t pos,
+		const sqfs_digest *digest, const sqfs_block *block) {
+}
+
+#endif /* SQFS_SHMCACHE_ENABLED */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_SHMCACHE_H
+#define SQFS_SHMCACHE_H
+
+#include "common.h"
+
+/* Block cache in shared memory, for processes mounting the same image
+ *  - Direct-mapped by block position, a collision replaces the old block
+ *  - Each slot has a robust, process-shared mutex, so a process dying while
+ *    holding it only loses that slot's contents
+ *  - Blocks are copied in and out, callers never point into the segment
+ *  - The segment is named after the image identifier and block size, under
+ *    /dev/shm or equivalent. Each process holds a shared flock() on it, and
+ *    the last to detach removes it. One left behind by processes that were
+ *    killed is reused, or reinitialised if its creator died setting it up,
+ *    and can be removed by hand when nothing is using it.
+ *  - Only available in multithreaded builds
+ */
+
+/* Attach to the segment for the given image, creating it with 'count'
+ * slots of 'slot_size' bytes if it doesn't exist. Returns SQFS_UNSUP where
+ * shared robust mutexes aren't available, and SQFS_ERR if the segment is in
+ * use with a layout this version can't share. */
+sqfs_err sqfs_shmcache_init(sqfs_shmcache *sc, uint64_t id, size_t count,
+	size_t slot_size);
+void sqfs_shmcache_destroy(sqfs_shmcache *sc);
+
+/* Copy out the block at image position 'pos'. On a hit, returns true with
+ * a new block of refcount one. If 'check' is given, the block must have
+ * been stored with that digest. */
+bool sqfs_shmcache_get(sqfs_shmcache *sc, sqfs_off_t pos,
+	const sqfs_digest *check, sqfs_block **block);
+
+/* Copy a block into the segment, with a digest of its source if 'digest'
+ * isn't NULL, replacing whatever shares its slot */
+void sqfs_shmcache_put(sqfs_shmcache *sc, sqfs_off_t pos,
+	const sqfs_digest *digest, const sqfs_block *block);
+
+#endif
@@ -29,6 +29,7 @@
 #include "file.h"
 #include "fs.h"
 #include "traverse.h"
+#include "traverse_mt.h"
 #include "util.h"
 #include "xattr.h"
 
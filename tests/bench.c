@@ -0,0 +1,357 @@
+/* Microbenchmarks of the libsquashfuse core, driven directly rather than
+ * through FUSE. Each benchmark repeats one operation against an image for
+ * a while, and the results are printed as JSON.
+ *
+ * usage: sqbench [-t MILLISECONDS] IMAGE...
+ */
+#include "squashfuse.h"
+#include "nonstd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Don't gather more than this many entries from an image */
+#define BENCH_MAX_ENTRIES 100000
+/* Check the clock after this many operations */
+#define BENCH_BATCH 16
+
+typedef struct {
+	sqfs_inode_id dir;	/* the directory it's in */
+	sqfs_inode_id id;
+	char *name;
+	char *path;
+} bench_entry;
+
+typedef struct {
+	sqfs fs;
+	bench_entry *entries;
+	size_t count;
+
+	/* The biggest regular file, for the reads */
+	sqfs_inode file;
+	sqfs_off_t file_size;
+	char *buf;
+
+	sqfs_traverse trv;
+	bool trv_open;
+} bench_image;
+
+/* One operation, the i'th. Adds to *bytes what it read, if anything. */
+typedef sqfs_err (*bench_op)(bench_image *img, uint64_t i, uint64_t *bytes);
+
+static uint64_t bench_budget_ns = 500 * 1000 * 1000;
+static bool bench_first;
+static int bench_threads = 1;
+
+/* A well mixed number from i, so random reads are repeatable */
+static uint64_t bench_mix(uint64_t i) {
+	i ^= i >> 33;
+	i *= 0xff51afd7ed558ccdULL;
+	i ^= i >> 33;
+	i *= 0xc4ceb9fe1a85ec53ULL;
+	i ^= i >> 33;
+	return i;
+}
+
+static sqfs_err bench_inode_get(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	sqfs_inode inode;
+	return sqfs_inode_get(&img->fs, &inode,
+		img->entries[i % img->count].id);
+}
+
+static sqfs_err bench_dir_lookup(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	bench_entry *e = &img->entries[i % img->count];
+	sqfs_inode dir;
+	sqfs_name namebuf;
+	sqfs_dir_entry entry;
+	bool found;
+	sqfs_err err;
+
+	if ((err = sqfs_inode_get(&img->fs, &dir, e->dir)))
+		return err;
+	sqfs_dentry_init(&entry, namebuf);
+	if ((err = sqfs_dir_lookup(&img->fs, &dir, e->name, strlen(e->name),
+			&entry, &found)))
+		return err;
+	return found ? SQFS_OK : SQFS_ERR;
+}
+
+static sqfs_err bench_lookup_path(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	sqfs_inode inode;
+	bool found;
+	sqfs_err err;
+
+	if ((err = sqfs_inode_get(&img->fs, &inode, sqfs_inode_root(&img->fs))))
+		return err;
+	if ((err = sqfs_lookup_path(&img->fs, &inode,
+			img->entries[i % img->count].path, &found)))
+		return err;
+	return found ? SQFS_OK : SQFS_ERR;
+}
+
+static sqfs_err bench_read(bench_image *img, sqfs_off_t off, size_t size,
+		uint64_t *bytes) {
+	sqfs_off_t got = size;
+	sqfs_err err;
+	if (off + got > img->file_size)
+		got = img->file_size - off;
+	if ((err = sqfs_read_range(&img->fs, &img->file, off, &got, img->buf)))
+		return err;
+	*bytes += got;
+	return SQFS_OK;
+}
+
+/* Sequential reads wrap around at the end of the file */
+static sqfs_err bench_read_seq(bench_image *img, uint64_t i, size_t size,
+		uint64_t *bytes) {
+	uint64_t chunks = (img->file_size + size - 1) / size;
+	return bench_read(img, (sqfs_off_t)(i % chunks) * size, size, bytes);
+}
+
+/* Random reads are aligned to their size */
+static sqfs_err bench_read_random(bench_image *img, uint64_t i, size_t size,
+		uint64_t *bytes) {
+	uint64_t chunks = (img->file_size + size - 1) / size;
+	return bench_read(img, (sqfs_off_t)(bench_mix(i) % chunks) * size, size,
+		bytes);
+}
+
+static sqfs_err bench_read_seq_4k(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	return bench_read_seq(img, i, 4096, bytes);
+}
+
+static sqfs_err bench_read_seq_1m(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	return bench_read_seq(img, i, 1024 * 1024, bytes);
+}
+
+static sqfs_err bench_read_random_4k(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	return bench_read_random(img, i, 4096, bytes);
+}
+
+static sqfs_err bench_read_random_128k(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	return bench_read_random(img, i, 128 * 1024, bytes);
+}
+
+/* Each step of the traversal is an operation, it starts over when done */
+static sqfs_err bench_traverse_next(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	sqfs_err err;
+	if (!img->trv_open) {
+		if ((err = sqfs_traverse_open(&img->trv, &img->fs,
+				sqfs_inode_root(&img->fs))))
+			return err;
+		img->trv_open = true;
+	}
+	if (!sqfs_traverse_next(&img->trv, &err)) {
+		sqfs_traverse_close(&img->trv);
+		img->trv_open = false;
+	}
+	return err;
+}
+
+static sqfs_err bench_traverse_mt_entry(void *user, const char *path,
+		sqfs_dir_entry *entry) {
+	__atomic_add_fetch((size_t *)user, 1, __ATOMIC_RELAXED);
+	return SQFS_OK;
+}
+
+/* A whole walk of the image, with a thread per CPU, is an operation */
+static sqfs_err bench_traverse_mt(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	size_t entries = 0;
+	return sqfs_traverse_mt(&img->fs, sqfs_inode_root(&img->fs),
+		bench_threads, bench_traverse_mt_entry, &entries);
+}
+
+/* The same walk as sqfs_listxattr() in fuseprivate.c, which needs FUSE */
+static sqfs_err bench_listxattr(bench_image *img, uint64_t i,
+		uint64_t *bytes) {
+	char name[SQUASHFS_NAME_LEN + 32];
+	sqfs_inode inode;
+	sqfs_xattr x;
+	sqfs_err err;
+
+	if ((err = sqfs_inode_get(&img->fs, &inode,
+			img->entries[i % img->count].id)))
+		return err;
+	if ((err = sqfs_xattr_open(&img->fs, &inode, &x)))
+		return err;
+	while (x.remain) {
+		if ((err = sqfs_xattr_read(&x)))
+			return err;
+		if (sqfs_xattr_name_size(&x) > sizeof(name))
+			return SQFS_ERR;
+		if ((err = sqfs_xattr_name(&x, name, true)))
+			return err;
+	}
+	return SQFS_OK;
+}
+
+static bool bench_run(bench_image *img, const char *name, bench_op op) {
+	uint64_t start, elapsed, ops = 0, bytes = 0;
+
+	start = sqfs_clock_ns();
+	do {
+		int j;
+		for (j = 0; j < BENCH_BATCH; ++j) {
+			sqfs_err err = op(img, ops, &bytes);
+			if (err) {
+				fprintf(stderr, "%s failed: %d\n", name, (int)err);
+				return false;
+			}
+			++ops;
+		}
+		elapsed = sqfs_clock_ns() - start;
+	} while (elapsed < bench_budget_ns);
+
+	printf("%s\n    {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.1f, "
+		"\"ops_per_sec\": %.1f", bench_first ? "" : ",", name,
+		(unsigned long long)ops, (double)elapsed / ops, ops * 1e9 / elapsed);
+	if (bytes)
+		printf(", \"bytes_per_sec\": %.0f", bytes * 1e9 / elapsed);
+	printf("}");
+	bench_first = false;
+	return true;
+}
+
+/* Find the entries to look up, and the biggest file */
+static sqfs_err bench_gather(bench_image *img) {
+	sqfs_traverse trv;
+	sqfs_inode_id biggest = 0;
+	sqfs_err err;
+
+	img->file_size = -1;
+	if ((err = sqfs_traverse_open(&trv, &img->fs, sqfs_inode_root(&img->fs))))
+		return err;
+	while (img->count < BENCH_MAX_ENTRIES && sqfs_traverse_next(&trv, &err)) {
+		bench_entry *e;
+		sqfs_inode inode;
+		char *slash;
+		bool found;
+
+		if (trv.dir_end)
+			continue;
+		e = &img->entries[img->count];
+		e->id = sqfs_dentry_inode(&trv.entry);
+		e->path = strdup(trv.path);
+		e->name = strdup(sqfs_dentry_name(&trv.entry));
+		if (!e->path || !e->name) {
+			err = SQFS_ERR;
+			break;
+		}
+
+		/* The directory it's in */
+		if ((err = sqfs_inode_get(&img->fs, &inode, sqfs_inode_root(&img->fs))))
+			break;
+		e->dir = sqfs_inode_root(&img->fs);
+		if ((slash = strrchr(e->path, '/'))) {
+			*slash = '\0';
+			err = sqfs_lookup_path_with_id(&img->fs, &inode, e->path, &found,
+				&e->dir);
+			*slash = '/';
+			if (err || !found) {
+				err = SQFS_ERR;
+				break;
+			}
+		}
+		++img->count;
+
+		if ((err = sqfs_inode_get(&img->fs, &inode, e->id)))
+			break;
+		if (S_ISREG(inode.base.mode) &&
+				(sqfs_off_t)inode.xtra.reg.file_size > img->file_size) {
+			biggest = e->id;
+			img->file_size = inode.xtra.reg.file_size;
+		}
+	}
+	sqfs_traverse_close(&trv);
+	if (err)
+		return err;
+	if (!img->count)
+		return SQFS_ERR;
+	if (img->file_size > 0)
+		err = sqfs_inode_get(&img->fs, &img->file, biggest);
+	return err;
+}
+
+static bool bench_image_run(const char *path, bool first) {
+	bench_image img;
+	bool ok = false;
+	size_t i;
+
+	memset(&img, 0, sizeof(img));
+	if (sqfs_open_image(&img.fs, path, 0))
+		return false;
+	if (!(img.entries = calloc(BENCH_MAX_ENTRIES, sizeof(*img.entries))) ||
+			!(img.buf = malloc(1024 * 1024)))
+		goto done;
+	if (bench_gather(&img)) {
+		fprintf(stderr, "Can't walk %s\n", path);
+		goto done;
+	}
+
+	printf("%s{\"image\": \"%s\", \"compression\": \"%s\", \"block_size\": %u, "
+		"\"entries\": %zu, \"file_size\": %lld, \"results\": [",
+		first ? "  " : ",\n  ", path,
+		sqfs_compression_name(sqfs_compression(&img.fs)),
+		img.fs.sb.block_size, img.count, (long long)img.file_size);
+	bench_first = true;
+	ok = bench_run(&img, "inode_get", bench_inode_get) &&
+		bench_run(&img, "dir_lookup", bench_dir_lookup) &&
+		bench_run(&img, "lookup_path", bench_lookup_path) &&
+		bench_run(&img, "traverse_next", bench_traverse_next) &&
+		bench_run(&img, "traverse_mt", bench_traverse_mt) &&
+		bench_run(&img, "listxattr", bench_listxattr);
+	if (ok && img.file_size > 0) {
+		ok = bench_run(&img, "read_seq_4k", bench_read_seq_4k) &&
+			bench_run(&img, "read_seq_1m", bench_read_seq_1m) &&
+			bench_run(&img, "read_random_4k", bench_read_random_4k) &&
+			bench_run(&img, "read_random_128k", bench_read_random_128k);
+	}
+	printf("\n  ]}");
+
+done:
+	if (img.trv_open)
+		sqfs_traverse_close(&img.trv);
+	if (img.entries) {
+		for (i = 0; i < img.count; ++i) {
+			free(img.entries[i].name);
+			free(img.entries[i].path);
+		}
+	}
+	free(img.entries);
+	free(img.buf);
+	sqfs_destroy(&img.fs);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	int i = 1, first;
+	bool ok = true;
+
+	if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+		bench_budget_ns = strtoull(argv[2], NULL, 10) * 1000 * 1000;
+		i += 2;
+	}
+	if (i >= argc) {
+		fprintf(stderr, "usage: %s [-t MILLISECONDS] IMAGE...\n", argv[0]);
+		return 2;
+	}
+
+	bench_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	printf("[\n");
+	for (first = i; i < argc && ok; ++i)
+		ok = bench_image_run(argv[i], i == first);
+	printf("\n]\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#!/bin/sh
+
+# Build reference images and run sqbench and decompbench against them, then
+# run cachebench.
+#
+# Environment:
+#   BENCH_DIR    Where to keep the images, reused if they're already there.
+#                Default: a temporary directory.
+#   BENCH_TIME   Milliseconds to spend on each benchmark. Default: 200.
+#   BENCH_OUT    Where to write the JSON results. Default: bench-results.json
+#   BENCH_CACHE_OUT  Where to write the cache contention results.
+#                Default: bench-cache-results.json
+#   BENCH_DECOMP_OUT  Where to write the decompression results.
+#                Default: bench-decompress-results.json
+
+. "tests/lib.sh"
+
+set -e
+
+if [ -n "$BENCH_DIR" ]; then
+    WORKDIR="$BENCH_DIR"
+    KEEP=1
+else
+    WORKDIR=$(mktemp -d)
+    KEEP=
+fi
+mkdir -p "$WORKDIR"
+
+cleanup() {
+    set +e # Don't care about errors here.
+    if [ -z "$KEEP" ] && [ -n "$WORKDIR" ]; then
+        rm -rf "$WORKDIR"
+    fi
+}
+trap cleanup EXIT
+
+find_compressors
+
+# Something to read: compressible, but not trivially so
+big_file() {
+    head -c 18000000 /dev/urandom | base64 > "$1"
+}
+
+# Directories nested a few deep, about 16 entries each, with xattrs if we can
+build_narrow() {
+    src="$WORKDIR/narrow"
+    [ -d "$src" ] && return
+    mkdir -p "$src.tmp"
+    for a in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        for b in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+            mkdir -p "$src.tmp/$a/$b"
+            for c in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+                echo "$a$b$c" > "$src.tmp/$a/$b/file$c"
+            done
+        done
+    done
+    if command -v setfattr >/dev/null 2>&1; then
+        for f in "$src.tmp"/*/0/*; do
+            setfattr -n user.bench -v "$f" "$f" 2>/dev/null || break
+            setfattr -n user.other -v 1 "$f" 2>/dev/null || break
+        done
+    fi
+    big_file "$src.tmp/big"
+    mv "$src.tmp" "$src"
+}
+
+# One very wide directory
+build_wide() {
+    src="$WORKDIR/wide"
+    [ -d "$src" ] && return
+    mkdir -p "$src.tmp/dir"
+    i=0
+    while [ $i -lt 16384 ]; do
+        : > "$src.tmp/dir/entry-$i"
+        i=$((i + 1))
+    done
+    big_file "$src.tmp/big"
+    mv "$src.tmp" "$src"
+}
+
+echo "Building source trees in $WORKDIR"
+build_narrow
+build_wide
+
+images=
+for tree in narrow wide; do
+    for comp in $compressors; do
+        for bs in 4K 128K 1M; do
+            image="$WORKDIR/$tree-$comp-$bs.squashfs"
+            if [ ! -f "$image" ]; then
+                echo "Building $image"
+                mksquashfs "$WORKDIR/$tree" "$image.tmp" -comp $comp -b $bs \
+                    -no-progress -noappend >/dev/null
+                mv "$image.tmp" "$image"
+            fi
+            images="$images $image"
+        done
+    done
+done
+
+out="${BENCH_OUT:-bench-results.json}"
+./sqbench -t "${BENCH_TIME:-200}" $images > "$out"
+cat "$out"
+echo "Results in $out"
+
+echo "Running decompression benchmark"
+decomp_out="${BENCH_DECOMP_OUT:-bench-decompress-results.json}"
+./decompbench -t "${BENCH_TIME:-200}" $images > "$decomp_out"
+echo "Results in $decomp_out"
+
+echo "Running cache contention benchmark"
+cache_out="${BENCH_CACHE_OUT:-bench-cache-results.json}"
+./cachebench -t "${BENCH_TIME:-200}" > "$cache_out"
+echo "Results in $cache_out"
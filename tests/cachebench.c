@@ -0,0 +1,305 @@
+/* Stress the cache from many threads at once, and see how it holds up.
+ *
+ * Each run has some number of threads getting entries with one access
+ * pattern, spending a fixed time to fill each miss while holding the entry,
+ * as a decompression would. It reports throughput, hit rate and how long
+ * sqfs_cache_get() took, which is mostly waiting for the lock. Results are
+ * printed as JSON.
+ *
+ * usage: cachebench [-t MILLISECONDS] [-T MAX_THREADS] [-n ENTRIES] [-k KEYS]
+ */
+#include "config.h"
+#include "cache.h"
+#include "nonstd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef SQFS_MULTITHREADED
+#include <pthread.h>
+#define MAX_THREADS 128
+#else
+#define MAX_THREADS 1
+#endif
+
+/* Keys are generated ahead of time, so picking one costs nothing */
+#define KEY_COUNT (1 << 20)
+/* Latencies are kept in power of two buckets of nanoseconds */
+#define BUCKETS 64
+
+typedef enum { UNIFORM, ZIPF, SCAN } Pattern;
+static const char *pattern_names[] = { "uniform", "zipf", "scan" };
+static const uint64_t fill_costs[] = { 0, 1000, 10000 };
+
+typedef struct {
+    sqfs_cache_idx idx;
+    uint64_t check;
+} Entry;
+
+typedef struct {
+#ifdef SQFS_MULTITHREADED
+    pthread_t thread;
+#endif
+    int number;
+    uint64_t ops, hits, errors;
+    uint64_t buckets[BUCKETS];
+    char pad[64];
+} Worker;
+
+static sqfs_cache cache;
+static Pattern pattern;
+static uint64_t fill_cost;
+static sqfs_cache_idx *keys;
+static size_t key_space = 16384;
+static int running;
+static uint64_t deadline;
+#ifdef SQFS_MULTITHREADED
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+static void EntryDispose(void *e) {
+    ((Entry *)e)->check = 0;
+}
+
+static uint64_t mix(uint64_t i) {
+    i ^= i >> 33;
+    i *= 0xff51afd7ed558ccdULL;
+    i ^= i >> 33;
+    i *= 0xc4ceb9fe1a85ec53ULL;
+    i ^= i >> 33;
+    return i;
+}
+
+/* Zipfian with s = 1, by searching the cumulative distribution */
+static void make_keys(Pattern p) {
+    double *cdf = NULL, sum = 0;
+    size_t i;
+
+    if (p == ZIPF) {
+        cdf = malloc(key_space * sizeof(*cdf));
+        for (i = 0; i < key_space; ++i)
+            cdf[i] = (sum += 1.0 / (i + 1));
+    }
+    for (i = 0; i < KEY_COUNT; ++i) {
+        uint64_t r = mix(i + 1);
+        if (p == UNIFORM) {
+            keys[i] = r % key_space;
+        } else if (p == ZIPF) {
+            double u = (r >> 11) * (1.0 / 9007199254740992.0) * sum;
+            size_t lo = 0, hi = key_space - 1;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (cdf[mid] < u)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            /* Spread the popular keys around, like real block numbers */
+            keys[i] = mix(lo) % (key_space * 64);
+        } else {
+            keys[i] = i % key_space;
+        }
+    }
+    free(cdf);
+}
+
+/* Hold the entry as long as a fill would */
+static void spin(uint64_t ns) {
+    uint64_t end;
+    if (!ns)
+        return;
+    end = sqfs_clock_ns() + ns;
+    while (sqfs_clock_ns() < end)
+        ;
+}
+
+static int bucket(uint64_t ns) {
+    int b = 0;
+    while (ns > 1 && b < BUCKETS - 1) {
+        ns >>= 1;
+        ++b;
+    }
+    return b;
+}
+
+static void *work(void *arg) {
+    Worker *w = arg;
+    /* Start each thread somewhere else in the keys */
+    size_t i = (size_t)mix(w->number) % KEY_COUNT;
+
+#ifdef SQFS_MULTITHREADED
+    /* Don't spin, so starting many threads doesn't take forever */
+    pthread_mutex_lock(&start_lock);
+    while (!running)
+        pthread_cond_wait(&start_cond, &start_lock);
+    pthread_mutex_unlock(&start_lock);
+#endif
+    while (__atomic_load_n(&running, __ATOMIC_RELAXED) > 0) {
+        sqfs_cache_idx idx = keys[i];
+        uint64_t start = sqfs_clock_ns();
+        Entry *e = sqfs_cache_get(&cache, idx);
+        w->buckets[bucket(sqfs_clock_ns() - start)]++;
+
+        if (sqfs_cache_entry_valid(&cache, e)) {
+            if (e->idx != idx || e->check != mix(idx))
+                w->errors++;
+            w->hits++;
+        } else {
+            spin(fill_cost);
+            e->idx = idx;
+            e->check = mix(idx);
+            sqfs_cache_entry_mark_valid(&cache, e);
+        }
+        sqfs_cache_put(&cache, e);
+
+        w->ops++;
+        if (++i == KEY_COUNT)
+            i = 0;
+#ifndef SQFS_MULTITHREADED
+        /* Nobody else to stop us */
+        if (!(w->ops % 256) && sqfs_clock_ns() >= deadline)
+            break;
+#endif
+    }
+    return NULL;
+}
+
+/* Upper bound of the bucket holding this fraction of the latencies */
+static uint64_t percentile(const uint64_t *buckets, uint64_t total,
+                           double frac) {
+    uint64_t seen = 0, want = (uint64_t)(total * frac);
+    int b;
+    for (b = 0; b < BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen > want)
+            break;
+    }
+    return (uint64_t)2 << (b < BUCKETS - 1 ? b : BUCKETS - 2);
+}
+
+static int run(int threads, uint64_t budget_ns, size_t entries, int first) {
+    Worker *workers = calloc(threads, sizeof(*workers));
+    uint64_t buckets[BUCKETS], ops = 0, hits = 0, errors = 0, start, elapsed;
+    int i, b;
+
+    if (!workers || sqfs_cache_init(&cache, sizeof(Entry), entries,
+            EntryDispose)) {
+        fprintf(stderr, "Can't set up the cache\n");
+        return 0;
+    }
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+    for (i = 0; i < threads; ++i) {
+        workers[i].number = i;
+#ifdef SQFS_MULTITHREADED
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i])) {
+            fprintf(stderr, "Can't start thread %d\n", i);
+            exit(1);
+        }
+#endif
+    }
+
+    start = sqfs_clock_ns();
+    deadline = start + budget_ns;
+#ifdef SQFS_MULTITHREADED
+    pthread_mutex_lock(&start_lock);
+    __atomic_store_n(&running, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_lock);
+    {
+        struct timespec ts;
+        ts.tv_sec = budget_ns / 1000000000;
+        ts.tv_nsec = budget_ns % 1000000000;
+        nanosleep(&ts, NULL);
+    }
+    __atomic_store_n(&running, -1, __ATOMIC_RELAXED);
+    for (i = 0; i < threads; ++i)
+        pthread_join(workers[i].thread, NULL);
+#else
+    running = 1;
+    work(&workers[0]);
+#endif
+    elapsed = sqfs_clock_ns() - start;
+
+    memset(buckets, 0, sizeof(buckets));
+    for (i = 0; i < threads; ++i) {
+        ops += workers[i].ops;
+        hits += workers[i].hits;
+        errors += workers[i].errors;
+        for (b = 0; b < BUCKETS; ++b)
+            buckets[b] += workers[i].buckets[b];
+    }
+
+    printf("%s\n  {\"threads\": %d, \"pattern\": \"%s\", \"fill_ns\": %llu, "
+           "\"ops\": %llu, \"ops_per_sec\": %.1f, \"hit_rate\": %.4f, "
+           "\"get_ns\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+           "\"p999\": %llu}}",
+           first ? "" : ",", threads, pattern_names[pattern],
+           (unsigned long long)fill_cost, (unsigned long long)ops,
+           ops * 1e9 / elapsed, ops ? (double)hits / ops : 0.0,
+           (unsigned long long)percentile(buckets, ops, 0.5),
+           (unsigned long long)percentile(buckets, ops, 0.9),
+           (unsigned long long)percentile(buckets, ops, 0.99),
+           (unsigned long long)percentile(buckets, ops, 0.999));
+    fflush(stdout);
+
+    sqfs_cache_destroy(&cache);
+    free(workers);
+    if (errors) {
+        fprintf(stderr, "%llu hits returned the wrong entry\n",
+                (unsigned long long)errors);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    uint64_t budget_ns = 200 * 1000 * 1000;
+    size_t entries = 1024;
+    int max_threads = MAX_THREADS, threads, ok = 1, first = 1, i;
+    size_t f;
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-t") == 0)
+            budget_ns = strtoull(argv[i + 1], NULL, 10) * 1000 * 1000;
+        else if (strcmp(argv[i], "-T") == 0)
+            max_threads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-n") == 0)
+            entries = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-k") == 0)
+            key_space = strtoul(argv[i + 1], NULL, 10);
+        else
+            break;
+    }
+    if (i < argc || !entries || !key_space || max_threads < 1) {
+        fprintf(stderr, "usage: %s [-t MILLISECONDS] [-T MAX_THREADS] "
+                "[-n ENTRIES] [-k KEYS]\n", argv[0]);
+        return 2;
+    }
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    if (!(keys = malloc(KEY_COUNT * sizeof(*keys)))) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    printf("[");
+    for (pattern = UNIFORM; pattern <= SCAN && ok; ++pattern) {
+        make_keys(pattern);
+        for (f = 0; f < sizeof(fill_costs) / sizeof(fill_costs[0]); ++f) {
+            fill_cost = fill_costs[f];
+            for (threads = 1; threads <= max_threads && ok; threads *= 2) {
+                ok = run(threads, budget_ns, entries, first);
+                first = 0;
+            }
+        }
+    }
+    printf("\n]\n");
+
+    free(keys);
+    return ok ? 0 : 1;
+}
@@ -101,8 +101,77 @@ int test_two_entries(void) {
     return errors == 0;
 }
 
+static int disposed;
+static void TestStructCountDispose(void *t) {
+    ++disposed;
+}
+
+int test_limit(void) {
+    int errors = 0;
+    sqfs_cache cache;
+    TestStruct *entry;
+    int i;
+
+    EXPECT_EQ(sqfs_cache_init(&cache, sizeof(TestStruct), 16,
+                              TestStructCountDispose), SQFS_OK);
+    disposed = 0;
+    for (i = 0; i < 16; ++i) {
+        entry = (TestStruct *)sqfs_cache_get(&cache, i);
+        if (!sqfs_cache_entry_valid(&cache, entry))
+            sqfs_cache_entry_mark_valid(&cache, entry);
+        sqfs_cache_put(&cache, entry);
+    }
+
+    /* At most one entry survives */
+    sqfs_cache_limit(&cache, 1);
+    EXPECT_EQ(sqfs_cache_count(&cache), 16);
+    EXPECT_EQ(disposed >= 15, 1);
+
+    /* And there's room again once the limit is lifted */
+    sqfs_cache_limit(&cache, 16);
+    entry = (TestStruct *)sqfs_cache_get(&cache, 100);
+    sqfs_cache_entry_mark_valid(&cache, entry);
+    sqfs_cache_put(&cache, entry);
+    entry = (TestStruct *)sqfs_cache_get(&cache, 100);
+    EXPECT_NE(sqfs_cache_entry_valid(&cache, entry), 0);
+    sqfs_cache_put(&cache, entry);
+
+    sqfs_cache_destroy(&cache);
+    return errors == 0;
+}
+
+int test_stats(void) {
+    int errors = 0;
+    sqfs_cache cache;
+    sqfs_cache_counters stats;
+    TestStruct *entry;
+
+    EXPECT_EQ(sqfs_cache_init(&cache, sizeof(TestStruct), 16,
+                              TestStructDispose), SQFS_OK);
+    entry = (TestStruct *)sqfs_cache_get(&cache, 1);
+    sqfs_cache_entry_mark_valid(&cache, entry);
+    sqfs_cache_count_bytes(&cache, 100);
+    sqfs_cache_put(&cache, entry);
+    entry = (TestStruct *)sqfs_cache_get(&cache, 1);
+    sqfs_cache_put(&cache, entry);
+    entry = (TestStruct *)sqfs_cache_get(&cache, 2);
+    sqfs_cache_put(&cache, entry);
+
+    sqfs_cache_stats(&cache, &stats);
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.fills, 1);
+    EXPECT_EQ(stats.bytes, 100);
+    EXPECT_EQ(stats.entries, 16);
+
+    sqfs_cache_destroy(&cache);
+    return errors == 0;
+}
+
 int main(void) {
 	return test_cache_miss() &&
 		test_mark_valid_and_lookup() &&
-		test_two_entries() ? 0 : 1;
+		test_two_entries() &&
+		test_limit() &&
+		test_stats() ? 0 : 1;
 }
@@ -0,0 +1,373 @@
+/* Time decompression of the real blocks of an image.
+ *
+ * Every metadata and data block is read once through sqfs_block_read(),
+ * which is timed as it goes. Then the compressed blocks are decompressed
+ * over and over with each implementation of the image's codec, for a while.
+ * The results are printed as JSON.
+ *
+ * usage: decompbench [-t MILLISECONDS] IMAGE...
+ */
+#include "squashfuse.h"
+#include "nonstd.h"
+#include "swap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Don't keep more than this much compressed data from an image */
+#define BENCH_MAX_BYTES (256 * 1024 * 1024)
+
+typedef struct {
+	sqfs_off_t pos;
+	uint32_t hdr;		/* as in a blocklist */
+} bench_loc;
+
+typedef struct {
+	void *data;			/* compressed */
+	uint32_t size;
+	size_t outsize;		/* decompressed */
+	uint64_t hash;		/* of the decompressed data */
+} bench_block;
+
+typedef struct {
+	const char *kind;
+	size_t max_out;		/* room needed to decompress a block */
+
+	bench_block *blocks;	/* the compressed ones */
+	size_t count, cap;
+	uint64_t in_bytes, out_bytes;
+	size_t stored;		/* blocks that weren't compressed */
+
+	/* Reading every block through sqfs_block_read() */
+	uint64_t *lat;
+	size_t nlat, latcap;
+	uint64_t read_bytes, read_ns;
+} bench_kind;
+
+static uint64_t bench_budget_ns = 500 * 1000 * 1000;
+static size_t bench_bytes;
+static bool bench_first;
+
+static void *bench_grow(void *p, size_t *cap, size_t each) {
+	*cap = *cap ? *cap * 2 : 1024;
+	if (!(p = realloc(p, *cap * each))) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static void bench_latency(uint64_t **lat, size_t *count, size_t *cap,
+		uint64_t ns) {
+	if (*count == *cap)
+		*lat = bench_grow(*lat, cap, sizeof(**lat));
+	(*lat)[(*count)++] = ns;
+}
+
+static uint64_t bench_hash(const void *data, size_t size) {
+	const unsigned char *p = data;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+	for (i = 0; i < size; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* Read a block the usual way, and keep its compressed form */
+static sqfs_err bench_add(sqfs *fs, bench_kind *k, sqfs_off_t pos,
+		bool compressed, uint32_t size) {
+	sqfs_block *block;
+	bench_block *b;
+	uint64_t start, ns;
+	sqfs_err err;
+
+	start = sqfs_clock_ns();
+	if ((err = sqfs_block_read(fs, pos, compressed, size, k->max_out, &block)))
+		return err;
+	ns = sqfs_clock_ns() - start;
+	bench_latency(&k->lat, &k->nlat, &k->latcap, ns);
+	k->read_ns += ns;
+	k->read_bytes += block->size;
+
+	if (!compressed) {
+		++k->stored;
+		goto done;
+	}
+	if (bench_bytes + size > BENCH_MAX_BYTES)
+		goto done;
+
+	if (k->count == k->cap)
+		k->blocks = bench_grow(k->blocks, &k->cap, sizeof(*k->blocks));
+	b = &k->blocks[k->count];
+	b->size = size;
+	b->outsize = block->size;
+	b->hash = bench_hash(block->data, block->size);
+	if (!(b->data = malloc(size))) {
+		err = SQFS_ERR;
+		goto done;
+	}
+	if (sqfs_pread(fs->fd, b->data, size, pos + fs->offset) != size) {
+		free(b->data);
+		err = SQFS_ERR;
+		goto done;
+	}
+	bench_bytes += size;
+	k->in_bytes += size;
+	k->out_bytes += b->outsize;
+	++k->count;
+
+done:
+	sqfs_block_dispose(block);
+	return err;
+}
+
+/* The inode and directory tables, and the other tables' blocks after them,
+ * up to the first index */
+static sqfs_err bench_gather_md(sqfs *fs, bench_kind *k) {
+	uint64_t starts[] = {
+		fs->sb.fragment_table_start,
+		fs->sb.lookup_table_start,
+		fs->sb.id_table_start,
+		fs->sb.xattr_id_table_start,
+	};
+	sqfs_off_t pos = fs->sb.inode_table_start;
+	uint64_t end = fs->sb.bytes_used;
+	size_t i;
+
+	for (i = 0; i < sizeof(starts) / sizeof(starts[0]); ++i) {
+		if (starts[i] > (uint64_t)pos && starts[i] < end)
+			end = starts[i];
+	}
+
+	while ((uint64_t)pos < end) {
+		uint16_t hdr, size;
+		bool compressed;
+		sqfs_err err;
+
+		if (sqfs_pread(fs->fd, &hdr, sizeof(hdr), pos + fs->offset)
+				!= sizeof(hdr))
+			return SQFS_ERR;
+		sqfs_swapin16(&hdr);
+		sqfs_md_header(hdr, &compressed, &size);
+		pos += sizeof(hdr);
+		if ((err = bench_add(fs, k, pos, compressed, size)))
+			return err;
+		pos += size;
+	}
+	return SQFS_OK;
+}
+
+static int bench_loc_compare(const void *a, const void *b) {
+	sqfs_off_t x = ((const bench_loc *)a)->pos, y = ((const bench_loc *)b)->pos;
+	return x < y ? -1 : x > y;
+}
+
+/* Every block of every file, and every fragment block, each just once */
+static sqfs_err bench_gather_data(sqfs *fs, bench_kind *k) {
+	sqfs_traverse trv;
+	bench_loc *locs = NULL;
+	size_t count = 0, cap = 0, i;
+	sqfs_err err;
+
+	if ((err = sqfs_traverse_open(&trv, fs, sqfs_inode_root(fs))))
+		return err;
+	while (sqfs_traverse_next(&trv, &err)) {
+		sqfs_inode inode;
+		sqfs_blocklist bl;
+
+		if (trv.dir_end)
+			continue;
+		if ((err = sqfs_inode_get(fs, &inode, sqfs_dentry_inode(&trv.entry))))
+			break;
+		if (!S_ISREG(inode.base.mode))
+			continue;
+		sqfs_blocklist_init(fs, &inode, &bl);
+		while (bl.remain && !(err = sqfs_blocklist_next(&bl))) {
+			if (!bl.input_size)
+				continue; /* sparse */
+			if (count == cap)
+				locs = bench_grow(locs, &cap, sizeof(*locs));
+			locs[count].pos = bl.block;
+			locs[count++].hdr = bl.header;
+		}
+		if (err)
+			break;
+	}
+	sqfs_traverse_close(&trv);
+
+	for (i = 0; !err && i < fs->sb.fragments; ++i) {
+		struct squashfs_fragment_entry frag;
+		if ((err = sqfs_frag_entry(fs, &frag, i)))
+			break;
+		if (count == cap)
+			locs = bench_grow(locs, &cap, sizeof(*locs));
+		locs[count].pos = frag.start_block;
+		locs[count++].hdr = frag.size;
+	}
+
+	/* Identical files share their blocks */
+	qsort(locs, count, sizeof(*locs), bench_loc_compare);
+	for (i = 0; !err && i < count; ++i) {
+		bool compressed;
+		uint32_t size;
+		if (i && locs[i].pos == locs[i - 1].pos)
+			continue;
+		sqfs_data_header(locs[i].hdr, &compressed, &size);
+		err = bench_add(fs, k, locs[i].pos, compressed, size);
+	}
+	free(locs);
+	return err;
+}
+
+static int bench_ns_compare(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double bench_percentile(const uint64_t *lat, size_t count,
+		double frac) {
+	size_t i;
+	if (!count)
+		return 0;
+	i = (size_t)(count * frac);
+	if (i >= count)
+		i = count - 1;
+	return lat[i] / 1000.0;
+}
+
+static void bench_print(bench_kind *k, const char *impl, uint64_t *lat,
+		size_t count, uint64_t bytes, uint64_t ns) {
+	qsort(lat, count, sizeof(*lat), bench_ns_compare);
+	printf("%s\n    {\"kind\": \"%s\", \"impl\": \"%s\", \"blocks\": %zu, "
+		"\"stored\": %zu, \"compressed_bytes\": %llu, "
+		"\"uncompressed_bytes\": %llu, \"ratio\": %.3f, "
+		"\"mb_per_sec\": %.1f, \"latency_us\": {\"p50\": %.1f, "
+		"\"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}}",
+		bench_first ? "" : ",", k->kind, impl, k->count, k->stored,
+		(unsigned long long)k->in_bytes, (unsigned long long)k->out_bytes,
+		k->in_bytes ? (double)k->out_bytes / k->in_bytes : 0.0,
+		ns ? bytes * 1e3 / ns : 0.0,
+		bench_percentile(lat, count, 0.5), bench_percentile(lat, count, 0.9),
+		bench_percentile(lat, count, 0.99), bench_percentile(lat, count, 1));
+	bench_first = false;
+}
+
+/* Decompress every block with one implementation, for a while. The first
+ * time through, check the results against what sqfs_block_read() got. */
+static bool bench_impl(bench_kind *k, const sqfs_decompressor_impl *impl,
+		char *out) {
+	uint64_t *lat = NULL, bytes = 0, ns = 0;
+	size_t count = 0, cap = 0, i;
+	bool first = true;
+
+	do {
+		for (i = 0; i < k->count; ++i) {
+			bench_block *b = &k->blocks[i];
+			size_t outsize = k->max_out;
+			uint64_t start = sqfs_clock_ns(), took;
+			sqfs_err err = impl->decompress(b->data, b->size, out, &outsize);
+			took = sqfs_clock_ns() - start;
+			if (err || (first && (outsize != b->outsize ||
+					bench_hash(out, outsize) != b->hash))) {
+				fprintf(stderr, "%s got the wrong %s block\n", impl->name,
+					k->kind);
+				free(lat);
+				return false;
+			}
+			bench_latency(&lat, &count, &cap, took);
+			bytes += outsize;
+			ns += took;
+		}
+		first = false;
+	} while (ns < bench_budget_ns);
+
+	bench_print(k, impl->name, lat, count, bytes, ns);
+	free(lat);
+	return true;
+}
+
+static bool bench_kind_run(sqfs *fs, bench_kind *k) {
+	const sqfs_decompressor_impl *impls;
+	size_t count, i;
+	char *out;
+	bool ok = true;
+
+	bench_print(k, "block_read", k->lat, k->nlat, k->read_bytes, k->read_ns);
+	if (!k->count)
+		return true;
+	if (!(out = malloc(k->max_out))) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+	count = sqfs_decompressor_impls(sqfs_compression(fs), &impls);
+	for (i = 0; ok && i < count; ++i)
+		ok = bench_impl(k, &impls[i], out);
+	free(out);
+	return ok;
+}
+
+static void bench_kind_free(bench_kind *k) {
+	size_t i;
+	for (i = 0; i < k->count; ++i)
+		free(k->blocks[i].data);
+	free(k->blocks);
+	free(k->lat);
+}
+
+static bool bench_image_run(const char *path, bool first) {
+	bench_kind md, data;
+	sqfs fs;
+	bool ok = false;
+
+	memset(&md, 0, sizeof(md));
+	md.kind = "metadata";
+	md.max_out = SQUASHFS_METADATA_SIZE;
+	memset(&data, 0, sizeof(data));
+	data.kind = "data";
+
+	if (sqfs_open_image(&fs, path, 0))
+		return false;
+	data.max_out = fs.sb.block_size;
+	bench_bytes = 0;
+	if (bench_gather_md(&fs, &md) || bench_gather_data(&fs, &data)) {
+		fprintf(stderr, "Can't read the blocks of %s\n", path);
+		goto done;
+	}
+
+	printf("%s{\"image\": \"%s\", \"compression\": \"%s\", \"block_size\": %u, "
+		"\"results\": [", first ? "  " : ",\n  ", path,
+		sqfs_compression_name(sqfs_compression(&fs)), fs.sb.block_size);
+	bench_first = true;
+	ok = bench_kind_run(&fs, &md) && bench_kind_run(&fs, &data);
+	printf("\n  ]}");
+
+done:
+	bench_kind_free(&md);
+	bench_kind_free(&data);
+	sqfs_destroy(&fs);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	int i = 1, first;
+	bool ok = true;
+
+	if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+		bench_budget_ns = strtoull(argv[2], NULL, 10) * 1000 * 1000;
+		i += 2;
+	}
+	if (i >= argc) {
+		fprintf(stderr, "usage: %s [-t MILLISECONDS] IMAGE...\n", argv[0]);
+		return 2;
+	}
+
+	printf("[\n");
+	for (first = i; i < argc && ok; ++i)
+		ok = bench_image_run(argv[i], i == first);
+	printf("\n]\n");
+	return ok ? 0 : 1;
+}
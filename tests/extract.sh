@@ -0,0 +1,80 @@
+#!/bin/sh
+
+. "tests/lib.sh"
+
+set -e
+
+WORKDIR=$(mktemp -d)
+
+cleanup() {
+    set +e # Don't care about errors here.
+    if [ -n "$WORKDIR" ]; then
+        rm -rf "$WORKDIR"
+    fi
+}
+trap cleanup EXIT
+
+find_compressors
+
+# Files spanning many blocks, ending in fragments or not, and other types
+mkdir -p "$WORKDIR/source/dir/sub" "$WORKDIR/source/readonly"
+head -c 100 /dev/urandom >"$WORKDIR/source/rand1"
+head -c 3000000 /dev/urandom >"$WORKDIR/source/dir/rand2"
+head -c 262144 /dev/urandom >"$WORKDIR/source/dir/sub/rand3"
+head -c 87 /dev/zero >"$WORKDIR/source/z1 with spaces"
+: >"$WORKDIR/source/empty"
+dd if=/dev/zero of="$WORKDIR/source/sparse" bs=1024 count=0 seek=1024 2>/dev/null
+echo tail >>"$WORKDIR/source/sparse"
+ln -s dir/sub/rand3 "$WORKDIR/source/link"
+ln "$WORKDIR/source/dir/rand2" "$WORKDIR/source/hard"
+ln "$WORKDIR/source/dir/rand2" "$WORKDIR/source/dir/sub/hard"
+chmod 600 "$WORKDIR/source/rand1"
+chmod 555 "$WORKDIR/source/readonly"
+
+for comp in $compressors; do
+    echo "Building $comp squashfs image..."
+    mksquashfs "$WORKDIR/source" "$WORKDIR/squashfs.image" -comp $comp \
+        -b 4K -no-progress -noappend >/dev/null
+
+    ./squashfuse_extract -j 4 -d "$WORKDIR/out" "$WORKDIR/squashfs.image"
+    if ! diff -r "$WORKDIR/source" "$WORKDIR/out"; then
+        echo "Extracted files differ!"
+        exit 1
+    fi
+    if [ "$(ls -l "$WORKDIR/out/rand1" | cut -c1-10)" != "-rw-------" ]; then
+        echo "Permissions weren't restored!"
+        exit 1
+    fi
+    if ! [ "$WORKDIR/out/hard" -ef "$WORKDIR/out/dir/rand2" ] ||
+            ! [ "$WORKDIR/out/dir/sub/hard" -ef "$WORKDIR/out/dir/rand2" ]; then
+        echo "Hard links weren't restored!"
+        exit 1
+    fi
+    plain_size=$(du -k "$WORKDIR/out/sparse" | cut -f1)
+    chmod -R u+w "$WORKDIR/out"
+    rm -rf "$WORKDIR/out"
+
+    ./squashfuse_extract -s -d "$WORKDIR/out" "$WORKDIR/squashfs.image"
+    if ! diff -r "$WORKDIR/source" "$WORKDIR/out"; then
+        echo "Sparse extraction differs!"
+        exit 1
+    fi
+    if [ "$(du -k "$WORKDIR/out/sparse" | cut -f1)" -ge "$plain_size" ]; then
+        echo "Sparse extraction didn't leave a hole!"
+        exit 1
+    fi
+    chmod -R u+w "$WORKDIR/out"
+    rm -rf "$WORKDIR/out"
+
+    ./squashfuse_extract -d "$WORKDIR/out" "$WORKDIR/squashfs.image" dir/sub
+    if ! diff -r "$WORKDIR/source/dir/sub" "$WORKDIR/out/dir/sub" ||
+            [ -e "$WORKDIR/out/dir/rand2" ]; then
+        echo "Extracted the wrong files!"
+        exit 1
+    fi
+    rm -rf "$WORKDIR/out" "$WORKDIR/squashfs.image"
+done
+
+chmod -R u+w "$WORKDIR/source"
+echo "Success."
+exit 0
@@ -0,0 +1,142 @@
+#!/bin/sh
+
+# Mount an image with each FUSE driver that was built, and time workloads
+# against it with fusebench. Each run gets a fresh mount, so the kernel's
+# caches start out empty.
+#
+# Environment:
+#   BENCH_DIR      Where to keep the image, reused if it's already there.
+#                  Default: a temporary directory.
+#   BENCH_TIME     Milliseconds to run each workload. Default: 5000.
+#   BENCH_READERS  Numbers of concurrent readers to try. Default: "1 4 16".
+#   BENCH_COMP     Compressor for the image. Default: the first one found.
+#   BENCH_OUT      Where to write the JSON results.
+#                  Default: fuse-bench-results.json
+
+. "tests/lib.sh"
+
+set -e
+
+if [ -n "$BENCH_DIR" ]; then
+    WORKDIR="$BENCH_DIR"
+    KEEP=1
+else
+    WORKDIR=$(mktemp -d)
+    KEEP=
+fi
+MNT="$WORKDIR/mount"
+mkdir -p "$MNT"
+
+cleanup() {
+    set +e # Don't care about errors here.
+    if sq_is_mountpoint "$MNT"; then
+        sq_umount "$MNT"
+    fi
+    if [ -z "$KEEP" ] && [ -n "$WORKDIR" ]; then
+        rm -rf "$WORKDIR"
+    fi
+}
+trap cleanup EXIT
+
+find_compressors
+comp=${BENCH_COMP:-$(echo $compressors | cut -d' ' -f1)}
+
+build_source() {
+    src="$WORKDIR/source"
+    [ -d "$src" ] && return
+    echo "Generating source files..."
+    mkdir -p "$src.tmp"
+
+    # Something big to read, compressible but not trivially so
+    head -c 96000000 /dev/urandom | base64 > "$src.tmp/big"
+
+    # A tree of small files
+    for a in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        for b in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+            mkdir -p "$src.tmp/tree/$a/$b"
+            for c in 0 1 2 3 4 5 6 7; do
+                head -c $(( (0x$a$b$c % 61 + 1) * 256 )) /dev/urandom \
+                    > "$src.tmp/tree/$a/$b/file$c"
+            done
+        done
+    done
+
+    # Programs, with xattrs if we can
+    mkdir -p "$src.tmp/bin"
+    i=0
+    while [ $i -lt 256 ]; do
+        head -c $(( (i % 16 + 1) * 65536 )) /dev/urandom | base64 \
+            > "$src.tmp/bin/prog$i"
+        if command -v setfattr >/dev/null 2>&1; then
+            setfattr -n user.mime_type -v application/x-executable \
+                "$src.tmp/bin/prog$i" 2>/dev/null || true
+        fi
+        i=$((i + 1))
+    done
+
+    mv "$src.tmp" "$src"
+}
+
+build_source
+image="$WORKDIR/bench-$comp.squashfs"
+if [ ! -f "$image" ]; then
+    echo "Building $comp squashfs image..."
+    mksquashfs "$WORKDIR/source" "$image.tmp" -comp $comp -no-progress \
+        -noappend >/dev/null
+    mv "$image.tmp" "$image"
+fi
+
+# mount_image DRIVER: mount the image with that driver, as a background job
+mount_image() {
+    case $1 in
+        ll) set -- ./squashfuse_ll ;;
+        ll-single) set -- ./squashfuse_ll -s ;;
+        hl) set -- ./squashfuse ;;
+    esac
+    FIFO=$(mktemp -u)
+    mkfifo "$FIFO"
+    "$@" -f -o notify_pipe="$FIFO" "$image" "$MNT" \
+        >"$WORKDIR/mount.log" 2>&1 &
+    STATUS=$(head -c1 "$FIFO")
+    rm -f "$FIFO"
+    if [ "$STATUS" != "s" ]; then
+        echo "Image did not mount successfully"
+        cat "$WORKDIR/mount.log"
+        exit 1
+    fi
+}
+
+drivers=
+[ -x ./squashfuse_ll ] && drivers="$drivers ll ll-single"
+[ -x ./squashfuse ] && drivers="$drivers hl"
+if [ -z "$drivers" ]; then
+    echo "No FUSE drivers were built."
+    exit 1
+fi
+
+out="${BENCH_OUT:-fuse-bench-results.json}"
+echo "[" > "$out"
+sep=
+for driver in $drivers; do
+    for workload in seq random stat small exec; do
+        case $workload in
+            seq|random) target=big ;;
+            stat|small) target=tree ;;
+            exec) target=bin ;;
+        esac
+        for readers in ${BENCH_READERS:-1 4 16}; do
+            echo "$driver: $workload with $readers readers..."
+            mount_image $driver
+            result=$(./fusebench -t "${BENCH_TIME:-5000}" -j $readers \
+                -l $driver $workload "$MNT/$target")
+            sq_umount "$MNT"
+            wait
+            printf '%s  %s\n' "$sep" "$result" >> "$out"
+            sep=,
+        done
+    done
+done
+echo "]" >> "$out"
+
+cat "$out"
+echo "Results in $out"
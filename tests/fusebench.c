@@ -0,0 +1,395 @@
+/* Workloads to run against a mounted filesystem, for tests/fuse-bench.sh.
+ *
+ * Several readers run the same workload at once, for a while. Each timed
+ * operation is recorded, and the throughput and latency percentiles are
+ * printed as JSON.
+ *
+ * usage: fusebench [-t MILLISECONDS] [-j READERS] [-l LABEL] WORKLOAD PATH
+ *
+ * Workloads:
+ *   seq FILE      read the file in 128K chunks, each reader in its own part
+ *   random FILE   read 4K at random places in the file
+ *   stat DIR      walk the tree, listing directories and stat'ing everything
+ *   small DIR     walk the tree, opening and reading every regular file
+ *   exec DIR      walk the tree, and load every regular file like exec would:
+ *                 stat it, check its xattrs, read its header and a few pages
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEQ_SIZE (128 * 1024)
+#define RANDOM_SIZE 4096
+#define PAGE 4096
+#define MAX_READERS 256
+
+typedef struct reader reader;
+typedef bool (*workload)(reader *r);
+
+struct reader {
+	pthread_t thread;
+	int number;
+	workload work;
+	char *buf;
+
+	uint64_t *lat;	/* nanoseconds for each operation */
+	size_t ops, cap;
+	uint64_t bytes;
+	bool failed;
+
+	uint64_t next;	/* where the workload is up to */
+};
+
+static const char *path;
+static int readers = 1;
+static uint64_t deadline;
+static off_t file_size;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool done(void) {
+	return now_ns() >= deadline;
+}
+
+static uint64_t mix(uint64_t i) {
+	i ^= i >> 33;
+	i *= 0xff51afd7ed558ccdULL;
+	i ^= i >> 33;
+	i *= 0xc4ceb9fe1a85ec53ULL;
+	i ^= i >> 33;
+	return i;
+}
+
+static bool record(reader *r, uint64_t start) {
+	if (r->ops == r->cap) {
+		size_t cap = r->cap ? r->cap * 2 : 4096;
+		uint64_t *lat = realloc(r->lat, cap * sizeof(*lat));
+		if (!lat) {
+			fprintf(stderr, "Out of memory\n");
+			return false;
+		}
+		r->lat = lat;
+		r->cap = cap;
+	}
+	r->lat[r->ops++] = now_ns() - start;
+	return true;
+}
+
+static bool fail(const char *what, const char *file) {
+	fprintf(stderr, "%s %s: %s\n", what, file, strerror(errno));
+	return false;
+}
+
+/* Each reader reads its own part of the file, wrapping around at the end */
+static bool work_seq(reader *r) {
+	off_t chunks = (file_size + SEQ_SIZE - 1) / SEQ_SIZE;
+	off_t chunk = chunks * r->number / readers;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return fail("Can't open", path);
+
+	while (!done()) {
+		uint64_t start = now_ns();
+		ssize_t got = pread(fd, r->buf, SEQ_SIZE, chunk * SEQ_SIZE);
+		if (got < 0) {
+			close(fd);
+			return fail("Can't read", path);
+		}
+		if (!record(r, start))
+			break;
+		r->bytes += got;
+		if (++chunk == chunks)
+			chunk = 0;
+	}
+	close(fd);
+	return true;
+}
+
+static bool work_random(reader *r) {
+	off_t pages = (file_size + RANDOM_SIZE - 1) / RANDOM_SIZE;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return fail("Can't open", path);
+
+	while (!done()) {
+		off_t page = mix(r->number * 0x100000000ULL + r->next++) % pages;
+		uint64_t start = now_ns();
+		ssize_t got = pread(fd, r->buf, RANDOM_SIZE, page * RANDOM_SIZE);
+		if (got < 0) {
+			close(fd);
+			return fail("Can't read", path);
+		}
+		if (!record(r, start))
+			break;
+		r->bytes += got;
+	}
+	close(fd);
+	return true;
+}
+
+/* Open a file and read all of it */
+static bool load_small(reader *r, const char *file) {
+	uint64_t start = now_ns();
+	ssize_t got;
+	int fd = open(file, O_RDONLY);
+	if (fd == -1)
+		return fail("Can't open", file);
+	while ((got = read(fd, r->buf, SEQ_SIZE)) > 0)
+		r->bytes += got;
+	close(fd);
+	if (got < 0)
+		return fail("Can't read", file);
+	return record(r, start);
+}
+
+/* Roughly what the kernel and dynamic loader do to run a program */
+static bool load_exec(reader *r, const char *file) {
+	uint64_t start = now_ns();
+	struct stat st;
+	char names[4096];
+	ssize_t len, got, i;
+	int fd = open(file, O_RDONLY);
+	if (fd == -1)
+		return fail("Can't open", file);
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return fail("Can't stat", file);
+	}
+
+#ifdef __APPLE__
+	len = flistxattr(fd, names, sizeof(names), 0);
+	fgetxattr(fd, "security.capability", r->buf, PAGE, 0, 0);
+#else
+	len = flistxattr(fd, names, sizeof(names));
+	fgetxattr(fd, "security.capability", r->buf, PAGE);
+#endif
+	for (i = 0; i < len; i += strlen(names + i) + 1) {
+#ifdef __APPLE__
+		fgetxattr(fd, names + i, r->buf, PAGE, 0, 0);
+#else
+		fgetxattr(fd, names + i, r->buf, PAGE);
+#endif
+	}
+
+	/* The header, then some pages that get faulted in */
+	if ((got = pread(fd, r->buf, PAGE, 0)) < 0)
+		goto error;
+	r->bytes += got;
+	for (i = 0; i < 4 && st.st_size > PAGE; ++i) {
+		off_t page = mix(st.st_ino + i) % ((st.st_size + PAGE - 1) / PAGE);
+		if ((got = pread(fd, r->buf, PAGE, page * PAGE)) < 0)
+			goto error;
+		r->bytes += got;
+	}
+	close(fd);
+	return record(r, start);
+
+error:
+	close(fd);
+	return fail("Can't read", file);
+}
+
+/* Walk the tree, doing something with each regular file, or stat'ing every
+ * entry if there's nothing to do */
+static bool walk(reader *r, const char *dir, bool (*load)(reader*, const char*)) {
+	DIR *d;
+	struct dirent *de;
+	bool ok = true;
+	uint64_t start = now_ns();
+
+	if (!(d = opendir(dir)))
+		return fail("Can't open", dir);
+	if (!load && !record(r, start)) {
+		closedir(d);
+		return false;
+	}
+	while (ok && !done() && (de = readdir(d))) {
+		char *sub;
+		struct stat st;
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		if (!(sub = malloc(strlen(dir) + strlen(de->d_name) + 2))) {
+			ok = false;
+			break;
+		}
+		sprintf(sub, "%s/%s", dir, de->d_name);
+
+		start = now_ns();
+		if (lstat(sub, &st) == -1)
+			ok = fail("Can't stat", sub);
+		else if (!load)
+			ok = record(r, start);
+		if (ok && S_ISDIR(st.st_mode))
+			ok = walk(r, sub, load);
+		else if (ok && load && S_ISREG(st.st_mode))
+			ok = load(r, sub);
+		free(sub);
+	}
+	closedir(d);
+	return ok;
+}
+
+static bool work_stat(reader *r) {
+	while (!done())
+		if (!walk(r, path, NULL))
+			return false;
+	return true;
+}
+
+static bool work_small(reader *r) {
+	while (!done())
+		if (!walk(r, path, load_small))
+			return false;
+	return true;
+}
+
+static bool work_exec(reader *r) {
+	while (!done())
+		if (!walk(r, path, load_exec))
+			return false;
+	return true;
+}
+
+static void *run(void *arg) {
+	reader *r = arg;
+	r->failed = !r->work(r);
+	return NULL;
+}
+
+static int compare(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const uint64_t *lat, size_t count, double frac) {
+	size_t i;
+	if (!count)
+		return 0;
+	i = (size_t)(count * frac);
+	if (i >= count)
+		i = count - 1;
+	return lat[i] / 1000.0;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-t MILLISECONDS] [-j READERS] [-l LABEL] "
+		"seq|random|stat|small|exec PATH\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	uint64_t budget_ns = 5000ULL * 1000 * 1000, start, elapsed, bytes = 0;
+	const char *label = NULL, *name;
+	workload work = NULL;
+	reader *rs;
+	uint64_t *lat;
+	size_t ops = 0;
+	bool ok = true;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "t:j:l:")) != -1) {
+		switch (opt) {
+			case 't': budget_ns = strtoull(optarg, NULL, 10) * 1000 * 1000; break;
+			case 'j': readers = atoi(optarg); break;
+			case 'l': label = optarg; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (optind + 2 != argc || readers < 1 || readers > MAX_READERS)
+		usage(argv[0]);
+	name = argv[optind];
+	path = argv[optind + 1];
+
+	if (strcmp(name, "seq") == 0)
+		work = work_seq;
+	else if (strcmp(name, "random") == 0)
+		work = work_random;
+	else if (strcmp(name, "stat") == 0)
+		work = work_stat;
+	else if (strcmp(name, "small") == 0)
+		work = work_small;
+	else if (strcmp(name, "exec") == 0)
+		work = work_exec;
+	else
+		usage(argv[0]);
+
+	if (work == work_seq || work == work_random) {
+		struct stat st;
+		if (stat(path, &st) == -1 || !S_ISREG(st.st_mode) || !st.st_size) {
+			fprintf(stderr, "%s isn't a file to read\n", path);
+			return 1;
+		}
+		file_size = st.st_size;
+	}
+
+	if (!(rs = calloc(readers, sizeof(*rs)))) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	start = now_ns();
+	deadline = start + budget_ns;
+	for (i = 0; i < readers; ++i) {
+		rs[i].number = i;
+		rs[i].work = work;
+		if (!(rs[i].buf = malloc(SEQ_SIZE)) ||
+				pthread_create(&rs[i].thread, NULL, run, &rs[i])) {
+			fprintf(stderr, "Can't start reader %d\n", i);
+			return 1;
+		}
+	}
+	for (i = 0; i < readers; ++i) {
+		pthread_join(rs[i].thread, NULL);
+		ok = ok && !rs[i].failed;
+		ops += rs[i].ops;
+		bytes += rs[i].bytes;
+	}
+	elapsed = now_ns() - start;
+	if (!ok)
+		return 1;
+
+	/* Put all the latencies together */
+	if (!(lat = malloc((ops ? ops : 1) * sizeof(*lat)))) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	ops = 0;
+	for (i = 0; i < readers; ++i) {
+		memcpy(lat + ops, rs[i].lat, rs[i].ops * sizeof(*lat));
+		ops += rs[i].ops;
+		free(rs[i].lat);
+		free(rs[i].buf);
+	}
+	qsort(lat, ops, sizeof(*lat), compare);
+
+	printf("{");
+	if (label)
+		printf("\"label\": \"%s\", ", label);
+	printf("\"workload\": \"%s\", \"readers\": %d, \"ops\": %zu, "
+		"\"ops_per_sec\": %.1f, \"bytes_per_sec\": %.0f, \"latency_us\": "
+		"{\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, "
+		"\"max\": %.1f}}\n",
+		name, readers, ops, ops * 1e9 / elapsed, bytes * 1e9 / elapsed,
+		percentile(lat, ops, 0.5), percentile(lat, ops, 0.9),
+		percentile(lat, ops, 0.99), percentile(lat, ops, 0.999),
+		percentile(lat, ops, 1));
+
+	free(lat);
+	free(rs);
+	return 0;
+}
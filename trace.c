@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "trace.h"
+
+#include "nonstd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef SQFS_MULTITHREADED
+# include <pthread.h>
+#endif
+#ifndef _WIN32
+# include <unistd.h>
+#endif
+
+/* Spans each thread holds before writing them out */
+#define SQFS_TRACE_BATCH 1024
+
+typedef struct {
+	uint64_t start, end;
+	const char *cat, *name;
+	const char *arg1, *arg2;
+	int64_t val1, val2;
+} sqfs_trace_event;
+
+typedef struct sqfs_trace_thread {
+	struct sqfs_trace_thread *next;
+	unsigned tid;
+	size_t count;
+	sqfs_trace_event events[SQFS_TRACE_BATCH];
+} sqfs_trace_thread;
+
+bool sqfs_trace_on = false;
+
+static FILE *sqfs_trace_file;
+static uint64_t sqfs_trace_epoch;
+static long sqfs_trace_pid;
+static bool sqfs_trace_written;	/* any events yet? */
+static unsigned sqfs_trace_tids;
+/* Each open starts a new generation, so threads drop buffers from
+ * earlier ones */
+static unsigned sqfs_trace_gen;
+static sqfs_trace_thread *sqfs_trace_threads;
+
+#ifdef SQFS_MULTITHREADED
+static pthread_mutex_t sqfs_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread sqfs_trace_thread *sqfs_trace_self;
+static __thread unsigned sqfs_trace_self_gen;
+# define SQFS_TRACE_LOCK() pthread_mutex_lock(&sqfs_trace_lock)
+# define SQFS_TRACE_UNLOCK() pthread_mutex_unlock(&sqfs_trace_lock)
+#else
+static sqfs_trace_thread *sqfs_trace_self;
+static unsigned sqfs_trace_self_gen;
+# define SQFS_TRACE_LOCK() ((void)0)
+# define SQFS_TRACE_UNLOCK() ((void)0)
+#endif
+
+uint64_t sqfs_trace_now(void) {
+	return sqfs_clock_ns();
+}
+
+sqfs_err sqfs_trace_open(const char *path) {
+	if (sqfs_trace_file)
+		return SQFS_ERR;
+	if (!(sqfs_trace_file = fopen(path, "w")))
+		return SQFS_ERR;
+	fputs("[\n", sqfs_trace_file);
+
+	sqfs_trace_epoch = sqfs_trace_now();
+#ifdef _WIN32
+	sqfs_trace_pid = 1;
+#else
+	sqfs_trace_pid = (long)getpid();
+#endif
+	sqfs_trace_written = false;
+	sqfs_trace_tids = 0;
+	++sqfs_trace_gen;
+	sqfs_trace_on = true;
+	return SQFS_OK;
+}
+
+/* Call with the lock held */
+static void sqfs_trace_flush(sqfs_trace_thread *t) {
+	size_t i;
+	for (i = 0; i < t->count; ++i) {
+		sqfs_trace_event *e = &t->events[i];
+		fprintf(sqfs_trace_file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+			"\"pid\":%ld,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+			sqfs_trace_written ? ",\n" : "", e->name, e->cat,
+			sqfs_trace_pid, t->tid, (e->start - sqfs_trace_epoch) / 1e3,
+			(e->end - e->start) / 1e3);
+		if (e->arg1) {
+			fprintf(sqfs_trace_file, ",\"args\":{\"%s\":%lld", e->arg1,
+				(long long)e->val1);
+			if (e->arg2)
+				fprintf(sqfs_trace_file, ",\"%s\":%lld", e->arg2,
+					(long long)e->val2);
+			fputc('}', sqfs_trace_file);
+		}
+		fputc('}', sqfs_trace_file);
+		sqfs_trace_written = true;
+	}
+	t->count = 0;
+}
+
+void sqfs_trace_close(void) {
+	sqfs_trace_thread *t, *next;
+	if (!sqfs_trace_file)
+		return;
+	sqfs_trace_on = false;
+
+	SQFS_TRACE_LOCK();
+	for (t = sqfs_trace_threads; t; t = next) {
+		next = t->next;
+		sqfs_trace_flush(t);
+		free(t);
+	}
+	sqfs_trace_threads = NULL;
+	fputs("\n]\n", sqfs_trace_file);
+	fclose(sqfs_trace_file);
+	sqfs_trace_file = NULL;
+	SQFS_TRACE_UNLOCK();
+}
+
+static sqfs_trace_thread *sqfs_trace_thread_get(void) {
+	sqfs_trace_thread *t;
+	if (sqfs_trace_self && sqfs_trace_self_gen == sqfs_trace_gen)
+		return sqfs_trace_self;
+
+	if (!(t = calloc(1, sizeof(*t))))
+		return NULL;
+	SQFS_TRACE_LOCK();
+	t->tid = ++sqfs_trace_tids;
+	t->next = sqfs_trace_threads;
+	sqfs_trace_threads = t;
+	SQFS_TRACE_UNLOCK();
+
+	sqfs_trace_self = t;
+	sqfs_trace_self_gen = sqfs_trace_gen;
+	return t;
+}
+
+void sqfs_trace_span(uint64_t start, const char *cat, const char *name,
+		const char *arg1, int64_t val1, const char *arg2, int64_t val2) {
+	uint64_t end = sqfs_trace_now();
+	sqfs_trace_thread *t;
+	sqfs_trace_event *e;
+
+	if (!sqfs_trace_on || !(t = sqfs_trace_thread_get()))
+		return;
+
+	e = &t->events[t->count++];
+	e->start = start;
+	e->end = end;
+	e->cat = cat;
+	e->name = name;
+	e->arg1 = arg1;
+	e->val1 = val1;
+	e->arg2 = arg2;
+	e->val2 = val2;
+
+	if (t->count == SQFS_TRACE_BATCH) {
+		SQFS_TRACE_LOCK();
+		sqfs_trace_flush(t);
+		SQFS_TRACE_UNLOCK();
+	}
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_TRACE_H
+#define SQFS_TRACE_H
+
+#include "common.h"
+
+/* Span tracing
+ *  - Records spans of time, with the thread they ran on, to a file in the
+ *    Chrome trace event format, which chrome://tracing and Perfetto load
+ *  - One trace per process, off until sqfs_trace_open()
+ *  - Each thread buffers its spans, and writes them out in batches
+ */
+
+/* Start tracing to the file at path. Call before starting any threads that
+ * might be traced. */
+sqfs_err sqfs_trace_open(const char *path);
+/* Write out what's buffered and finish the file. Call once the traced
+ * threads are done. Ok to call if tracing is off. */
+void sqfs_trace_close(void);
+
+extern bool sqfs_trace_on;
+uint64_t sqfs_trace_now(void);
+
+/* When a span starts, or zero if tracing is off */
+static inline uint64_t sqfs_trace_begin(void) {
+	return sqfs_trace_on ? sqfs_trace_now() : 0;
+}
+
+/* Record a span that started at 'start', and ends now, in category 'cat'.
+ * Up to two integer arguments may be named, the names of unused ones are
+ * NULL. The strings must be static. */
+void sqfs_trace_span(uint64_t start, const char *cat, const char *name,
+	const char *arg1, int64_t val1, const char *arg2, int64_t val2);
+
+#endif
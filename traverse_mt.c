@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "traverse_mt.h"
+
+#include "fs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SQFS_MULTITHREADED
+# include <pthread.h>
+# define SQFS_TRAVERSE_MT_LOCK(p) pthread_mutex_lock(&(p)->lock)
+# define SQFS_TRAVERSE_MT_UNLOCK(p) pthread_mutex_unlock(&(p)->lock)
+# define SQFS_TRAVERSE_MT_WAKE(st) pthread_cond_signal(&(st)->cond)
+# define SQFS_TRAVERSE_MT_WAKE_ALL(st) pthread_cond_broadcast(&(st)->cond)
+# define SQFS_TRAVERSE_MT_STOPPED(st) \
+	__atomic_load_n(&(st)->stop, __ATOMIC_RELAXED)
+# define SQFS_TRAVERSE_MT_SET_STOPPED(st) \
+	__atomic_store_n(&(st)->stop, true, __ATOMIC_RELAXED)
+#else
+# define SQFS_TRAVERSE_MT_LOCK(p)
+# define SQFS_TRAVERSE_MT_UNLOCK(p)
+# define SQFS_TRAVERSE_MT_WAKE(st)
+# define SQFS_TRAVERSE_MT_WAKE_ALL(st)
+# define SQFS_TRAVERSE_MT_STOPPED(st) ((st)->stop)
+# define SQFS_TRAVERSE_MT_SET_STOPPED(st) ((st)->stop = true)
+#endif
+
+#define SQFS_TRAVERSE_MT_MAX_THREADS 256
+
+/* A directory waiting to be listed */
+typedef struct {
+	sqfs_inode_id id;
+	char *path;
+} sqfs_traverse_mt_dir;
+
+/* Each thread's queue. The owner adds and takes at the back, so it goes
+ * depth-first and its queue stays short. Thieves take from the front. */
+typedef struct {
+#ifdef SQFS_MULTITHREADED
+	pthread_t thread;
+	pthread_mutex_t lock;
+#endif
+	sqfs_traverse_mt_dir *dirs;
+	size_t head, count, cap;
+} sqfs_traverse_mt_queue;
+
+typedef struct {
+	sqfs *fs;
+	sqfs_traverse_mt_fn fn;
+	void *user;
+
+	sqfs_traverse_mt_queue *queues;
+	int threads;
+
+#ifdef SQFS_MULTITHREADED
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+	size_t queued;		/* directories in any queue */
+	size_t pending;		/* directories queued or being listed */
+	sqfs_err err;
+	bool stop;
+} sqfs_traverse_mt_state;
+
+typedef struct {
+	sqfs_traverse_mt_state *st;
+	int self;
+} sqfs_traverse_mt_thread;
+
+
+static sqfs_err sqfs_traverse_mt_push(sqfs_traverse_mt_state *st, int self,
+		sqfs_inode_id id, char *path) {
+	sqfs_traverse_mt_queue *q = &st->queues[self];
+
+	SQFS_TRAVERSE_MT_LOCK(q);
+	if (q->count == q->cap) {
+		size_t cap = q->cap ? q->cap * 2 : 64, i;
+		sqfs_traverse_mt_dir *dirs = malloc(cap * sizeof(*dirs));
+		if (!dirs) {
+			SQFS_TRAVERSE_MT_UNLOCK(q);
+			return SQFS_ERR;
+		}
+		for (i = 0; i < q->count; ++i)
+			dirs[i] = q->dirs[(q->head + i) % q->cap];
+		free(q->dirs);
+		q->dirs = dirs;
+		q->head = 0;
+		q->cap = cap;
+	}
+	q->dirs[(q->head + q->count) % q->cap].id = id;
+	q->dirs[(q->head + q->count) % q->cap].path = path;
+	++q->count;
+	SQFS_TRAVERSE_MT_UNLOCK(q);
+
+	SQFS_TRAVERSE_MT_LOCK(st);
+	++st->queued;
+	++st->pending;
+	SQFS_TRAVERSE_MT_WAKE(st);
+	SQFS_TRAVERSE_MT_UNLOCK(st);
+	return SQFS_OK;
+}
+
+static bool sqfs_traverse_mt_take(sqfs_traverse_mt_queue *q,
+		sqfs_traverse_mt_dir *d, bool steal) {
+	bool found = false;
+	SQFS_TRAVERSE_MT_LOCK(q);
+	if (q->count) {
+		if (steal) {
+			*d = q->dirs[q->head];
+			q->head = (q->head + 1) % q->cap;
+		} else {
+			*d = q->dirs[(q->head + q->count - 1) % q->cap];
+		}
+		--q->count;
+		found = true;
+	}
+	SQFS_TRAVERSE_MT_UNLOCK(q);
+	return found;
+}
+
+static bool sqfs_traverse_mt_find(sqfs_traverse_mt_state *st, int self,
+		sqfs_traverse_mt_dir *d) {
+	int i;
+	if (sqfs_traverse_mt_take(&st->queues[self], d, false))
+		return true;
+	for (i = 1; i < st->threads; ++i) {
+		if (sqfs_traverse_mt_take(&st->queues[(self + i) % st->threads], d,
+				true))
+			return true;
+	}
+	return false;
+}
+
+/* Report everything in a directory, and queue its subdirectories */
+static sqfs_err sqfs_traverse_mt_list(sqfs_traverse_mt_state *st, int self,
+		sqfs_traverse_mt_dir *d) {
+	size_t prefix = strlen(d->path), cap = 0;
+	char *path = NULL;
+	sqfs_dir_entry entry;
+	sqfs_name namebuf;
+	sqfs_inode inode;
+	sqfs_dir dir;
+	sqfs_err err;
+
+	if ((err = sqfs_inode_get(st->fs, &inode, d->id)))
+		return err;
+	if ((err = sqfs_dir_open(st->fs, &inode, &dir, 0)))
+		return err;
+
+	sqfs_dentry_init(&entry, namebuf);
+	while (!SQFS_TRAVERSE_MT_STOPPED(st) &&
+			sqfs_dir_next(st->fs, &dir, &entry, &err)) {
+		size_t size = sqfs_dentry_name_size(&entry), len = 0;
+
+		/* Room for the directory, a separator, the name and a nul */
+		if (prefix + size + 2 > cap) {
+			char *next;
+			cap = prefix + size + 2 > 2 * cap ? prefix + size + 2 : 2 * cap;
+			if (!(next = realloc(path, cap))) {
+				err = SQFS_ERR;
+				break;
+			}
+			path = next;
+		}
+		if (prefix) {
+			memcpy(path, d->path, prefix);
+			path[prefix] = '/';
+			len = prefix + 1;
+		}
+		memcpy(path + len, sqfs_dentry_name(&entry), size);
+		path[len + size] = '\0';
+
+		if ((err = st->fn(st->user, path, &entry)))
+			break;
+		if (sqfs_dentry_is_dir(&entry)) {
+			char *sub = malloc(len + size + 1);
+			if (!sub) {
+				err = SQFS_ERR;
+				break;
+			}
+			memcpy(sub, path, len + size + 1);
+			err = sqfs_traverse_mt_push(st, self, sqfs_dentry_inode(&entry),
+				sub);
+			if (err) {
+				free(sub);
+				break;
+			}
+		}
+	}
+	free(path);
+	return err;
+}
+
+/* List directories until there are none left anywhere */
+static void sqfs_traverse_mt_run(sqfs_traverse_mt_state *st, int self) {
+	sqfs_traverse_mt_dir d;
+	sqfs_err err;
+
+	for (;;) {
+		if (sqfs_traverse_mt_find(st, self, &d)) {
+			SQFS_TRAVERSE_MT_LOCK(st);
+			--st->queued;
+			SQFS_TRAVERSE_MT_UNLOCK(st);
+
+			err = SQFS_TRAVERSE_MT_STOPPED(st) ? SQFS_OK
+				: sqfs_traverse_mt_list(st, self, &d);
+			free(d.path);
+
+			SQFS_TRAVERSE_MT_LOCK(st);
+			if (err && !st->err) {
+				st->err = err;
+				SQFS_TRAVERSE_MT_SET_STOPPED(st);
+			}
+			if (--st->pending == 0)
+				SQFS_TRAVERSE_MT_WAKE_ALL(st);
+			SQFS_TRAVERSE_MT_UNLOCK(st);
+			continue;
+		}
+
+#ifdef SQFS_MULTITHREADED
+		/* Wait for something to steal, or for everyone to finish */
+		SQFS_TRAVERSE_MT_LOCK(st);
+		while (!st->queued && st->pending)
+			pthread_cond_wait(&st->cond, &st->lock);
+		if (!st->pending) {
+			SQFS_TRAVERSE_MT_UNLOCK(st);
+			return;
+		}
+		SQFS_TRAVERSE_MT_UNLOCK(st);
+#else
+		return;
+#endif
+	}
+}
+
+#ifdef SQFS_MULTITHREADED
+static void *sqfs_traverse_mt_thread_run(void *arg) {
+	sqfs_traverse_mt_thread *t = arg;
+	sqfs_traverse_mt_run(t->st, t->self);
+	return NULL;
+}
+#endif
+
+sqfs_err sqfs_traverse_mt(sqfs *fs, sqfs_inode_id iid, int threads,
+		sqfs_traverse_mt_fn fn, void *user) {
+	sqfs_traverse_mt_state st;
+	sqfs_err err;
+	char *root;
+	int i;
+
+#ifdef SQFS_MULTITHREADED
+	sqfs_traverse_mt_thread *ts;
+	int started;
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > SQFS_TRAVERSE_MT_MAX_THREADS)
+		threads = SQFS_TRAVERSE_MT_MAX_THREADS;
+#else
+	threads = 1;
+#endif
+
+	memset(&st, 0, sizeof(st));
+	st.fs = fs;
+	st.fn = fn;
+	st.user = user;
+	st.threads = threads;
+	if (!(st.queues = calloc(threads, sizeof(*st.queues))))
+		return SQFS_ERR;
+	if (!(root = malloc(1))) {
+		free(st.queues);
+		return SQFS_ERR;
+	}
+	root[0] = '\0';
+
+#ifdef SQFS_MULTITHREADED
+	if (!(ts = calloc(threads, sizeof(*ts)))) {
+		free(root);
+		free(st.queues);
+		return SQFS_ERR;
+	}
+	/* Every queue must be ready before anyone can steal from it */
+	pthread_mutex_init(&st.lock, NULL);
+	pthread_cond_init(&st.cond, NULL);
+	for (i = 0; i < threads; ++i)
+		pthread_mutex_init(&st.queues[i].lock, NULL);
+#endif
+
+	if ((err = sqfs_traverse_mt_push(&st, 0, iid, root))) {
+		free(root);
+		st.err = err;
+	} else {
+#ifdef SQFS_MULTITHREADED
+		/* This thread takes part too */
+		for (started = 1; started < threads; ++started) {
+			ts[started].st = &st;
+			ts[started].self = started;
+			if (pthread_create(&st.queues[started].thread, NULL,
+					sqfs_traverse_mt_thread_run, &ts[started]))
+				break;
+		}
+		sqfs_traverse_mt_run(&st, 0);
+		for (i = 1; i < started; ++i)
+			pthread_join(st.queues[i].thread, NULL);
+#else
+		sqfs_traverse_mt_run(&st, 0);
+#endif
+	}
+
+	for (i = 0; i < threads; ++i) {
+#ifdef SQFS_MULTITHREADED
+		pthread_mutex_destroy(&st.queues[i].lock);
+#endif
+		free(st.queues[i].dirs);
+	}
+	free(st.queues);
+#ifdef SQFS_MULTITHREADED
+	pthread_cond_destroy(&st.cond);
+	pthread_mutex_destroy(&st.lock);
+	free(ts);
+#endif
+	return st.err;
+}
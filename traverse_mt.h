@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2026 Dave Vasilevsky <dave@vasilevsky.ca>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SQFS_TRAVERSE_MT_H
+#define SQFS_TRAVERSE_MT_H
+
+#include "common.h"
+
+#include "dir.h"
+
+/* Walk a whole tree using several threads
+ *  - Each thread lists its own directories, and the subdirectories it finds
+ *    are queued for it
+ *  - A thread with nothing left steals the oldest queued directory from
+ *    another, which is usually the biggest subtree
+ *  - Entries are reported in no particular order, except that a directory
+ *    is always reported before anything inside it
+ *  - Single-threaded builds walk the tree in the calling thread
+ */
+
+/* Called for each entry, from any of the threads. The path is relative to
+ * the directory the walk started at. Return an error to stop the walk. */
+typedef sqfs_err (*sqfs_traverse_mt_fn)(void *user, const char *path,
+	sqfs_dir_entry *entry);
+
+/* Walk everything inside directory 'iid', but not the directory itself,
+ * with up to 'threads' threads. Returns once the walk is done, with the
+ * first error from reading the tree or from the callback. */
+sqfs_err sqfs_traverse_mt(sqfs *fs, sqfs_inode_id iid, int threads,
+	sqfs_traverse_mt_fn fn, void *user);
+
+#endif